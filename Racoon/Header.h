@@ -1,8 +1,15 @@
 ﻿#pragma once
 #include <windows.h>
 #include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_audio.h>
+#include <SDL2/SDL_ttf.h>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -14,6 +21,10 @@ extern "C" {
 #include <libavutil/channel_layout.h>
 }
 
+// libavfilter is only used by video.cpp (atempo)
+struct AVFilterGraph;
+struct AVFilterContext;
+
 #define MAX_FILES 5000
 
 struct ImageData {
@@ -43,6 +54,7 @@ int del(const wchar_t* filename);
 std::wstring attributesToString(DWORD attr);
 void filetimeToString(FILETIME ft, wchar_t* buffer, size_t len);
 std::string cc(const wchar_t* buf);
+std::wstring str_to_wstr(const std::string& str);
 bool goto_folder(wchar_t* path);
 void freeDriveLetters(wchar_t** drives, int driveCount);
 int scanDriveLetters(wchar_t*** drives);
@@ -59,6 +71,31 @@ bool loadWithAVIF(const wchar_t* imagePath, ImageData& imageData);
 
 void logError(const char* format, ...);
 
+// Per-frame renderer counters, reported for the last presented frame
+struct RenderStats {
+    int drawCalls = 0;
+    int primitives = 0;
+    int textQuads = 0;
+    int glyphsRasterized = 0;
+    int runCacheHits = 0;
+    int runCacheMisses = 0;
+};
+
+bool initTextRenderer(SDL_Renderer* renderer, TTF_Font* font);
+void shutdownTextRenderer();
+// Queued drawing; batches are flushed in order by presentFrame().
+// Direct SDL_Render* calls end up underneath anything already queued, so call
+// flushRenderBatches() first when drawing on top of queued content.
+void queuePoint(int x, int y, SDL_Color color);
+void queueLine(int x1, int y1, int x2, int y2, SDL_Color color);
+void queueRect(const SDL_Rect& rect, SDL_Color color, bool filled);
+void queueText(int x, int y, const std::wstring& text, SDL_Color color);
+void queueText(int x, int y, const char* text, SDL_Color color);
+int measureText(const std::wstring& text);
+void flushRenderBatches(SDL_Renderer* renderer);
+void presentFrame(SDL_Renderer* renderer);
+const RenderStats& getRenderStats();
+
 enum ImageSaveFormat {
     SAVE_FORMAT_PNG,
     SAVE_FORMAT_BMP,
@@ -70,33 +107,507 @@ enum ImageSaveFormat {
 
 bool saveImage(ImageData* imageData, const wchar_t* outputPath, ImageSaveFormat format, int jpegQuality);
 
+// Read-ahead file input for the demuxer (videoio.cpp). Local files are
+// memory-mapped; remote ones are read ahead into a ring by a background
+// thread. Pass avio() to the AVFormatContext as custom I/O.
+struct MediaReaderOptions {
+    size_t cacheBytes = 16 * 1024 * 1024;  // Read-ahead ring (not used when mapped)
+    bool allowMap = true;                  // Memory-map local files
+    int throttleKBps = 0;                  // > 0: limit the reader (testing slow media)
+};
+
+struct MediaReaderStats {
+    bool mapped = false;
+    size_t cacheBytes = 0;
+    size_t cached = 0;             // Bytes read ahead of the demuxer
+    uint64_t bytesRead = 0;        // From the file by the reader thread
+    uint64_t stalls = 0;           // Demuxer reads that had to wait for the reader
+    double stallMs = 0.0;
+    uint64_t restarts = 0;         // Seeks outside the cached window
+};
+
+class MediaReader {
+public:
+    MediaReader() {}
+    ~MediaReader();
+    MediaReader(const MediaReader&) = delete;
+    MediaReader& operator=(const MediaReader&) = delete;
+
+    bool open(const char* path, const MediaReaderOptions& readerOptions);
+    void close();
+    AVIOContext* avio() const { return avioContext; }
+    bool isLocal() const { return local; }     // Fixed or RAM drive (remote files are not mapped)
+    MediaReaderStats stats();
+
+private:
+    void readerMain();
+    int read(uint8_t* buffer, int size);
+    int64_t seek(int64_t offset, int whence);
+    static int readPacket(void* opaque, uint8_t* buffer, int size);
+    static int64_t seekCallback(void* opaque, int64_t offset, int whence);
+
+    MediaReaderOptions options;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+    const uint8_t* mapped = nullptr;
+    AVIOContext* avioContext = nullptr;
+    bool local = false;
+    int64_t fileSize = 0;
+    int64_t position = 0;          // Consumer (demuxer) position
+
+    // Ring mode; guarded by mutex. The ring holds [windowStart, fillEnd) of
+    // the file, at file offset modulo its size.
+    std::vector<uint8_t> ring;
+    std::thread readerThread;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool stop = false;
+    bool readError = false;
+    int64_t windowStart = 0;
+    int64_t fillEnd = 0;
+    int generation = 0;            // Bumped when a seek restarts the reader
+    MediaReaderStats counters;
+};
+
+// Shared audio output (audio.cpp): the one SDL_mixer device, used by Mix_
+// playback and, through a post-mix source, by video audio.
+struct AudioOutputOptions {
+    int frequency = 44100;         // Requested; the device may run at its native rate instead
+    int bufferSamples = 2048;      // Device buffer in sample frames
+    int targetLatencyMs = 0;       // > 0: choose the buffer size from this instead
+};
+
+struct AudioOutputInfo {
+    int frequency = 0;
+    Uint16 format = 0;
+    int channels = 0;
+    int bufferSamples = 0;
+    double bufferLatency = 0.0;    // One device buffer (s)
+    double measuredLatency = 0.0;  // Audio handed to the device but not yet heard (s)
+};
+
+typedef void (*AudioSourceCallback)(void* userdata, Uint8* stream, int len);
+
+bool openAudioOutput(const AudioOutputOptions& options);
+void closeAudioOutput();
+AudioOutputInfo getAudioOutputInfo();
+double getAudioOutputLatency();
+// Mixes callback's output into the device stream after Mix_ playback; nullptr detaches
+void setAudioOutputSource(AudioSourceCallback callback, void* userdata);
+// Output tap for visualization: keeps the latest mixed output as mono floats.
+// readAudioOutputTap copies the most recent `count` (<= 4096) samples and
+// fails while the tap is off or has not seen that many yet.
+void setAudioOutputTap(bool enabled);
+bool readAudioOutputTap(float* samples, int count);
+
+// Float kernels for the audio processing stage (audiodsp.cpp), SSE2 where
+// available. Samples are interleaved; counts are samples unless named frames.
+void scaleAudioSamples(float* samples, size_t count, float gain);
+void rampAudioSamples(float* samples, size_t frames, int channels, float from, float to);
+void downmixAudioToMono(float* samples, size_t frames, int channels);      // Every channel becomes the average
+void convertAudioToS16(const float* samples, int16_t* output, size_t count);   // x * 32768, rounded and saturated
+bool runAudioProcessingSelfTest();
+
+// Gapless playlist for the sound player (playlist.cpp). Tracks are streamed
+// through FFmpeg (openAudioStream); the next one is opened and buffered on a
+// loader thread while the current one plays through the Mix_ music hook, and
+// output runs from one into the other without a gap.
+struct PlaylistStatus {
+    bool active = false;           // Hooked into the output
+    bool finished = false;         // Last track played out
+    int index = -1;                // Track playing, into the paths given to startPlaylist
+    int count = 0;
+    std::wstring path;
+    double position = 0.0;         // Seconds, as heard
+    double duration = 0.0;         // Seconds, 0 if unknown
+    uint64_t underruns = 0;        // Callbacks the playing track's ring could not fill
+};
+
+// Fails (without skipping ahead) if paths[startIndex] cannot be decoded
+bool startPlaylist(const std::vector<std::wstring>& paths, int startIndex, int crossfadeMs);
+void stopPlaylist();
+void updatePlaylist();             // Main thread, once per frame
+void skipPlaylistTrack(int delta);
+void seekPlaylist(double deltaSeconds);
+PlaylistStatus getPlaylistStatus();
+bool runGaplessPlaylistTest();
+
+// Waveform overview and spectrum for the sound player (waveform.cpp). The
+// overview has one bucket per pixel column and is decoded in parallel time
+// segments; loadWaveformOverview goes through an on-disk cache checked
+// against the file's size and last write time.
+struct WaveformBucket {
+    float min = 0.0f;              // -1..1
+    float max = 0.0f;
+    float rms = 0.0f;
+};
+
+struct WaveformOverview {
+    std::wstring path;
+    double duration = 0.0;         // Seconds covered by the buckets
+    std::vector<WaveformBucket> buckets;
+};
+
+// threads <= 0: one per core, up to 8. Never touches the cache.
+bool computeWaveformOverview(const std::wstring& path, int columns, int threads, WaveformOverview& overview);
+bool loadWaveformOverview(const std::wstring& path, int columns, WaveformOverview& overview);
+// Background loadWaveformOverview for the main thread: a new request cancels
+// the previous one; takeWaveformOverview returns true once, with the result
+void requestWaveformOverview(const std::wstring& path, int columns);
+bool takeWaveformOverview(WaveformOverview& overview);
+bool waveformOverviewFailed();        // The current request ended without an overview
+void cancelWaveformOverview();
+// `count` log-spaced bands of the output tap's spectrum, each 0..1
+void computeAudioSpectrum(float* bands, int count);
+
+// Bounded, thread-safe FIFO of demuxed packets for one stream. put() blocks
+// while the queue is full; get() returns 1 with a packet, 0 if the queue is
+// empty, AVERROR_EOF once the demuxer hit end of file and the queue drained,
+// or AVERROR_EXIT after abort(). flush() starts a new serial (used for
+// seeks); get() reports the serial a packet was queued under.
+struct PacketQueueStats {
+    int depth = 0;
+    size_t bytes = 0;
+    int maxDepth = 0;
+    size_t maxBytesQueued = 0;
+    uint64_t packetsIn = 0;
+    uint64_t packetsOut = 0;
+    uint64_t packetsFlushed = 0;   // Dropped by flush(); in = out + flushed + depth
+    uint64_t underruns = 0;        // get() calls that found the queue empty
+    uint64_t shellAllocations = 0; // AVPacket shells allocated; flat once the queue is warm
+};
+
+class PacketQueue {
+public:
+    PacketQueue(int maxPackets, size_t maxBytes) : packets(maxPackets), maxPackets(maxPackets), maxBytes(maxBytes) {
+        spare.reserve(maxPackets);
+    }
+    ~PacketQueue();
+
+    bool put(AVPacket* packet);    // Moves the packet's reference into the queue
+    int get(AVPacket* packet, bool block, int* serial = nullptr);
+    void setEof();
+    void flush();
+    void abort();
+    void start();
+    PacketQueueStats stats();
+    int serial() const { return currentSerial.load(); }
+
+private:
+    struct QueuedPacket {
+        AVPacket* packet;
+        int serial;
+    };
+
+    bool fullLocked() const { return count >= maxPackets || bytes >= maxBytes; }
+
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::vector<QueuedPacket> packets;  // Ring of maxPackets entries, oldest at head
+    size_t head = 0;
+    int count = 0;
+    std::vector<AVPacket*> spare;  // Unreferenced shells for reuse
+    size_t bytes = 0;
+    const int maxPackets;
+    const size_t maxBytes;
+    bool eof = false;
+    bool aborted = false;
+    std::atomic<int> currentSerial{ 0 };
+    PacketQueueStats counters;
+};
+
+// Converted frames handed from the video decode worker to the render loop.
+// Single producer / single consumer: the worker only advances writeIndex, the
+// render loop only advances readIndex, so no lock is needed.
+#define VIDEO_FRAME_RING_SIZE 4
+#define VIDEO_DECODE_TIME_BUCKETS 8   // <1, <2, <4, <8, <16, <33, <66, >=66 ms
+
+// A slot either references the decoder's planes directly (YUV at display size)
+// or holds a copy that swscale scaled to the display size and/or converted.
+struct VideoFrameSlot {
+    AVFrame* frame = nullptr;      // Reference to the decoded source frame
+    bool converted = false;        // Image is in `image` rather than frame->data
+    AVFrame* image = nullptr;      // swscale output; its buffer is reused while the size holds
+    int width = 0;
+    int height = 0;
+    Uint32 format = SDL_PIXELFORMAT_UNKNOWN;
+    double pts = 0.0;
+    int serial = 0;                // Packet queue serial the frame was decoded under
+};
+
+struct VideoFrameRing {
+    VideoFrameSlot slots[VIDEO_FRAME_RING_SIZE];
+    std::atomic<uint32_t> writeIndex{ 0 };
+    std::atomic<uint32_t> readIndex{ 0 };
+
+    int occupancy() const {
+        return (int)(writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire));
+    }
+};
+
+// Lock-free single-producer/single-consumer PCM ring between the audio decode
+// thread (write) and the SDL audio callback (read). Indices count bytes and
+// only grow; capacity is a power of two. The producer drops stale audio after
+// a seek by moving discardIndex up to its write position; the consumer skips
+// to it on its next read.
+struct AudioRing {
+    uint8_t* data = nullptr;
+    uint32_t capacity = 0;
+    std::atomic<uint64_t> writeIndex{ 0 };
+    std::atomic<uint64_t> readIndex{ 0 };
+    std::atomic<uint64_t> discardIndex{ 0 };
+    // Stream time of the byte at baseIndex; set by the producer at the start
+    // of each serial, the playback position follows from the bytes read since
+    std::atomic<uint64_t> baseIndex{ 0 };
+    std::atomic<double> basePts{ 0.0 };
+    std::atomic<double> baseTempo{ 1.0 };          // Stream seconds per second of ring data (playback speed)
+    std::atomic<int> serial{ -1 };                 // Packet queue serial of the data in the ring
+    std::atomic<bool> primed{ false };             // Something was written this serial; empty reads now count as underruns
+    std::atomic<uint64_t> underruns{ 0 };          // Callbacks that could not be filled
+    std::atomic<uint32_t> minFill{ UINT32_MAX };   // Low-water mark seen by the callback (bytes)
+
+    bool allocate(uint32_t minBytes);
+    void release();
+    uint32_t write(const uint8_t* src, uint32_t len);  // Producer; returns bytes written (may be short when full)
+    uint32_t read(uint8_t* dst, uint32_t len);         // Consumer; returns bytes read
+    void discard();                                    // Producer; drop everything written so far
+    uint32_t fill() const {
+        return (uint32_t)(writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire));
+    }
+};
+
+// A decoded subtitle on the stream clock (subtitle.cpp). Bitmaps are in the
+// coordinates of a canvas, normally the video's size.
+struct SubtitleBitmap {
+    SDL_Rect area = { 0, 0, 0, 0 };
+    std::vector<uint32_t> pixels;                  // ARGB8888, area.w * area.h
+};
+
+struct SubtitleEvent {
+    uint64_t id = 0;
+    double start = 0.0;                            // Stream seconds
+    double end = -1.0;                             // < 0: until the next event
+    std::string text;                              // UTF-8, ASS markup removed, lines split by '\n'
+    std::vector<SubtitleBitmap> bitmaps;
+    int canvasWidth = 0;
+    int canvasHeight = 0;
+};
+
+// A video, audio or subtitle stream of the open file (VideoContext::tracks).
+// Unselected streams are discarded by the demuxer, so they are not read into
+// packets at all; selectAudioTrack and selectSubtitleTrack switch at runtime.
+struct MediaTrack {
+    int streamIndex = -1;
+    AVMediaType type = AVMEDIA_TYPE_UNKNOWN;
+    std::string codec;
+    std::string language;                          // ISO 639-2 from the container; empty if not tagged
+    std::string title;
+    bool isDefault = false;                        // AV_DISPOSITION_DEFAULT
+    int channels = 0;                              // Audio
+    int width = 0;                                 // Video
+    int height = 0;
+};
+
+// Video decoder configuration, set on VideoContext::decoderOptions before openVideoFile
+struct VideoDecoderOptions {
+    int threadCount = 0;           // 0 = one per logical core
+    bool frameThreads = true;      // FF_THREAD_FRAME (throughput, adds a frame of latency per thread)
+    bool sliceThreads = true;      // FF_THREAD_SLICE
+    bool lowDelay = false;         // Preview: AV_CODEC_FLAG_LOW_DELAY and no frame threading
+    std::string decoderName;       // e.g. "libdav1d"; empty = FFmpeg's default for the codec
+    bool yuvTextures = true;       // Upload YUV planes directly; false forces the swscale RGBA path
+    int convertThreads = 0;        // swscale slice threads; 0 = one per core, up to 8
+    bool fastStart = true;         // Bounded probing; full stream analysis continues in the background
+};
+
 struct VideoContext {
     AVFormatContext* formatContext = nullptr;
     AVCodecContext* videoCodecContext = nullptr;
     AVCodecContext* audioCodecContext = nullptr;
     int videoStreamIndex = -1;
-    int audioStreamIndex = -1;
+    std::atomic<int> audioStreamIndex{ -1 };       // Written by the demux thread on a track switch
     struct SwsContext* swsContext = nullptr;
     AVFrame* decodedFrame = nullptr;
-    AVFrame* rgbFrame = nullptr;
-    uint8_t* rgbBuffer = nullptr;
+    AVPacket* videoPacket = nullptr;               // Reused for every video packet
+    bool videoPacketPending = false;               // videoPacket was refused with EAGAIN and must be resent
 
     AVPacket* audioPacket = nullptr;
     AVFrame* decodedAudioFrame = nullptr;
-    uint8_t* audioBuffer = nullptr;
-    uint32_t audioBufferPos = 0;
+    uint8_t* audioBuffer = nullptr;                // Processed chunk in the output's S16
     uint32_t audioBufferSize = 0;
     uint32_t audioBufferAllocatedSize = 0;
-    SDL_AudioSpec desiredAudioSpec = { 0 };
-    SDL_AudioSpec obtainedAudioSpec = { 0 };
-    SDL_AudioDeviceID audioDevice = 0;
+    // swr converts to interleaved float at the output's rate and channel
+    // count; atempo, downmix and gain run on this, then one S16 conversion
+    // into audioBuffer. Sized from swr_get_out_samples at open.
+    float* audioFloatBuffer = nullptr;
+    int audioFloatFrames = 0;                      // Capacity in sample frames (audioBuffer holds as many)
+    double audioChunkDuration = 0.0;               // Stream seconds of the last decoded frame
+    float appliedGain = 1.0f;                      // Gain at the end of the last chunk, ramped from on a change
+    SDL_AudioSpec obtainedAudioSpec = { 0 };       // Format of the shared output
+    bool audioEnabled = false;                     // Audio is mixed into the shared output
     struct SwrContext* swrContext = nullptr;
+    int swrInputRate = 0;                          // What swrContext converts from; audioChannelLayout is the layout
+    int swrInputFormat = AV_SAMPLE_FMT_NONE;
+    // Time-stretch for playback speeds other than 1, on the resampled output
+    // (audio decode thread): abuffer -> atempo -> abuffersink
+    AVFilterGraph* tempoGraph = nullptr;
+    AVFilterContext* tempoSource = nullptr;
+    AVFilterContext* tempoSink = nullptr;
+    AVFrame* tempoFrame = nullptr;
+    double tempoRate = 1.0;                        // atempo factor the graph was built with
+    double tempoStartPts = 0.0;                    // Stream time of the graph's first input sample
+
+    // Audio is decoded and resampled on audioThread into audioRing; the
+    // output callback only mixes out of the ring
+    AudioRing audioRing;
+    uint8_t* audioMixBuffer = nullptr;             // Scratch for one device buffer, read from the ring then mixed
+    uint32_t audioMixBufferSize = 0;
+    std::thread audioThread;
+    std::atomic<bool> audioStop{ false };
+    std::atomic<bool> audioFinished{ false };      // Decoder drained at end of stream
 
     AVChannelLayout audioChannelLayout = { AV_CHANNEL_ORDER_UNSPEC, 0, { 0 }, nullptr };
 
-    uint64_t currentStreamPos = 0; // Tracks the current stream position
+    // Subtitles: packets of subtitleStreamIndex are decoded on the demux
+    // thread into subtitleEvents, which the render thread draws and prunes
+    std::atomic<int> subtitleStreamIndex{ -1 };
+    AVCodecContext* subtitleCodecContext = nullptr;
+    std::mutex subtitleMutex;
+    std::deque<SubtitleEvent> subtitleEvents;      // By start time
+    uint64_t subtitleEventCount = 0;
+
+    // Tracks. The render thread posts a switch; the demux thread applies it,
+    // then goes back to the switch position and reads again for the new
+    // stream only, passing over packets of the others it has already queued,
+    // so video plays on while the new audio (or subtitle) track catches up.
+    std::vector<MediaTrack> tracks;                // Set at open, by stream index
+    std::atomic<int> requestedAudioTrack{ -1 };
+    std::atomic<int> requestedSubtitleTrack{ -1 };
+    std::atomic<double> trackSwitchClock{ 0.0 };   // Master clock when the switch was requested
+    std::atomic<AVCodecContext*> switchedAudioDecoder{ nullptr };   // Opened by the demux thread; the audio thread adopts it on the new serial
+    std::atomic<double> audioResumePts{ -1.0 };    // After a switch: audio before this is dropped, like accurateSeekPts
+
+    std::string sourcePath;
+    double startTime = 0.0;                        // Seconds; stream timestamps start here
+    double duration = 0.0;                         // Seconds, 0 if unknown
 
     bool is_fullscreen = false; // Add this member to fix the error
+
+    VideoDecoderOptions decoderOptions;
+    MediaReaderOptions readerOptions;
+    bool audioOnly = false;                        // Sound player stream: no video, ring read by the caller (openAudioStream)
+    MediaReader reader;                            // Custom I/O under formatContext
+
+    // Demuxer thread feeding one packet queue per decoded stream
+    std::thread demuxThread;
+    std::atomic<bool> demuxStop{ false };
+    PacketQueue videoQueue{ 256, 32 * 1024 * 1024 };
+    PacketQueue audioQueue{ 512, 4 * 1024 * 1024 };
+    bool videoDraining = false;                    // NULL packet sent after the queue hit EOF
+
+    // Decode-ahead pipeline: the decode worker fills decodedRing, the convert
+    // worker turns those into displayable frames in frameRing
+    std::thread decodeThread;
+    std::thread convertThread;
+    std::atomic<bool> decodeStop{ false };
+    std::atomic<bool> decodeDone{ false };         // Decode worker exited
+    std::atomic<bool> decodeFinished{ false };     // Convert worker exited (EOF or error)
+    VideoFrameRing decodedRing;
+    int videoSerial = 0;                           // Serial of the last packet fed to the video decoder
+    std::atomic<int> videoEofSerial{ -1 };         // Serial whose video stream decoded to the end
+    std::atomic<double> displayClock{ 0.0 };       // Master clock at the last update, for late-frame skipping
+    VideoFrameRing frameRing;
+    std::atomic<int> decodeTimeHistogram[VIDEO_DECODE_TIME_BUCKETS] = {};
+    int ringOccupancyHistogram[VIDEO_FRAME_RING_SIZE + 1] = {};
+    std::atomic<int> decodedFrameCount{ 0 };
+    std::atomic<Uint64> decodeTicks{ 0 };          // Performance-counter ticks spent in decodeVideoFrame
+    std::atomic<Uint64> convertTicks{ 0 };         // Ticks spent handing frames to the ring (ref or swscale)
+    std::atomic<int> convertedFrameCount{ 0 };     // Frames handed to the ring
+    std::atomic<uint64_t> bufferAllocations{ 0 };  // Conversion and audio buffers (re)allocated; flat once playing
+    Uint64 uploadTicks = 0;                        // Ticks spent in texture uploads on the render thread
+    int uploadedFrames = 0;
+    SDL_YUV_CONVERSION_MODE yuvConversionMode = SDL_YUV_CONVERSION_BT601;
+
+    // On-screen size of the video rect in output pixels; frames larger than
+    // this are scaled down on the worker. 0 = source size.
+    std::atomic<int> targetWidth{ 0 };
+    std::atomic<int> targetHeight{ 0 };
+
+    // Playback speed, 0.5..4 (setVideoSpeed); kept across files like decoderOptions.
+    // Above 1x, frames the display cannot show are not converted, and
+    // non-reference frames are not decoded once the source outruns it.
+    std::atomic<double> playbackSpeed{ 1.0 };
+    std::atomic<int> thinnedFrames{ 0 };
+    // Volume 0..1 (setVideoVolume), mute and mono downmix, also kept across
+    // files. Applied as audio is decoded, so a change is heard once the ring
+    // ahead of the output has played out.
+    std::atomic<float> volume{ 1.0f };
+    std::atomic<bool> muted{ false };
+    std::atomic<bool> downmixMono{ false };
+
+    // Pause. The frame on screen is re-converted once at high quality.
+    std::atomic<bool> paused{ false };
+    double pausedClock = 0.0;
+    AVFrame* shownFrame = nullptr;                 // Source of the frame on screen (render thread)
+    struct SwsContext* refineSwsContext = nullptr;
+    VideoFrameSlot refineSlot;
+    bool refined = false;
+
+    // Seeking. seekVideo() posts the target and flushes the packet queues,
+    // which starts a new serial; the demuxer performs the seek, decoders flush
+    // on the first packet of the new serial and stale frames are discarded.
+    std::atomic<int> seekRequests{ 0 };            // Bumped by seekVideo()
+    std::atomic<int> seeksCompleted{ 0 };          // Last request the demuxer has carried out
+    std::atomic<double> seekTarget{ 0.0 };
+    std::atomic<bool> seekAccurate{ true };
+    std::atomic<double> accurateSeekPts{ -1.0 };   // Frames before this are decoded but not shown
+    std::atomic<int> seekDecodedFrames{ 0 };       // Frames decoded forward from the keyframe
+    int audioSerial = 0;                           // Serial of the last packet fed to the audio decoder
+    Uint64 seekStartCounter = 0;
+    bool seekPending = false;                      // Waiting for the first frame after a seek
+    int seekCount = 0;
+    double lastSeekMs = 0.0;
+    double seekLatencyTotalMs = 0.0;
+    double seekLatencyMaxMs = 0.0;
+    int seekDecodedTotal = 0;
+
+    // Keyframe index, built on a background thread after the first seek
+    std::thread keyframeThread;
+    std::atomic<bool> keyframeStop{ false };
+    std::mutex keyframeMutex;
+    std::vector<int64_t> keyframes;                // Keyframe PTS in the video stream time base, ascending
+    bool keyframeIndexComplete = false;
+
+    // Fast start: stream analysis skipped or bounded at open, then redone in
+    // full on a background thread whose results updateVideoPlayback applies
+    std::thread streamInfoThread;
+    std::atomic<bool> streamInfoStop{ false };
+    std::atomic<bool> streamInfoReady{ false };
+    std::atomic<double> analyzedStartTime{ 0.0 };
+    std::atomic<double> analyzedDuration{ 0.0 };
+    Uint64 openStartCounter = 0;                   // SDL_GetPerformanceCounter() at openVideoFile
+    double timeToFirstFrameMs = 0.0;
+
+    // Presentation clock. Audio is the master when a device is open; otherwise
+    // (or before the first callback) a wall clock started at the first frame.
+    double audioBufferPts = 0.0;                   // PTS (s) of the first byte in audioBuffer (audio decode thread)
+    std::atomic<double> audioClockPts{ 0.0 };      // Audio position at audioClockCounter
+    std::atomic<Uint64> audioClockCounter{ 0 };    // SDL_GetPerformanceCounter() of the last callback
+    std::atomic<bool> audioClockValid{ false };
+    Uint64 wallClockStart = 0;
+    double wallClockStartPts = 0.0;
+    double fixedClockStep = 0.0;                   // > 0: advance the clock by this much per update (headless)
+    double fixedClock = 0.0;
+
+    double frameDuration = 1.0 / 30.0;             // From the stream frame rate
+    bool hasShownFrame = false;
+
+    // Sync statistics
+    double clockDrift = 0.0;                       // Last presented frame PTS minus master clock (s)
+    int presentedFrames = 0;
+    std::atomic<int> droppedFrames{ 0 };           // Late frames skipped by the worker or the render loop
+    int repeatedFrames = 0;
 };
 
 extern "C" void audioCallback(void* userdata, uint8_t* stream, int len);
@@ -104,8 +615,117 @@ extern "C" void audioCallback(void* userdata, uint8_t* stream, int len);
 bool initializeFFmpeg();
 bool openVideoFile(const char* filePath, VideoContext& videoCtx);
 void closeVideoFile(VideoContext& videoCtx);
-bool decodeVideoFrame(VideoContext& videoCtx, SDL_Texture** videoTexture, SDL_Renderer* renderer);
+int decodeVideoFrame(VideoContext& videoCtx);
+bool updateVideoPlayback(VideoContext& videoCtx, SDL_Texture** videoTexture, SDL_Renderer* renderer);
+double getMasterClock(VideoContext& videoCtx);
+void setVideoTargetSize(VideoContext& videoCtx, int width, int height);
+void setVideoPaused(VideoContext& videoCtx, bool paused);
+void seekVideo(VideoContext& videoCtx, double seconds, bool accurate);
+void setVideoSpeed(VideoContext& videoCtx, double speed);
+void setVideoVolume(VideoContext& videoCtx, float volume);
 bool decodeNextAudioPacket(VideoContext& videoCtx);
+// Streaming audio for the sound player: the demux and audio decode threads
+// of a video, without the video. Decoded audio waits in audioRing for the
+// caller instead of going to the output; seek with seekVideo.
+bool openAudioStream(const char* filePath, VideoContext& videoCtx);
+double getAudioStreamPosition(const VideoContext& videoCtx);
+// Track switching. Both return at once (false if the stream is not a track
+// of that type); the demux thread does the switch, or nothing if the stream
+// is already playing. Subtitle stream -1 turns them off.
+bool selectAudioTrack(VideoContext& videoCtx, int streamIndex);
+bool selectSubtitleTrack(VideoContext& videoCtx, int streamIndex);
+std::string describeMediaTrack(const MediaTrack& track);   // e.g. eng aac 6ch "Commentary"
+// Subtitles (subtitle.cpp). The decoder side runs on the demux thread;
+// drawVideoSubtitles draws the events active at `clock` over the video in
+// videoRect (logical coordinates). Each event is turned into a texture once,
+// when it first shows, and reused until it ends.
+bool openSubtitleDecoder(VideoContext& videoCtx, int streamIndex);
+void closeSubtitleDecoder(VideoContext& videoCtx);
+void decodeSubtitlePacket(VideoContext& videoCtx, AVPacket* packet);
+void flushSubtitles(VideoContext& videoCtx);
+void drawVideoSubtitles(SDL_Renderer* renderer, VideoContext& videoCtx, const SDL_Rect& videoRect, double clock);
+void shutdownSubtitleRenderer();
+// Fast preview decode, independent of any open VideoContext: `count`
+// keyframes spread evenly over the file, decoded at reduced resolution and
+// scaled to at most maxWidth pixels wide (RGBA). Appends to `frames`; free
+// each with freeImageData.
+bool extractVideoPreview(const char* filePath, int count, int maxWidth, std::vector<ImageData>& frames);
+// Stills at source resolution (framegrab.cpp). saveVideoSnapshot references
+// the frame on screen and returns at once; a worker converts and saves it.
+// False if no frame has been shown yet.
+bool saveVideoSnapshot(const VideoContext& videoCtx, const std::wstring& outputPath, ImageSaveFormat format, int quality);
+int pendingVideoSnapshots();
+void shutdownVideoSnapshots();        // Finishes the queued snapshots first
+const wchar_t* imageSaveExtension(ImageSaveFormat format);
+bool parseImageSaveFormat(const wchar_t* name, ImageSaveFormat* format);
+// Batch export of every Nth frame (everyNth > 0) or every keyframe (0) into
+// outputDir as <name>_<frame number>.<ext>, decoded in parallel time
+// segments (threads <= 0: one per core, up to 8). Returns the frames saved, -1 on error.
+int extractVideoFrames(const std::wstring& path, const std::wstring& outputDir, int everyNth, ImageSaveFormat format, int quality, int threads);
+// Time-to-first-frame benchmark: opens filePath in a private VideoContext and
+// returns the milliseconds until the first frame is decoded and converted,
+// or -1 on failure or after a 10 s timeout.
+double measureTimeToFirstFrame(const char* filePath, const VideoDecoderOptions& options, const MediaReaderOptions& readerOptions);
+// Decode throughput benchmark: decodes the first `frames` frames of the video
+// stream with `options` (threading, decoder), without conversion or display.
+// Returns frames per second, or -1 on failure.
+double measureDecodeFps(const char* filePath, const VideoDecoderOptions& options, int frames);
+// Scaling benchmark: converts a synthetic srcWidth x srcHeight 4:2:0 frame to
+// dstWidth x dstHeight `frames` times the way the convert stage does (YUV or
+// RGBA output, swscale threads from options.convertThreads). Returns ms per
+// frame, or -1 on failure.
+double measureScaleCost(int srcWidth, int srcHeight, int dstWidth, int dstHeight, bool yuvOutput,
+    const VideoDecoderOptions& options, int frames);
+// Demux stress test: plays filePath headless as fast as it decodes, seeking
+// `seeks` times across it along the way and then on to the end, and checks
+// the packet queues (every packet taken out or flushed, high-water marks)
+// and the frames (serial and position after each seek). Logs the results;
+// returns true if nothing was lost or out of place.
+bool runDemuxStressTest(const char* filePath, int seeks);
+// Headless playback run for benchmarks and checks: plays filePath in a
+// private VideoContext through updateVideoPlayback, uploading frames to
+// `renderer` if there is one, and returns the counters gathered after the
+// warm-up. False if the file cannot be opened.
+struct VideoPlaybackSetup {
+    VideoDecoderOptions decoderOptions;
+    MediaReaderOptions readerOptions;
+    int targetWidth = 0;                           // On-screen size to scale to (setVideoTargetSize); 0 = source size
+    int targetHeight = 0;
+    bool realTime = true;                          // Paced by the clock and audio output; false = every frame, as fast as it decodes
+    double warmupSeconds = 2.0;                    // Stream time played before counting
+    double seconds = 10.0;                         // Stream time counted
+};
+
+struct VideoPlaybackRun {
+    double seconds = 0.0;                          // Wall time counted
+    bool reachedEnd = false;                       // The file ended first
+    bool hasAudio = false;                         // Audio was mixed into the shared output
+    int width = 0;                                 // Source frame size
+    int height = 0;
+    double frameDuration = 0.0;                    // Frame interval of the stream: the per-frame budget (s)
+    int presentedFrames = 0;
+    int droppedFrames = 0;
+    int repeatedFrames = 0;
+    int decodedFrames = 0;
+    int convertedFrames = 0;
+    double decodeMs = 0.0;                         // Decoder time, over decodedFrames
+    double convertMs = 0.0;                        // Convert stage time, over convertedFrames
+    uint64_t audioUnderruns = 0;
+    uint64_t readerStalls = 0;
+    double readerStallMs = 0.0;
+    uint64_t allocations = 0;                      // Packet shells plus conversion and audio buffers
+};
+bool runVideoPlayback(const char* filePath, const VideoPlaybackSetup& setup, SDL_Renderer* renderer, VideoPlaybackRun& run);
+// Demux cost benchmark: reads filePath to the end without decoding, either
+// every stream or only the tracks openVideoFile would select (the rest set to
+// AVDISCARD_ALL). Returns false if the file cannot be opened.
+struct DemuxCost {
+    int64_t packets = 0;
+    int64_t packetBytes = 0;                       // Payload handed out by av_read_frame
+    int64_t bytesRead = 0;                         // From the I/O layer
+    double ms = 0.0;
+};
+bool measureDemuxCost(const char* filePath, bool selectedOnly, DemuxCost& cost);
 // Add the missing #if directive
 #ifdef __cplusplus
 #endif
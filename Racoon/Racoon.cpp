@@ -8,6 +8,10 @@
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <shellapi.h> // For CommandLineToArgvW
+#include <psapi.h>    // For GetProcessMemoryInfo (streaming benchmark)
+#pragma comment(lib, "shell32.lib")
+#pragma comment(lib, "psapi.lib")
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 #include <SDL2/SDL_mixer.h>
@@ -86,9 +90,53 @@ VideoContext g_videoContext; // Manages FFmpeg state for the current video
 SDL_Texture* g_videoTexture = nullptr; // Texture to render video frames
 // void* g_videoStream = nullptr; // This will be replaced by g_videoContext
 std::wstring g_currentPlayingVideoPath;
+ImageSaveFormat g_snapshotFormat = SAVE_FORMAT_PNG;   // Video snapshots and frame export
+std::wstring g_videoMessage;                          // Shown briefly in the video player (snapshots, track switches)
+Uint32 g_videoMessageTicks = 0;
+bool g_showSubtitles = true;                          // T in the video player
 
 static bool showDrives = false;
 
+// Headless mode (--headless): no window, software renderer on an offscreen
+// surface, dummy audio, fixed frame count. Used for benchmarks and captures.
+struct HeadlessOptions {
+    bool enabled = false;
+    int frames = 120;              // Frames to render before exiting
+    int captureEvery = 0;          // Capture every Nth frame; 0 = last frame only
+    std::wstring captureDir;       // Where frame_NNNNN.png files go; empty = no capture
+    std::wstring openPath;         // File to open as if chosen in the browser
+    int cpuLoadThreads = 0;        // Busy threads competing with playback
+    std::wstring filmstripPath;    // Time a 10-frame keyframe preview of this file at startup
+    std::wstring ttffDir;          // Time-to-first-frame of every video in this folder, full probe vs fast start
+    bool gaplessTest = false;      // Check the playlist hook for gaps at the sample level
+    std::wstring audioBenchPath;   // Stream this sound file for a minute, logging CPU time and memory
+    bool audioSelfTest = false;    // Check the audio processing kernels and resampler output counts
+    std::wstring waveformBenchPath; // Time the waveform overview of this file at several thread counts
+    std::wstring trackBenchPath;   // Demux this file with every stream, then with only the selected tracks
+    std::wstring demuxStressPath;  // Decode this (long) file to the end with seeks, checking the packet queues
+    std::wstring decodeBenchDir;   // Decode fps of every video in this folder at 1, 2, 4 and one-per-core threads
+    std::wstring textBenchPath;    // Draw this file in the text and hex viewers, logging draw calls and frame time
+    std::wstring allocCheckPath;   // Play this video and fail if the player still allocates after warm-up
+    std::wstring underrunTestPath; // Play this video under CPU load and fail on any audio underrun
+    std::wstring throttleTestPath; // Play this video through a throttled reader, logging stalls and dropped frames
+    std::wstring convertBenchPath; // Convert time per frame of this (4K) video at 1, 2, 4 and one-per-core swscale threads
+    bool scaleBench = false;       // Time the swscale step for a fixed set of source and window sizes
+    std::wstring extractPath;      // Export frames of this video, then continue
+    int extractEvery = 0;          // Every Nth frame; 0 = keyframes
+    std::wstring extractDir;       // Default: <video name>_frames next to the video
+};
+static HeadlessOptions g_headless;
+static AudioOutputOptions g_audioOutputOptions;
+static int g_crossfadeMs = 0;      // Sound player playlist; 0 = gapless cut
+static SDL_Surface* g_headlessSurface = nullptr;
+static std::vector<std::thread> g_cpuLoadThreads;
+static std::atomic<bool> g_cpuLoadStop{ false };
+static bool showRenderStats = false; // F3 overlay
+
+// Video seek bar scrubbing
+static bool g_scrubbing = false;
+static Uint32 g_lastScrubTicks = 0;
+
 // Double-click detection
 static Uint32 lastClickTime = 0;
 static int lastClickX = -1;
@@ -113,6 +161,15 @@ std::string wstr_to_str(const std::wstring& wstr) {
     return strTo;
 }
 
+// And back, for UTF-8 from FFmpeg metadata
+std::wstring str_to_wstr(const std::string& str) {
+    if (str.empty()) return L"";
+    int size_needed = MultiByteToWideChar(CP_UTF8, 0, &str[0], (int)str.size(), NULL, 0);
+    std::wstring wstrTo(size_needed, 0);
+    MultiByteToWideChar(CP_UTF8, 0, &str[0], (int)str.size(), &wstrTo[0], size_needed);
+    return wstrTo;
+}
+
 
 
 // Initialize SDL2, SDL_ttf, SDL_mixer, and create a borderless window with a renderer
@@ -121,6 +178,12 @@ bool initSDL(const std::string & title, int width, int height, SDL_Window * &out
     outRenderer = nullptr;
     outFont = nullptr;
 
+    if (g_headless.enabled) {
+        // Dummy drivers keep headless runs independent of the desktop and sound card
+        SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+        SDL_SetHint(SDL_HINT_AUDIODRIVER, "dummy");
+    }
+
     // Initialize SDL with video and audio subsystems
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
         logError("SDL_Init failed: %s", SDL_GetError());
@@ -139,8 +202,8 @@ bool initSDL(const std::string & title, int width, int height, SDL_Window * &out
         logError("Mix_Init failed to initialize all loaders: %s", Mix_GetError());
     }
 
-    if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0) {
-        logError("Mix_OpenAudio failed: %s", Mix_GetError());
+    // One device for Mix_ playback and video audio
+    if (!openAudioOutput(g_audioOutputOptions)) {
         while (Mix_Init(0)) Mix_Quit();
         TTF_Quit();
         SDL_Quit();
@@ -154,48 +217,77 @@ bool initSDL(const std::string & title, int width, int height, SDL_Window * &out
         logError("Driver %d: %s", i, SDL_GetVideoDriver(i));
     }
 
-    SDL_Window* window = SDL_CreateWindow(
-        title.c_str(),
-        SDL_WINDOWPOS_CENTERED,
-        SDL_WINDOWPOS_CENTERED,
-        width,
-        height,
-        SDL_WINDOW_BORDERLESS | SDL_WINDOW_SHOWN
-    );
-    if (!window) {
-        logError("Borderless window creation failed: %s", SDL_GetError());
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
+
+    if (g_headless.enabled) {
+        // No window: render with the software renderer into an offscreen surface
+        g_headlessSurface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32);
+        if (!g_headlessSurface) {
+            logError("Headless surface creation failed: %s", SDL_GetError());
+            closeAudioOutput();
+            while (Mix_Init(0)) Mix_Quit();
+            TTF_Quit();
+            SDL_Quit();
+            return false;
+        }
+        renderer = SDL_CreateSoftwareRenderer(g_headlessSurface);
+        if (!renderer) {
+            logError("Headless software renderer creation failed: %s", SDL_GetError());
+            SDL_FreeSurface(g_headlessSurface);
+            g_headlessSurface = nullptr;
+            closeAudioOutput();
+            while (Mix_Init(0)) Mix_Quit();
+            TTF_Quit();
+            SDL_Quit();
+            return false;
+        }
+        logError("Headless mode: software renderer on %dx%d offscreen surface.", width, height);
+    }
+    else {
         window = SDL_CreateWindow(
             title.c_str(),
             SDL_WINDOWPOS_CENTERED,
             SDL_WINDOWPOS_CENTERED,
             width,
             height,
-            SDL_WINDOW_SHOWN
+            SDL_WINDOW_BORDERLESS | SDL_WINDOW_SHOWN
         );
         if (!window) {
-            logError("Standard window creation failed: %s", SDL_GetError());
-            Mix_CloseAudio();
+            logError("Borderless window creation failed: %s", SDL_GetError());
+            window = SDL_CreateWindow(
+                title.c_str(),
+                SDL_WINDOWPOS_CENTERED,
+                SDL_WINDOWPOS_CENTERED,
+                width,
+                height,
+                SDL_WINDOW_SHOWN
+            );
+            if (!window) {
+                logError("Standard window creation failed: %s", SDL_GetError());
+                closeAudioOutput();
+                while (Mix_Init(0)) Mix_Quit();
+                TTF_Quit();
+                SDL_Quit();
+                return false;
+            }
+            logError("Fallback to standard window succeeded.");
+        }
+
+        renderer = SDL_CreateRenderer(
+            window,
+            -1,
+            SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC
+        );
+        if (!renderer) {
+            logError("Renderer creation failed: %s", SDL_GetError());
+            SDL_DestroyWindow(window);
+            closeAudioOutput();
             while (Mix_Init(0)) Mix_Quit();
             TTF_Quit();
             SDL_Quit();
             return false;
         }
-        logError("Fallback to standard window succeeded.");
-    }
-
-    SDL_Renderer* renderer = SDL_CreateRenderer(
-        window,
-        -1,
-        SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC
-    );
-    if (!renderer) {
-        logError("Renderer creation failed: %s", SDL_GetError());
-        SDL_DestroyWindow(window);
-        Mix_CloseAudio();
-        while (Mix_Init(0)) Mix_Quit();
-        TTF_Quit();
-        SDL_Quit();
-        return false;
     }
 
     if (SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND) != 0) {
@@ -215,7 +307,7 @@ bool initSDL(const std::string & title, int width, int height, SDL_Window * &out
             logError("TTF_OpenFont failed for system arial.ttf: %s", TTF_GetError());
             SDL_DestroyRenderer(renderer);
             SDL_DestroyWindow(window);
-            Mix_CloseAudio();
+            closeAudioOutput();
             while (Mix_Init(0)) Mix_Quit();
             TTF_Quit();
             SDL_Quit();
@@ -224,6 +316,18 @@ bool initSDL(const std::string & title, int width, int height, SDL_Window * &out
         logError("Fallback to system arial.ttf succeeded.");
     }
 
+    if (!initTextRenderer(renderer, font)) {
+        logError("initTextRenderer failed.");
+        TTF_CloseFont(font);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        closeAudioOutput();
+        while (Mix_Init(0)) Mix_Quit();
+        TTF_Quit();
+        SDL_Quit();
+        return false;
+    }
+
     if (SDL_SetRenderDrawColor(renderer, 33, 33, 33, 100) != 0) {
         logError("SetRenderDrawColor failed: %s", SDL_GetError());
     }
@@ -241,6 +345,10 @@ bool initSDL(const std::string & title, int width, int height, SDL_Window * &out
 // Clean up SDL resources
 void cleanupSDL(SDL_Window * window, SDL_Renderer * renderer, TTF_Font * font) {
     logError("Starting application cleanup..."); // Simple string
+    stopPlaylist();
+    cancelWaveformOverview();
+    shutdownVideoSnapshots();
+    shutdownSubtitleRenderer();
     if (g_currentMusic) {
         Mix_HaltMusic();
         Mix_FreeMusic(g_currentMusic);
@@ -258,116 +366,162 @@ void cleanupSDL(SDL_Window * window, SDL_Renderer * renderer, TTF_Font * font) {
     // Remove old g_videoStream cleanup:
     // if (g_videoStream) { free(g_videoStream); g_videoStream = nullptr; ... }
 
-    Mix_CloseAudio();
+    closeAudioOutput();
     while (Mix_Init(0)) Mix_Quit();
+    shutdownTextRenderer();
     if (font) TTF_CloseFont(font);
     if (renderer) SDL_DestroyRenderer(renderer);
     if (window) SDL_DestroyWindow(window);
+    if (g_headlessSurface) {
+        SDL_FreeSurface(g_headlessSurface);
+        g_headlessSurface = nullptr;
+    }
     TTF_Quit();
     SDL_Quit();
     logError("Application cleanup complete."); // Simple string
 }
 
-// Render text using SDL_ttf
+// Render text through the glyph atlas (queued, drawn in presentFrame)
 void renderText(SDL_Renderer * renderer, TTF_Font * font, const std::wstring & text, int x, int y) {
     if (text.empty()) return;
     SDL_Color color = { 255, 255, 255, 255 };
-    SDL_Surface* surface = TTF_RenderUNICODE_Solid(font, (const Uint16*)text.c_str(), color);
-    if (!surface) {
-        logError("TTF_RenderUNICODE_Solid failed: %s", TTF_GetError());
-        return;
-    }
-    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-    if (!texture) {
-        logError("CreateTextureFromSurface failed: %s", SDL_GetError());
-        SDL_FreeSurface(surface);
-        return;
-    }
-    SDL_Rect dst = { x, y, surface->w, surface->h };
-    SDL_RenderCopy(renderer, texture, nullptr, &dst);
-    SDL_FreeSurface(surface);
-    SDL_DestroyTexture(texture);
+    queueText(x, y, text, color);
 }
 
 void Text(int x, int y, const std::wstring & text, int r, int g, int b) {
     if (text.empty()) return;
     SDL_Color color = { (Uint8)r, (Uint8)g, (Uint8)b, 255 };
-    SDL_Surface* surface = TTF_RenderUNICODE_Solid(font, (const Uint16*)text.c_str(), color);
-    if (!surface) {
-        logError("TTF_RenderUNICODE_Solid failed: %s", TTF_GetError());
-        return;
-    }
-    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-    if (!texture) {
-        logError("CreateTextureFromSurface failed: %s", SDL_GetError());
-        SDL_FreeSurface(surface);
-        return;
-    }
-    SDL_Rect dst = { x, y, surface->w, surface->h };
-    SDL_RenderCopy(renderer, texture, nullptr, &dst);
-    SDL_FreeSurface(surface);
-    SDL_DestroyTexture(texture);
+    queueText(x, y, text, color);
 }
 
 void Text(const char* text, int x, int y, int r, int g, int b) {
     if (!text || !*text) return;
     SDL_Color color = { (Uint8)r, (Uint8)g, (Uint8)b, 255 };
-    SDL_Surface* surface = TTF_RenderText_Blended(font, text, color);
-    if (!surface) {
-        logError("TTF_RenderText_Blended failed: %s", TTF_GetError());
-        return;
-    }
-    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-    if (!texture) {
-        logError("CreateTextureFromSurface failed: %s", SDL_GetError());
-        SDL_FreeSurface(surface);
-        return;
-    }
-    SDL_Rect dest = { x, y, surface->w, surface->h };
-    SDL_RenderCopy(renderer, texture, nullptr, &dest);
-    SDL_FreeSurface(surface);
-    SDL_DestroyTexture(texture);
+    queueText(x, y, text, color);
 }
 
 // Set a single pixel
 void pixel(int x, int y, Uint8 r, Uint8 g, Uint8 b, Uint8 alpha) {
     if (x < 0 || x >= X || y < 0 || y >= Y) return;
-    if (SDL_SetRenderDrawColor(renderer, r, g, b, alpha) != 0) {
-        logError("setpixel: SetRenderDrawColor failed: %s", SDL_GetError());
-    }
-    if (SDL_RenderDrawPoint(renderer, x, y) != 0) {
-        logError("setpixel: RenderDrawPoint failed: %s", SDL_GetError());
-    }
+    queuePoint(x, y, SDL_Color{ r, g, b, alpha });
 }
 
 // Bresenham line
 void line(int x1, int y1, int x2, int y2, Uint8 r, Uint8 g, Uint8 b, Uint8 a) {
-    int dx = abs(x2 - x1), dy = abs(y2 - y1);
-    int sx = x1 < x2 ? 1 : -1;
-    int sy = y1 < y2 ? 1 : -1;
-    int err = dx - dy;
-
-    while (true) {
-        pixel(x1, y1, r, g, b, a);
-        if (x1 == x2 && y1 == y2) break;
-        int e2 = 2 * err;
-        if (e2 > -dy) { err -= dy; x1 += sx; }
-        if (e2 < dx) { err += dx; y1 += sy; }
-    }
+    queueLine(x1, y1, x2, y2, SDL_Color{ r, g, b, a });
 }
 
 // Filled rectangle
 void Rectanglefull(int x1, int y1, int x2, int y2, Uint8 r, Uint8 g, Uint8 b, Uint8 a) {
     SDL_Rect rect = { x1, y1, x2 - x1 + 1, y2 - y1 + 1 };
-    SDL_SetRenderDrawColor(renderer, r, g, b, a);
-    SDL_RenderFillRect(renderer, &rect);
+    queueRect(rect, SDL_Color{ r, g, b, a }, true);
 }
 
 // Outline rectangle
 void Rectangle(int x1, int y1, int x2, int y2, Uint8 r, Uint8 g, Uint8 b, Uint8 a) {
-    SDL_SetRenderDrawColor(renderer, r, g, b, a);
     SDL_Rect rect = { x1, y1, x2 - x1 + 1, y2 - y1 + 1 };
-    SDL_RenderDrawRect(renderer, &rect);
+    queueRect(rect, SDL_Color{ r, g, b, a }, false);
+}
+
+// Video seek bar, above the controls line
+static const int SEEKBAR_X1 = 10;
+static const int SEEKBAR_X2 = X - 10;
+static const int SEEKBAR_Y = Y - 40;
+static const int SEEKBAR_H = 6;
+
+static bool isOnSeekBar(int mx, int my) {
+    return g_videoContext.duration > 0.0 &&
+        mx >= SEEKBAR_X1 && mx <= SEEKBAR_X2 && my >= SEEKBAR_Y - 6 && my <= SEEKBAR_Y + SEEKBAR_H + 6;
+}
+
+// Seek to the position under mx. Keyframe seeks while dragging, accurate on release.
+static void scrubVideoTo(int mx, bool accurate) {
+    double fraction = (double)(mx - SEEKBAR_X1) / (double)(SEEKBAR_X2 - SEEKBAR_X1);
+    if (fraction < 0.0) fraction = 0.0;
+    if (fraction > 1.0) fraction = 1.0;
+    seekVideo(g_videoContext, g_videoContext.startTime + fraction * g_videoContext.duration, accurate);
+    g_lastScrubTicks = SDL_GetTicks();
+}
+
+static void drawSeekBar() {
+    if (g_videoContext.duration <= 0.0) return;
+    double position = getMasterClock(g_videoContext) - g_videoContext.startTime;
+    if (position < 0.0) position = 0.0;
+    if (position > g_videoContext.duration) position = g_videoContext.duration;
+    int filled = (int)((SEEKBAR_X2 - SEEKBAR_X1) * (position / g_videoContext.duration));
+    Rectanglefull(SEEKBAR_X1, SEEKBAR_Y, SEEKBAR_X2, SEEKBAR_Y + SEEKBAR_H - 1, 60, 60, 60, 255);
+    if (filled > 0) Rectanglefull(SEEKBAR_X1, SEEKBAR_Y, SEEKBAR_X1 + filled, SEEKBAR_Y + SEEKBAR_H - 1, 0, 160, 255, 255);
+
+    char timeLine[32];
+    int pos = (int)position, total = (int)g_videoContext.duration;
+    snprintf(timeLine, sizeof(timeLine), "%d:%02d / %d:%02d", pos / 60, pos % 60, total / 60, total % 60);
+    Text(timeLine, SEEKBAR_X2 - 110, SEEKBAR_Y - 20, 200, 200, 200);
+}
+
+// Step through the playback speeds offered by [ and ]
+static void stepVideoSpeed(int direction) {
+    static const double speeds[] = { 0.5, 0.75, 1.0, 1.25, 1.5, 2.0, 2.5, 3.0, 4.0 };
+    const int count = (int)(sizeof(speeds) / sizeof(speeds[0]));
+    double current = g_videoContext.playbackSpeed.load();
+    int index = 0;
+    while (index + 1 < count && speeds[index] < current - 0.001) index++;
+    if (direction > 0 && speeds[index] <= current + 0.001) index = std::min(index + 1, count - 1);
+    if (direction < 0) index = std::max(index - 1, 0);
+    setVideoSpeed(g_videoContext, speeds[index]);
+}
+
+// Next audio track (A) or subtitle track (Shift+T, with "off" after the
+// last one), announced on screen. A switch still in flight counts as made,
+// so pressing again moves on from it.
+static void cycleVideoTrack(AVMediaType type) {
+    bool subtitles = type == AVMEDIA_TYPE_SUBTITLE;
+    std::vector<const MediaTrack*> choices;
+    for (const MediaTrack& track : g_videoContext.tracks) {
+        if (track.type == type) choices.push_back(&track);
+    }
+    if (subtitles) choices.push_back(nullptr);   // Off
+    if (choices.size() < 2) return;
+
+    int pending = subtitles ? g_videoContext.requestedSubtitleTrack.load() : g_videoContext.requestedAudioTrack.load();
+    int current = pending == -2 ? -1 : pending;
+    if (pending == -1) current = subtitles ? g_videoContext.subtitleStreamIndex.load() : g_videoContext.audioStreamIndex.load();
+    size_t at = 0;
+    while (at < choices.size() && (choices[at] ? choices[at]->streamIndex : -1) != current) at++;
+    size_t next = at + 1 < choices.size() ? at + 1 : 0;
+    const MediaTrack* track = choices[next];
+    int streamIndex = track ? track->streamIndex : -1;
+
+    bool posted = subtitles ? selectSubtitleTrack(g_videoContext, streamIndex) : selectAudioTrack(g_videoContext, streamIndex);
+    if (!posted) return;
+    if (subtitles && track) g_showSubtitles = true;
+    int number = (int)next + 1;
+    int count = (int)choices.size() - (subtitles ? 1 : 0);
+    wchar_t prefix[48];
+    if (!track) {
+        g_videoMessage = L"Subtitles: off";
+    }
+    else {
+        swprintf_s(prefix, 48, L"%s %d/%d: ", subtitles ? L"Subtitles" : L"Audio", number, count);
+        g_videoMessage = prefix + str_to_wstr(describeMediaTrack(*track));
+    }
+    g_videoMessageTicks = SDL_GetTicks();
+}
+
+// Save the frame on screen next to the video, named after its position
+static void takeVideoSnapshot() {
+    int ms = (int)(getMasterClock(g_videoContext) * 1000.0);
+    if (ms < 0) ms = 0;
+    wchar_t suffix[64];
+    swprintf_s(suffix, 64, L"_%d-%02d-%02d.%03d.%s", ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, ms % 1000,
+        imageSaveExtension(g_snapshotFormat));
+    std::wstring outputPath = g_currentPlayingVideoPath.substr(0, g_currentPlayingVideoPath.find_last_of(L'.')) + suffix;
+    if (saveVideoSnapshot(g_videoContext, outputPath, g_snapshotFormat, 95)) {
+        g_videoMessage = L"Snapshot: " + outputPath.substr(outputPath.find_last_of(L"\\/") + 1);
+    }
+    else {
+        g_videoMessage = L"Snapshot: no frame on screen yet";
+    }
+    g_videoMessageTicks = SDL_GetTicks();
 }
 
 void Spin(int x, int y, Uint8 r, Uint8 g, Uint8 b, float angleDegrees) {
@@ -378,8 +532,59 @@ void Spin(int x, int y, Uint8 r, Uint8 g, Uint8 b, float angleDegrees) {
     float x2 = x - cosf(radians) * length;
     float y2 = y - sinf(radians) * length;
 
-    SDL_SetRenderDrawColor(renderer, r, g, b, 255);
-    SDL_RenderDrawLineF(renderer, x1, y1, x2, y2);
+    queueLine((int)lroundf(x1), (int)lroundf(y1), (int)lroundf(x2), (int)lroundf(y2), SDL_Color{ r, g, b, 255 });
+}
+
+// Sound player waveform overview, and the live spectrum below it
+static const int WAVEFORM_X1 = 20;
+static const int WAVEFORM_X2 = X - 20;
+static const int WAVEFORM_MID = 200;
+static const int WAVEFORM_HALF = 70;
+static const int SPECTRUM_BOTTOM = Y - 90;
+static const int SPECTRUM_HEIGHT = 150;
+static const int SPECTRUM_BANDS = 48;
+static WaveformOverview g_waveform;
+static float g_spectrumLevels[SPECTRUM_BANDS];
+
+// The overview is built in the background; spin in its place until it
+// arrives. Files without one keep the spinner, marked as such.
+static void drawWaveform(const std::wstring& path, double position, float rotorAngle) {
+    const int columns = WAVEFORM_X2 - WAVEFORM_X1;
+    requestWaveformOverview(path, columns);
+    takeWaveformOverview(g_waveform);
+    if (g_waveform.path != path || (int)g_waveform.buckets.size() != columns) {
+        Spin(X / 2, WAVEFORM_MID, 0, 255, 255, rotorAngle);
+        if (waveformOverviewFailed()) Text("No waveform for this file", X / 2 - 90, WAVEFORM_MID + WAVEFORM_HALF, 150, 150, 150);
+        return;
+    }
+    int played = g_waveform.duration > 0.0 ? (int)(columns * std::min(1.0, position / g_waveform.duration)) : 0;
+    for (int i = 0; i < columns; i++) {
+        const WaveformBucket& bucket = g_waveform.buckets[i];
+        bool past = i < played;
+        Rectanglefull(WAVEFORM_X1 + i, WAVEFORM_MID - (int)(bucket.max * WAVEFORM_HALF), WAVEFORM_X1 + i,
+            WAVEFORM_MID - (int)(bucket.min * WAVEFORM_HALF), 0, past ? 150 : 90, past ? 190 : 110, 255);
+    }
+    for (int i = 0; i < columns; i++) {
+        int rms = (int)(g_waveform.buckets[i].rms * WAVEFORM_HALF);
+        bool past = i < played;
+        Rectanglefull(WAVEFORM_X1 + i, WAVEFORM_MID - rms, WAVEFORM_X1 + i, WAVEFORM_MID + rms, 0, past ? 230 : 140, past ? 255 : 170, 255);
+    }
+    queueLine(WAVEFORM_X1 + played, WAVEFORM_MID - WAVEFORM_HALF, WAVEFORM_X1 + played, WAVEFORM_MID + WAVEFORM_HALF,
+        SDL_Color{ 255, 255, 255, 255 });
+}
+
+// Bars rise at once and fall back slowly, so short peaks stay visible
+static void drawSpectrum() {
+    float bands[SPECTRUM_BANDS];
+    computeAudioSpectrum(bands, SPECTRUM_BANDS);
+    const int width = (WAVEFORM_X2 - WAVEFORM_X1) / SPECTRUM_BANDS;
+    for (int i = 0; i < SPECTRUM_BANDS; i++) {
+        g_spectrumLevels[i] = std::max(bands[i], g_spectrumLevels[i] - 0.02f);
+        int height = (int)(g_spectrumLevels[i] * SPECTRUM_HEIGHT);
+        if (height <= 0) continue;
+        int x = WAVEFORM_X1 + i * width;
+        Rectanglefull(x, SPECTRUM_BOTTOM - height, x + width - 2, SPECTRUM_BOTTOM, 255, 160, 0, 255);
+    }
 }
 
 int begin() {
@@ -638,6 +843,57 @@ std::wstring formatHexLine(const std::vector<unsigned char>&dataBuffer, size_t l
     return ss.str();
 }
 
+static void drawTextViewer() {
+    SDL_SetRenderDrawColor(renderer, 20, 20, 40, 255);
+    SDL_RenderClear(renderer);
+
+    int display_y = 10;
+    int font_line_height = 20;
+    int start_line = g_textScrollOffset;
+    int num_lines_to_display = std::min(G_TEXT_VIEWER_LINES_PER_SCREEN, static_cast<int>(g_textFileContent.size()) - start_line);
+    if (num_lines_to_display < 0) num_lines_to_display = 0;
+
+    for (int i = 0; i < num_lines_to_display; ++i) {
+        int current_line_index = start_line + i;
+        if (current_line_index >= 0 && static_cast<size_t>(current_line_index) < g_textFileContent.size()) {
+            renderText(renderer, font, g_textFileContent[current_line_index], 10, display_y);
+            display_y += font_line_height;
+        }
+    }
+
+    Text("Mouse Wheel: Scroll Text", 10, Y - 40, 200, 200, 200);
+    Text("Esc: Close Text Viewer", 10, Y - 20, 200, 200, 200);
+}
+
+static void drawHexViewer() {
+    SDL_SetRenderDrawColor(renderer, 25, 25, 50, 255);
+    SDL_RenderClear(renderer);
+
+    int display_y = 10;
+    int font_line_height = 20;
+
+    if (!g_hexFileBuffer.empty()) {
+        for (int i = 0; i < G_HEX_LINES_PER_SCREEN; ++i) {
+            size_t current_line_index_in_file = static_cast<size_t>(g_hexScrollOffset) + i;
+            size_t current_byte_offset = current_line_index_in_file * G_HEX_BYTES_PER_LINE;
+            if (current_byte_offset < g_hexFileBuffer.size()) {
+                std::wstring line_content = formatHexLine(g_hexFileBuffer, current_byte_offset, G_HEX_BYTES_PER_LINE);
+                renderText(renderer, font, line_content, 10, display_y);
+                display_y += font_line_height;
+            }
+            else {
+                break;
+            }
+        }
+    }
+    else {
+        renderText(renderer, font, L"File is empty or could not be loaded.", 10, display_y);
+    }
+
+    Text("Mouse Wheel: Scroll Hex Data", 10, Y - 40, 200, 200, 200);
+    Text("Esc: Close Hex Viewer", 10, Y - 20, 200, 200, 200);
+}
+
 char* wcharPathToCharPath(const wchar_t* wcharPath) {
     if (!wcharPath) return nullptr;
     int size_needed = WideCharToMultiByte(CP_UTF8, 0, wcharPath, -1, NULL, 0, NULL, NULL);
@@ -692,7 +948,7 @@ bool loadAndPlaySound(const wchar_t* filePath) {
 }
 
 bool loadAndPlayVideo(const wchar_t* filePath) {
-    // Clean up existing video resources (g_videoTexture might be recreated by decodeVideoFrame)
+    // Clean up existing video resources (g_videoTexture might be recreated by updateVideoPlayback)
     if (g_videoTexture) {
         SDL_DestroyTexture(g_videoTexture);
         g_videoTexture = nullptr;
@@ -706,12 +962,15 @@ bool loadAndPlayVideo(const wchar_t* filePath) {
         return false;
     }
 
+    // Headless runs advance the clock one 60 Hz frame per loop so output is deterministic
+    g_videoContext.fixedClockStep = g_headless.enabled ? 1.0 / 60.0 : 0.0;
+
     logError("loadAndPlayVideo: Attempting to open with FFmpeg: %s", filePath_char);
     if (openVideoFile(filePath_char, g_videoContext)) { // openVideoFile uses char*
         delete[] filePath_char; // filePath_char no longer needed
         g_currentPlayingVideoPath = filePath; // Keep wchar_t path for display
         logError("Successfully opened video with FFmpeg: %s", wstr_to_str(g_currentPlayingVideoPath).c_str());
-        // Texture will be created/updated by decodeVideoFrame
+        // Texture will be created/updated by updateVideoPlayback
         return true; // Signal success to Action function
     }
     else {
@@ -897,9 +1156,25 @@ void Action(wchar_t* filename, wchar_t* name) {
             }
             else if (isSoundFile(files[Sel].extension)) {
                 logError("Action: Matched sound file: %s", wstr_to_str(full_path_wstr).c_str());
-                if (loadAndPlaySound(full_path_to_file)) {
+                // Play the folder's sound files as a playlist from this one.
+                // Formats the playlist cannot decode (MIDI, trackers) still go
+                // through Mix_Music on their own.
+                std::vector<std::wstring> playlist;
+                int playlistStart = 0;
+                for (int i = 0; i < fileCount; i++) {
+                    if (!isSoundFile(files[i].extension)) continue;
+                    if (i == Sel) playlistStart = (int)playlist.size();
+                    playlist.push_back(std::wstring(currentDir) + L"\\" + files[i].filename);
+                }
+                if (g_currentMusic) {
+                    Mix_HaltMusic();
+                    Mix_FreeMusic(g_currentMusic);
+                    g_currentMusic = nullptr;
+                }
+                if (startPlaylist(playlist, playlistStart, g_crossfadeMs) || loadAndPlaySound(full_path_to_file)) {
                     g_currentPlayingSoundPath = full_path_wstr;
                     currentState = STATE_SOUND_PLAYER;
+                    setAudioOutputTap(true);
                     logError("Action: Switched to Sound Player state for: %s", wstr_to_str(full_path_wstr).c_str());
                     return;
                 }
@@ -950,10 +1225,6 @@ void Action(wchar_t* filename, wchar_t* name) {
                     g_currentPlayingVideoPath = full_path_wstr;
                     currentState = STATE_VIDEO_PLAYER;
                     logError("Action: Switched to Video Player state for: %s", wstr_to_str(full_path_wstr).c_str());
-                    if (g_videoContext.audioDevice != 0) {
-                        SDL_PauseAudioDevice(g_videoContext.audioDevice, 0);
-                        logError("FFmpeg: Audio playback started via Action.");
-                    }
                 }
                 else {
                     logError("Action: Failed to load/play video: %s", wstr_to_str(full_path_wstr).c_str());
@@ -1020,11 +1291,612 @@ void checkdrv(int mx, int my) {
 
 
 
+// --headless [--frames N] [--capture DIR] [--capture-every N] [--open FILE] [--cpu-load N] [--filmstrip FILE] [--ttff DIR]
+// [--gapless-test] [--audio-bench FILE] [--audio-selftest] [--waveform-bench FILE] [--track-bench FILE]
+// [--demux-stress FILE] [--decode-bench DIR] [--text-bench FILE] [--alloc-check FILE]
+// [--underrun-test FILE] [--throttle-test FILE] [--convert-bench FILE] [--scale-bench]
+// [--snapshot-format png|jpg|webp|avif|bmp|tga] [--extract-frames FILE N] [--extract-dir DIR]
+// --decoder NAME --decode-threads N --low-delay --rgb-video --convert-threads N --full-probe (video decoder options)
+// --speed X (video playback speed, 0.5 to 4) --volume PERCENT --mono (video audio)
+// --audio-rate HZ --audio-buffer SAMPLES --audio-latency MS (shared audio output) --crossfade MS (sound player)
+// --read-cache MB --read-throttle KBPS --no-mmap (video file read-ahead)
+void parseCommandLine() {
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    if (!argv) return;
+    for (int i = 1; i < argc; i++) {
+        if (wcscmp(argv[i], L"--headless") == 0) {
+            g_headless.enabled = true;
+        }
+        else if (wcscmp(argv[i], L"--frames") == 0 && i + 1 < argc) {
+            g_headless.frames = _wtoi(argv[++i]);
+            if (g_headless.frames < 1) g_headless.frames = 1;
+        }
+        else if (wcscmp(argv[i], L"--capture") == 0 && i + 1 < argc) {
+            g_headless.captureDir = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--capture-every") == 0 && i + 1 < argc) {
+            g_headless.captureEvery = _wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--open") == 0 && i + 1 < argc) {
+            g_headless.openPath = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--cpu-load") == 0 && i + 1 < argc) {
+            g_headless.cpuLoadThreads = _wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--filmstrip") == 0 && i + 1 < argc) {
+            g_headless.filmstripPath = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--ttff") == 0 && i + 1 < argc) {
+            g_headless.ttffDir = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--gapless-test") == 0) {
+            g_headless.gaplessTest = true;
+        }
+        else if (wcscmp(argv[i], L"--audio-bench") == 0 && i + 1 < argc) {
+            g_headless.audioBenchPath = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--audio-selftest") == 0) {
+            g_headless.audioSelfTest = true;
+        }
+        else if (wcscmp(argv[i], L"--waveform-bench") == 0 && i + 1 < argc) {
+            g_headless.waveformBenchPath = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--track-bench") == 0 && i + 1 < argc) {
+            g_headless.trackBenchPath = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--demux-stress") == 0 && i + 1 < argc) {
+            g_headless.demuxStressPath = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--decode-bench") == 0 && i + 1 < argc) {
+            g_headless.decodeBenchDir = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--text-bench") == 0 && i + 1 < argc) {
+            g_headless.textBenchPath = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--alloc-check") == 0 && i + 1 < argc) {
+            g_headless.allocCheckPath = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--underrun-test") == 0 && i + 1 < argc) {
+            g_headless.underrunTestPath = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--throttle-test") == 0 && i + 1 < argc) {
+            g_headless.throttleTestPath = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--convert-bench") == 0 && i + 1 < argc) {
+            g_headless.convertBenchPath = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--scale-bench") == 0) {
+            g_headless.scaleBench = true;
+        }
+        else if (wcscmp(argv[i], L"--snapshot-format") == 0 && i + 1 < argc) {
+            if (!parseImageSaveFormat(argv[++i], &g_snapshotFormat)) {
+                logError("Unknown --snapshot-format %s, keeping %s.", wstr_to_str(argv[i]).c_str(), wstr_to_str(imageSaveExtension(g_snapshotFormat)).c_str());
+            }
+        }
+        else if (wcscmp(argv[i], L"--extract-frames") == 0 && i + 2 < argc) {
+            g_headless.extractPath = argv[++i];
+            g_headless.extractEvery = std::max(0, _wtoi(argv[++i]));
+        }
+        else if (wcscmp(argv[i], L"--extract-dir") == 0 && i + 1 < argc) {
+            g_headless.extractDir = argv[++i];
+        }
+        else if (wcscmp(argv[i], L"--decoder") == 0 && i + 1 < argc) {
+            g_videoContext.decoderOptions.decoderName = wstr_to_str(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--decode-threads") == 0 && i + 1 < argc) {
+            g_videoContext.decoderOptions.threadCount = _wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--low-delay") == 0) {
+            g_videoContext.decoderOptions.lowDelay = true;
+        }
+        else if (wcscmp(argv[i], L"--rgb-video") == 0) {
+            g_videoContext.decoderOptions.yuvTextures = false;
+        }
+        else if (wcscmp(argv[i], L"--convert-threads") == 0 && i + 1 < argc) {
+            g_videoContext.decoderOptions.convertThreads = _wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--full-probe") == 0) {
+            g_videoContext.decoderOptions.fastStart = false;
+        }
+        else if (wcscmp(argv[i], L"--speed") == 0 && i + 1 < argc) {
+            setVideoSpeed(g_videoContext, _wtof(argv[++i]));
+        }
+        else if (wcscmp(argv[i], L"--volume") == 0 && i + 1 < argc) {
+            setVideoVolume(g_videoContext, (float)(_wtof(argv[++i]) / 100.0));
+        }
+        else if (wcscmp(argv[i], L"--mono") == 0) {
+            g_videoContext.downmixMono.store(true);
+        }
+        else if (wcscmp(argv[i], L"--audio-rate") == 0 && i + 1 < argc) {
+            g_audioOutputOptions.frequency = _wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--audio-buffer") == 0 && i + 1 < argc) {
+            g_audioOutputOptions.bufferSamples = _wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--audio-latency") == 0 && i + 1 < argc) {
+            g_audioOutputOptions.targetLatencyMs = _wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--crossfade") == 0 && i + 1 < argc) {
+            g_crossfadeMs = std::max(0, _wtoi(argv[++i]));
+        }
+        else if (wcscmp(argv[i], L"--read-cache") == 0 && i + 1 < argc) {
+            g_videoContext.readerOptions.cacheBytes = (size_t)_wtoi(argv[++i]) * 1024 * 1024;
+        }
+        else if (wcscmp(argv[i], L"--read-throttle") == 0 && i + 1 < argc) {
+            g_videoContext.readerOptions.throttleKBps = _wtoi(argv[++i]);
+        }
+        else if (wcscmp(argv[i], L"--no-mmap") == 0) {
+            g_videoContext.readerOptions.allowMap = false;
+        }
+        else {
+            logError("Ignoring unknown command line argument: %s", wstr_to_str(argv[i]).c_str());
+        }
+    }
+    LocalFree(argv);
+}
+
+// Spin `count` threads at normal priority so decoding and the audio callback
+// compete for CPU; --underrun-test checks that audio holds up under them.
+static void startCpuLoad(int count) {
+    if (count <= 0) return;
+    logError("Starting %d CPU load threads.", count);
+    g_cpuLoadStop.store(false);
+    for (int i = 0; i < count; i++) {
+        g_cpuLoadThreads.emplace_back([] {
+            volatile uint64_t sink = 0;
+            while (!g_cpuLoadStop.load(std::memory_order_relaxed)) {
+                for (int j = 0; j < 100000; j++) sink = sink * 6364136223846793005ULL + 1;
+            }
+        });
+    }
+}
+
+static void stopCpuLoad() {
+    g_cpuLoadStop.store(true);
+    for (std::thread& thread : g_cpuLoadThreads) thread.join();
+    g_cpuLoadThreads.clear();
+}
+
+// Read back the current render target and write it as PNG
+bool captureFrame(SDL_Renderer * renderer, const wchar_t* outputPath) {
+    int w = 0, h = 0;
+    if (SDL_GetRendererOutputSize(renderer, &w, &h) != 0 || w <= 0 || h <= 0) {
+        logError("captureFrame: SDL_GetRendererOutputSize failed: %s", SDL_GetError());
+        return false;
+    }
+    ImageData frame = { nullptr, (unsigned int)w, (unsigned int)h, 4 };
+    frame.pixels = (unsigned char*)malloc((size_t)w * h * 4);
+    if (!frame.pixels) {
+        logError("captureFrame: Out of memory for %dx%d frame.", w, h);
+        return false;
+    }
+    if (SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_RGBA32, frame.pixels, w * 4) != 0) {
+        logError("captureFrame: SDL_RenderReadPixels failed: %s", SDL_GetError());
+        freeImageData(&frame);
+        return false;
+    }
+    bool saved = saveImage(&frame, outputPath, SAVE_FORMAT_PNG, 0);
+    freeImageData(&frame);
+    return saved;
+}
+
+// Preview benchmark: extractVideoPreview logs the time; with --capture the
+// frames are written as filmstrip_NN.png
+void benchmarkFilmstrip(const std::wstring & path) {
+    char* path_char = wcharPathToCharPath(path.c_str());
+    if (!path_char) return;
+    std::vector<ImageData> frames;
+    extractVideoPreview(path_char, 10, 160, frames);
+    delete[] path_char;
+    for (size_t i = 0; i < frames.size(); i++) {
+        if (!g_headless.captureDir.empty()) {
+            wchar_t outputPath[MAX_PATH];
+            swprintf_s(outputPath, MAX_PATH, L"%s\\filmstrip_%02zu.png", g_headless.captureDir.c_str(), i);
+            saveImage(&frames[i], outputPath, SAVE_FORMAT_PNG, 0);
+        }
+        freeImageData(&frames[i]);
+    }
+}
+
+// Open benchmark: time-to-first-frame of each video in `dir`, once with the
+// full stream probe and once with fast start
+void benchmarkTimeToFirstFrame(const std::wstring & dir) {
+    WIN32_FIND_DATAW findData;
+    HANDLE find = FindFirstFileW((dir + L"\\*").c_str(), &findData);
+    if (find == INVALID_HANDLE_VALUE) {
+        logError("benchmarkTimeToFirstFrame: Could not list %s", wstr_to_str(dir).c_str());
+        return;
+    }
+    VideoDecoderOptions fullProbe = g_videoContext.decoderOptions;
+    VideoDecoderOptions fastStart = g_videoContext.decoderOptions;
+    fullProbe.fastStart = false;
+    fastStart.fastStart = true;
+    int measured = 0;
+    double fullTotal = 0.0, fastTotal = 0.0;
+    do {
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        const wchar_t* extension = wcsrchr(findData.cFileName, L'.');
+        if (!extension || !isVideoFile(extension + 1)) continue;
+        char* path_char = wcharPathToCharPath((dir + L"\\" + findData.cFileName).c_str());
+        if (!path_char) continue;
+        double fullMs = measureTimeToFirstFrame(path_char, fullProbe, g_videoContext.readerOptions);
+        double fastMs = measureTimeToFirstFrame(path_char, fastStart, g_videoContext.readerOptions);
+        logError("TTFF %s: full probe %.1f ms, fast start %.1f ms", path_char, fullMs, fastMs);
+        if (fullMs >= 0.0 && fastMs >= 0.0) {
+            measured++;
+            fullTotal += fullMs;
+            fastTotal += fastMs;
+        }
+        delete[] path_char;
+    } while (FindNextFileW(find, &findData));
+    FindClose(find);
+    if (measured > 0) {
+        logError("TTFF average over %d files: full probe %.1f ms, fast start %.1f ms",
+            measured, fullTotal / measured, fastTotal / measured);
+    }
+}
+
+// Decode benchmark: fps of each video in `dir` over its first 300 frames with
+// 1, 2, 4 and one-per-core decoder threads (the other decoder options as
+// given on the command line), then the average per thread count
+void benchmarkDecodeThreads(const std::wstring & dir) {
+    WIN32_FIND_DATAW findData;
+    HANDLE find = FindFirstFileW((dir + L"\\*").c_str(), &findData);
+    if (find == INVALID_HANDLE_VALUE) {
+        logError("benchmarkDecodeThreads: Could not list %s", wstr_to_str(dir).c_str());
+        return;
+    }
+    const int frames = 300;
+    int cores = SDL_GetCPUCount();
+    std::vector<int> counts = { 1, 2, 4 };
+    if (cores > 4) counts.push_back(cores);
+    std::vector<double> totals(counts.size(), 0.0);
+    int measured = 0;
+    do {
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        const wchar_t* extension = wcsrchr(findData.cFileName, L'.');
+        if (!extension || !isVideoFile(extension + 1)) continue;
+        char* path_char = wcharPathToCharPath((dir + L"\\" + findData.cFileName).c_str());
+        if (!path_char) continue;
+        std::vector<double> fps(counts.size(), -1.0);
+        bool complete = true;
+        for (size_t c = 0; c < counts.size(); c++) {
+            VideoDecoderOptions options = g_videoContext.decoderOptions;
+            options.threadCount = counts[c];
+            fps[c] = measureDecodeFps(path_char, options, frames);
+            if (fps[c] < 0.0) {
+                complete = false;
+                break;
+            }
+            logError("Decode bench %s: %d thread(s): %.1f fps (%.2fx vs 1 thread)", path_char, counts[c], fps[c], fps[c] / fps[0]);
+        }
+        if (complete) {
+            measured++;
+            for (size_t c = 0; c < counts.size(); c++) totals[c] += fps[c];
+        }
+        delete[] path_char;
+    } while (FindNextFileW(find, &findData));
+    FindClose(find);
+    for (size_t c = 0; c < counts.size() && measured > 0; c++) {
+        logError("Decode bench average over %d files: %d thread(s): %.1f fps", measured, counts[c], totals[c] / measured);
+    }
+}
+
+static double processCpuSeconds() {
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return 0.0;
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (double)(k.QuadPart + u.QuadPart) / 1e7;
+}
+
+// Sound player benchmark: streams `path` through the playlist for a minute,
+// with seeks across the file in the second half, and logs CPU use and the
+// working set every 10 s. Memory should stay flat however long the file is.
+void benchmarkAudioStreaming(const std::wstring & path) {
+    std::vector<std::wstring> single(1, path);
+    if (!startPlaylist(single, 0, 0)) return;
+    const int seconds = 60;
+    double cpuStart = processCpuSeconds();
+    double cpuLast = cpuStart;
+    SIZE_T workingSetMin = SIZE_MAX, workingSetMax = 0;
+    for (int s = 1; s <= seconds; s++) {
+        SDL_Delay(1000);
+        updatePlaylist();
+        PlaylistStatus status = getPlaylistStatus();
+        if (s > seconds / 2 && s % 5 == 0 && status.duration > 0.0) {
+            // Jump around the whole file, forward and back
+            double target = status.duration * ((s * 37) % 100) / 100.0;
+            seekPlaylist(target - status.position);
+        }
+        PROCESS_MEMORY_COUNTERS memory = {};
+        memory.cb = sizeof(memory);
+        GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory));
+        if (s > 5) {
+            // Past startup: steady state
+            workingSetMin = std::min(workingSetMin, memory.WorkingSetSize);
+            workingSetMax = std::max(workingSetMax, memory.WorkingSetSize);
+        }
+        if (s % 10 == 0) {
+            double cpu = processCpuSeconds();
+            logError("Audio bench %d s: position %.1f / %.1f s, CPU %.1f%% of one core, working set %.1f MB, underruns %llu",
+                s, status.position, status.duration, (cpu - cpuLast) * 10.0, memory.WorkingSetSize / 1048576.0,
+                (unsigned long long)status.underruns);
+            cpuLast = cpu;
+        }
+    }
+    logError("Audio bench: average CPU %.1f%% of one core; steady-state working set %.1f - %.1f MB",
+        (processCpuSeconds() - cpuStart) * 100.0 / seconds, workingSetMin / 1048576.0, workingSetMax / 1048576.0);
+    stopPlaylist();
+}
+
+// Waveform overview benchmark: builds the overview of `path` uncached with 1,
+// 2, 4 and one-per-core segment threads, then once through the cache (the
+// first cached load fills it).
+void benchmarkWaveformOverview(const std::wstring & path) {
+    const int columns = 1920;
+    int cores = (int)std::thread::hardware_concurrency();
+    std::vector<int> counts = { 1, 2, 4 };
+    if (cores > 4) counts.push_back(cores);
+    double singleMs = 0.0;
+    for (int threads : counts) {
+        WaveformOverview overview;
+        Uint64 start = SDL_GetPerformanceCounter();
+        if (!computeWaveformOverview(path, columns, threads, overview)) return;
+        double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+        if (threads == 1) singleMs = ms;
+        logError("Waveform bench: %d thread(s): %.0f ms for %.0f s of audio (%.0fx real time, %.2fx vs 1 thread)",
+            threads, ms, overview.duration, overview.duration * 1000.0 / ms, singleMs / ms);
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        WaveformOverview overview;
+        Uint64 start = SDL_GetPerformanceCounter();
+        if (!loadWaveformOverview(path, columns, overview)) return;
+        double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+        logError("Waveform bench: through the cache (%s): %.1f ms", pass == 0 ? "first load" : "cached", ms);
+    }
+}
+
+// Track selection benchmark: demuxes `path` to the end twice without
+// decoding, first every stream, then only the tracks the player selects
+// with the rest discarded, and logs what each read and cost
+void benchmarkTrackSelection(const std::wstring & path) {
+    char* path_char = wcharPathToCharPath(path.c_str());
+    if (!path_char) return;
+    for (int pass = 0; pass < 2; pass++) {
+        bool selectedOnly = pass == 1;
+        DemuxCost cost;
+        double cpuStart = processCpuSeconds();
+        if (!measureDemuxCost(path_char, selectedOnly, cost)) break;
+        logError("Track bench (%s): %lld packets, %.1f MB in packets, %.1f MB read, %.0f ms, %.2f s CPU",
+            selectedOnly ? "selected tracks" : "all streams", (long long)cost.packets, cost.packetBytes / 1048576.0,
+            cost.bytesRead / 1048576.0, cost.ms, processCpuSeconds() - cpuStart);
+    }
+    delete[] path_char;
+}
+
+// Allocation check: plays `path` in real time for 20 s after a 5 s warm-up
+// and fails if the player allocated any packet shells, conversion buffers or
+// audio buffers in the counted part
+bool checkSteadyStateAllocations(const std::wstring & path) {
+    char* path_char = wcharPathToCharPath(path.c_str());
+    if (!path_char) return false;
+    VideoPlaybackSetup setup;
+    setup.decoderOptions = g_videoContext.decoderOptions;
+    setup.readerOptions = g_videoContext.readerOptions;
+    setup.warmupSeconds = 5.0;
+    setup.seconds = 20.0;
+    VideoPlaybackRun run;
+    bool opened = runVideoPlayback(path_char, setup, renderer, run);
+    delete[] path_char;
+    if (!opened) return false;
+    bool passed = run.allocations == 0 && run.presentedFrames > 0;
+    logError("Allocation check: %s (%llu allocations in %.1f s of playback after a %.0f s warm-up, %.2f per second; %d frames shown)",
+        passed ? "PASSED" : "FAILED", (unsigned long long)run.allocations, run.seconds, setup.warmupSeconds,
+        run.seconds > 0.0 ? run.allocations / run.seconds : 0.0, run.presentedFrames);
+    return passed;
+}
+
+// Underrun test: plays `path` in real time for 30 s after a 3 s warm-up with
+// every core kept busy by load threads (or the --cpu-load threads, if those
+// are running) and fails on any audio ring underrun in the counted part
+bool runAudioUnderrunTest(const std::wstring & path) {
+    char* path_char = wcharPathToCharPath(path.c_str());
+    if (!path_char) return false;
+    bool ownLoad = g_cpuLoadThreads.empty();
+    if (ownLoad) startCpuLoad(SDL_GetCPUCount());
+    VideoPlaybackSetup setup;
+    setup.decoderOptions = g_videoContext.decoderOptions;
+    setup.readerOptions = g_videoContext.readerOptions;
+    setup.warmupSeconds = 3.0;
+    setup.seconds = 30.0;
+    VideoPlaybackRun run;
+    bool opened = runVideoPlayback(path_char, setup, renderer, run);
+    if (ownLoad) stopCpuLoad();
+    delete[] path_char;
+    if (!opened) return false;
+    if (!run.hasAudio) {
+        logError("Underrun test: FAILED (%s has no audio that reached the output).", wstr_to_str(path).c_str());
+        return false;
+    }
+    bool passed = run.audioUnderruns == 0;
+    logError("Underrun test: %s (%llu underruns in %.1f s with %d load threads; %d frames shown, %d dropped)",
+        passed ? "PASSED" : "FAILED", (unsigned long long)run.audioUnderruns, run.seconds,
+        ownLoad ? SDL_GetCPUCount() : (int)g_cpuLoadThreads.size(), run.presentedFrames, run.droppedFrames);
+    return passed;
+}
+
+// Slow media test: plays `path` in real time through the read-ahead ring (no
+// memory mapping) with the reader throttled to each rate in turn, or only to
+// --read-throttle if given, and logs the demuxer stalls and dropped frames
+void runThrottledReadTest(const std::wstring & path) {
+    char* path_char = wcharPathToCharPath(path.c_str());
+    if (!path_char) return;
+    std::vector<int> rates = { 0, 16384, 4096, 2048, 1024 };
+    if (g_videoContext.readerOptions.throttleKBps > 0) rates.assign(1, g_videoContext.readerOptions.throttleKBps);
+    for (int rate : rates) {
+        VideoPlaybackSetup setup;
+        setup.decoderOptions = g_videoContext.decoderOptions;
+        setup.readerOptions = g_videoContext.readerOptions;
+        setup.readerOptions.allowMap = false;
+        setup.readerOptions.throttleKBps = rate;
+        setup.warmupSeconds = 2.0;
+        setup.seconds = 20.0;
+        VideoPlaybackRun run;
+        if (!runVideoPlayback(path_char, setup, renderer, run)) break;
+        char rateText[32];
+        if (rate > 0) snprintf(rateText, sizeof(rateText), "%d KB/s", rate);
+        else snprintf(rateText, sizeof(rateText), "unthrottled");
+        logError("Throttled read (%s): %llu stalls (%.0f ms) in %.1f s; %d frames shown, %d dropped, %d repeated; %llu audio underruns",
+            rateText, (unsigned long long)run.readerStalls, run.readerStallMs, run.seconds, run.presentedFrames,
+            run.droppedFrames, run.repeatedFrames, (unsigned long long)run.audioUnderruns);
+    }
+    delete[] path_char;
+}
+
+// Convert benchmark: plays `path` (meant for a 4K clip) headless as fast as
+// it decodes with 1, 2, 4 and one-per-core swscale threads, once scaled to a
+// 1080p rect as YUV and once converted to RGBA at source size (--rgb-video),
+// and logs the convert stage's ms per frame against the frame interval
+void benchmarkConvertThreads(const std::wstring & path) {
+    char* path_char = wcharPathToCharPath(path.c_str());
+    if (!path_char) return;
+    int cores = SDL_GetCPUCount();
+    std::vector<int> counts = { 1, 2, 4 };
+    if (cores > 4) counts.push_back(cores);
+    for (int mode = 0; mode < 2; mode++) {
+        bool rgba = mode == 1;
+        for (int threads : counts) {
+            VideoPlaybackSetup setup;
+            setup.decoderOptions = g_videoContext.decoderOptions;
+            setup.decoderOptions.convertThreads = threads;
+            setup.decoderOptions.yuvTextures = !rgba;
+            setup.readerOptions = g_videoContext.readerOptions;
+            setup.targetWidth = rgba ? 0 : 1920;
+            setup.targetHeight = rgba ? 0 : 1080;
+            setup.realTime = false;
+            setup.warmupSeconds = 0.5;
+            setup.seconds = 8.0;
+            VideoPlaybackRun run;
+            if (!runVideoPlayback(path_char, setup, nullptr, run)) {
+                delete[] path_char;
+                return;
+            }
+            double msPerFrame = run.convertedFrames > 0 ? run.convertMs / run.convertedFrames : 0.0;
+            double budgetMs = run.frameDuration * 1000.0;
+            logError("Convert bench %dx%d -> %s, %d thread(s): %.2f ms/frame over %d frames; frame budget %.1f ms (%.0f%% used)",
+                run.width, run.height, rgba ? "RGBA at source size" : "YUV scaled to 1920x1080", threads, msPerFrame,
+                run.convertedFrames, budgetMs, budgetMs > 0.0 ? msPerFrame * 100.0 / budgetMs : 0.0);
+        }
+    }
+    delete[] path_char;
+}
+
+// Scaling benchmark: cost per frame of the convert stage's swscale step for
+// common source and window sizes, to YUV and to RGBA
+void benchmarkScaling() {
+    struct SizePair { int srcWidth, srcHeight, dstWidth, dstHeight; };
+    const SizePair pairs[] = {
+        { 1280, 720, 800, 450 },
+        { 1920, 1080, 800, 450 },
+        { 1920, 1080, 1280, 720 },
+        { 3840, 2160, 800, 450 },
+        { 3840, 2160, 1920, 1080 },
+        { 3840, 2160, 2560, 1440 },
+    };
+    const int frames = 60;
+    for (const SizePair& pair : pairs) {
+        double yuvMs = measureScaleCost(pair.srcWidth, pair.srcHeight, pair.dstWidth, pair.dstHeight, true, g_videoContext.decoderOptions, frames);
+        double rgbaMs = measureScaleCost(pair.srcWidth, pair.srcHeight, pair.dstWidth, pair.dstHeight, false, g_videoContext.decoderOptions, frames);
+        logError("Scale bench %dx%d -> %dx%d: YUV %.2f ms/frame, RGBA %.2f ms/frame",
+            pair.srcWidth, pair.srcHeight, pair.dstWidth, pair.dstHeight, yuvMs, rgbaMs);
+    }
+}
+
+// Text rendering benchmark: draws `path` in the text viewer and then in the
+// hex viewer for 300 frames each, scrolling a line per frame so new lines
+// keep missing the run cache, and logs draw calls, glyph work and frame time
+void benchmarkTextViewers(const std::wstring & path) {
+    g_textFileContent = loadTextFileContent(path.c_str());
+    if (g_textFileContent.empty() || !loadHexFileContent(path.c_str(), g_hexFileBuffer)) {
+        logError("benchmarkTextViewers: Could not load %s", wstr_to_str(path).c_str());
+        g_textFileContent.clear();
+        g_hexFileBuffer.clear();
+        return;
+    }
+    const int frames = 300;
+    int textLines = (int)g_textFileContent.size();
+    int hexLines = (int)((g_hexFileBuffer.size() + G_HEX_BYTES_PER_LINE - 1) / G_HEX_BYTES_PER_LINE);
+    for (int pass = 0; pass < 2; pass++) {
+        bool hex = pass == 1;
+        int maxOffset = std::max(0, (hex ? hexLines - G_HEX_LINES_PER_SCREEN : textLines - G_TEXT_VIEWER_LINES_PER_SCREEN));
+        double toMs = 1000.0 / (double)SDL_GetPerformanceFrequency();
+        double totalMs = 0.0, maxMs = 0.0;
+        long long drawCalls = 0, textQuads = 0, glyphs = 0, hits = 0, misses = 0;
+        for (int i = 0; i < frames; i++) {
+            Uint64 start = SDL_GetPerformanceCounter();
+            if (hex) {
+                g_hexScrollOffset = maxOffset > 0 ? i % (maxOffset + 1) : 0;
+                drawHexViewer();
+            }
+            else {
+                g_textScrollOffset = maxOffset > 0 ? i % (maxOffset + 1) : 0;
+                drawTextViewer();
+            }
+            presentFrame(renderer);
+            double ms = (double)(SDL_GetPerformanceCounter() - start) * toMs;
+            totalMs += ms;
+            maxMs = std::max(maxMs, ms);
+            const RenderStats& stats = getRenderStats();
+            drawCalls += stats.drawCalls;
+            textQuads += stats.textQuads;
+            glyphs += stats.glyphsRasterized;
+            hits += stats.runCacheHits;
+            misses += stats.runCacheMisses;
+        }
+        logError("Text bench (%s viewer, %d frames): frame time avg %.3f ms, max %.3f ms; per frame %.1f draw calls, %.0f glyph quads; %lld glyphs rasterized; runs %lld hits / %lld misses",
+            hex ? "hex" : "text", frames, totalMs / frames, maxMs, (double)drawCalls / frames, (double)textQuads / frames,
+            glyphs, hits, misses);
+    }
+    g_textFileContent.clear();
+    g_textScrollOffset = 0;
+    g_hexFileBuffer.clear();
+    g_hexScrollOffset = 0;
+}
+
+// Select a file by full path and open it through Action(), like a double-click
+void openFromCommandLine(const std::wstring & path) {
+    size_t lastSlash = path.find_last_of(L"\\/");
+    if (lastSlash == std::wstring::npos) {
+        logError("openFromCommandLine: Expected a full path, got %s", wstr_to_str(path).c_str());
+        return;
+    }
+    std::wstring dir = path.substr(0, lastSlash);
+    std::wstring name = path.substr(lastSlash + 1);
+    wcsncpy_s(currentDir, MAX_PATH, dir.c_str(), _TRUNCATE);
+    update();
+    for (int i = 0; i < fileCount; i++) {
+        if (_wcsicmp(files[i].filename, name.c_str()) == 0) {
+            Sel = i;
+            Action(currentDir, files[Sel].filename);
+            return;
+        }
+    }
+    logError("openFromCommandLine: %s not found in %s", wstr_to_str(name).c_str(), wstr_to_str(dir).c_str());
+}
+
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
     currentImage.pixels = nullptr;
     imageTexture = nullptr;
     currentZoom = 1.0f;
 
+    parseCommandLine();
+    startCpuLoad(g_headless.cpuLoadThreads);
+
     if (!initSDL("Borderless File Manager", X, Y, window, renderer, font)) {
         logError("WinMain: Initialization failed. Exiting."); // initSDL logs specific errors
         return 1;
@@ -1048,9 +1920,75 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 
     DI = finddrive(); // finddrive should use new logError (or be checked)
 
+    if (!g_headless.filmstripPath.empty()) {
+        benchmarkFilmstrip(g_headless.filmstripPath);
+    }
+    if (!g_headless.ttffDir.empty()) {
+        benchmarkTimeToFirstFrame(g_headless.ttffDir);
+    }
+    if (g_headless.gaplessTest) {
+        runGaplessPlaylistTest();
+    }
+    if (!g_headless.audioBenchPath.empty()) {
+        benchmarkAudioStreaming(g_headless.audioBenchPath);
+    }
+    if (g_headless.audioSelfTest) {
+        runAudioProcessingSelfTest();
+    }
+    if (!g_headless.waveformBenchPath.empty()) {
+        benchmarkWaveformOverview(g_headless.waveformBenchPath);
+    }
+    if (!g_headless.trackBenchPath.empty()) {
+        benchmarkTrackSelection(g_headless.trackBenchPath);
+    }
+    if (!g_headless.decodeBenchDir.empty()) {
+        benchmarkDecodeThreads(g_headless.decodeBenchDir);
+    }
+    if (!g_headless.textBenchPath.empty()) {
+        benchmarkTextViewers(g_headless.textBenchPath);
+    }
+    if (!g_headless.allocCheckPath.empty()) {
+        checkSteadyStateAllocations(g_headless.allocCheckPath);
+    }
+    if (!g_headless.underrunTestPath.empty()) {
+        runAudioUnderrunTest(g_headless.underrunTestPath);
+    }
+    if (!g_headless.throttleTestPath.empty()) {
+        runThrottledReadTest(g_headless.throttleTestPath);
+    }
+    if (!g_headless.convertBenchPath.empty()) {
+        benchmarkConvertThreads(g_headless.convertBenchPath);
+    }
+    if (g_headless.scaleBench) {
+        benchmarkScaling();
+    }
+    if (!g_headless.demuxStressPath.empty()) {
+        char* path_char = wcharPathToCharPath(g_headless.demuxStressPath.c_str());
+        if (path_char) {
+            runDemuxStressTest(path_char, 20);
+            delete[] path_char;
+        }
+    }
+    if (!g_headless.extractPath.empty()) {
+        std::wstring outputDir = g_headless.extractDir;
+        if (outputDir.empty()) {
+            outputDir = g_headless.extractPath.substr(0, g_headless.extractPath.find_last_of(L'.')) + L"_frames";
+        }
+        extractVideoFrames(g_headless.extractPath, outputDir, g_headless.extractEvery, g_snapshotFormat, 90, 0);
+    }
+    if (!g_headless.openPath.empty()) {
+        openFromCommandLine(g_headless.openPath);
+    }
+
+    int frameIndex = 0;
+    Uint64 frameTimeTotal = 0;
+    Uint64 frameTimeMin = ~0ULL;
+    Uint64 frameTimeMax = 0;
+
     bool running = true;
     SDL_Event event;
     while (running) {
+        Uint64 frameBegin = SDL_GetPerformanceCounter();
         while (SDL_PollEvent(&event)) {
             switch (event.type) {
             case SDL_QUIT:
@@ -1086,6 +2024,9 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
                     }
                     else if (currentState == STATE_SOUND_PLAYER) {
                         logError("Exiting sound player, returning to file browser."); // Simple string
+                        stopPlaylist();
+                        cancelWaveformOverview();
+                        setAudioOutputTap(false);
                         Mix_HaltMusic();
                         if (g_currentMusic != nullptr) {
                             Mix_FreeMusic(g_currentMusic);
@@ -1104,10 +2045,6 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
                         else {
                             // Original logic: Exit video player if not in fullscreen
                             logError("Video Player: Exiting video player (was windowed), returning to file browser via ESC.");
-                            if (g_videoContext.audioDevice != 0) {
-                                SDL_PauseAudioDevice(g_videoContext.audioDevice, 1); // 1 means pause
-                                logError("FFmpeg: Audio playback paused on ESC (WinMain - exiting player).");
-                            }
                             closeVideoFile(g_videoContext); // Clean up FFmpeg resources
                             if (g_videoTexture) {
                                 SDL_DestroyTexture(g_videoTexture);
@@ -1141,6 +2078,10 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
                     break;
                 case SDLK_PAGEUP:
                 case SDLK_KP_9:
+                    if (currentState == STATE_SOUND_PLAYER) {
+                        skipPlaylistTrack(-1);
+                        break;
+                    }
                     if (Tag > 0) {
                         Tag -= MAX_DISPLAY;
                         if (Tag < 0) Tag = 0;
@@ -1152,6 +2093,10 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
                     break;
                 case SDLK_PAGEDOWN:
                 case SDLK_KP_3:
+                    if (currentState == STATE_SOUND_PLAYER) {
+                        skipPlaylistTrack(1);
+                        break;
+                    }
                     if (fileCount <= MAX_DISPLAY) {
                         Sel = fileCount - 1;
                     }
@@ -1160,13 +2105,89 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
                         Tag = 0;
                     }
                     break;
-                case SDLK_RETURN:
                 case SDLK_SPACE:
+                    if (currentState == STATE_VIDEO_PLAYER && g_videoContext.formatContext) {
+                        setVideoPaused(g_videoContext, !g_videoContext.paused.load());
+                        break;
+                    }
+                    Action(currentDir, files[Sel].filename);
+                    break;
+                case SDLK_RETURN:
                 case SDLK_KP_ENTER:
                     Action(currentDir, files[Sel].filename);
                     break;
+                case SDLK_F3:
+                    showRenderStats = !showRenderStats;
+                    break;
+                case SDLK_LEFT:
+                case SDLK_RIGHT:
+                    if (currentState == STATE_VIDEO_PLAYER && g_videoContext.formatContext) {
+                        double step = (event.key.keysym.mod & KMOD_SHIFT) ? 60.0 : 5.0;
+                        if (event.key.keysym.sym == SDLK_LEFT) step = -step;
+                        seekVideo(g_videoContext, getMasterClock(g_videoContext) + step, true);
+                    }
+                    else if (currentState == STATE_SOUND_PLAYER) {
+                        double step = (event.key.keysym.mod & KMOD_SHIFT) ? 60.0 : 5.0;
+                        seekPlaylist(event.key.keysym.sym == SDLK_LEFT ? -step : step);
+                    }
+                    break;
+                case SDLK_HOME:
+                    if (currentState == STATE_VIDEO_PLAYER && g_videoContext.formatContext) {
+                        seekVideo(g_videoContext, g_videoContext.startTime, true);
+                    }
+                    break;
+                case SDLK_LEFTBRACKET:
+                case SDLK_RIGHTBRACKET:
+                    if (currentState == STATE_VIDEO_PLAYER && g_videoContext.formatContext) {
+                        stepVideoSpeed(event.key.keysym.sym == SDLK_RIGHTBRACKET ? 1 : -1);
+                    }
+                    break;
+                case SDLK_BACKSLASH:
+                    if (currentState == STATE_VIDEO_PLAYER && g_videoContext.formatContext) {
+                        setVideoSpeed(g_videoContext, 1.0);
+                    }
+                    break;
+                case SDLK_EQUALS:
+                case SDLK_PLUS:
+                case SDLK_KP_PLUS:
+                case SDLK_MINUS:
+                case SDLK_KP_MINUS:
+                    if (currentState == STATE_VIDEO_PLAYER && g_videoContext.formatContext) {
+                        bool louder = event.key.keysym.sym != SDLK_MINUS && event.key.keysym.sym != SDLK_KP_MINUS;
+                        setVideoVolume(g_videoContext, roundf(g_videoContext.volume.load() * 10.0f + (louder ? 1.0f : -1.0f)) / 10.0f);
+                        g_videoContext.muted.store(false);
+                    }
+                    break;
+                case SDLK_t:
+                    if (currentState == STATE_VIDEO_PLAYER && g_videoContext.formatContext) {
+                        if (event.key.keysym.mod & KMOD_SHIFT) {
+                            cycleVideoTrack(AVMEDIA_TYPE_SUBTITLE);
+                        }
+                        else {
+                            g_showSubtitles = !g_showSubtitles;
+                        }
+                    }
+                    break;
+                case SDLK_a:
+                    if (currentState == STATE_VIDEO_PLAYER && g_videoContext.formatContext) {
+                        cycleVideoTrack(AVMEDIA_TYPE_AUDIO);
+                    }
+                    break;
+                case SDLK_m:
+                    if (currentState == STATE_VIDEO_PLAYER && g_videoContext.formatContext) {
+                        if (event.key.keysym.mod & KMOD_SHIFT) {
+                            g_videoContext.downmixMono.store(!g_videoContext.downmixMono.load());
+                        }
+                        else {
+                            g_videoContext.muted.store(!g_videoContext.muted.load());
+                        }
+                    }
+                    break;
                 case SDLK_s:
-                    if (currentState == STATE_IMAGE_VIEWER && currentImage.pixels != nullptr) {
+                    if (currentState == STATE_VIDEO_PLAYER && g_videoContext.formatContext) {
+                        takeVideoSnapshot();
+                    }
+                    else if (currentState == STATE_IMAGE_VIEWER && currentImage.pixels != nullptr) {
                         wchar_t outputPath[MAX_PATH];
                         swprintf_s(outputPath, MAX_PATH, L"%s\\output.jpg", currentDir);
                         if (saveImage(&currentImage, outputPath, SAVE_FORMAT_JPG, 100)) {
@@ -1262,6 +2283,12 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
                         isDoubleClick = true;
                     }
 
+                    if (currentState == STATE_VIDEO_PLAYER && g_videoContext.formatContext && isOnSeekBar(mx, my)) {
+                        g_scrubbing = true;
+                        scrubVideoTo(mx, false);
+                        break;
+                    }
+
                     // Update last click info BEFORE any state-specific double-click handling
                     lastClickTime = currentTime;
                     lastClickX = mx;
@@ -1392,9 +2419,16 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
             case SDL_MOUSEBUTTONUP:
                 if (event.button.button == SDL_BUTTON_LEFT) {
                     isDragging = false;
+                    if (g_scrubbing) {
+                        g_scrubbing = false;
+                        scrubVideoTo(event.button.x, true);
+                    }
                 }
                 break;
             case SDL_MOUSEMOTION:
+                if (g_scrubbing && SDL_GetTicks() - g_lastScrubTicks >= 30) {
+                    scrubVideoTo(event.motion.x, false);
+                }
                 if (isDragging) {
                     POINT cursorPos;
                     if (GetCursorPos(&cursorPos)) {
@@ -1485,58 +2519,21 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
             }
         }
         else if (currentState == STATE_TEXT_VIEWER) {
-            SDL_SetRenderDrawColor(renderer, 20, 20, 40, 255);
-            SDL_RenderClear(renderer);
-
-            int display_y = 10;
-            int font_line_height = 20;
-            int start_line = g_textScrollOffset;
-            int num_lines_to_display = std::min(G_TEXT_VIEWER_LINES_PER_SCREEN, static_cast<int>(g_textFileContent.size()) - start_line);
-            if (num_lines_to_display < 0) num_lines_to_display = 0;
-
-            for (int i = 0; i < num_lines_to_display; ++i) {
-                int current_line_index = start_line + i;
-                if (current_line_index >= 0 && static_cast<size_t>(current_line_index) < g_textFileContent.size()) {
-                    renderText(renderer, font, g_textFileContent[current_line_index], 10, display_y);
-                    display_y += font_line_height;
-                }
-            }
-
-            Text("Mouse Wheel: Scroll Text", 10, Y - 40, 200, 200, 200);
-            Text("Esc: Close Text Viewer", 10, Y - 20, 200, 200, 200);
+            drawTextViewer();
         }
         else if (currentState == STATE_HEX_VIEWER) {
-            SDL_SetRenderDrawColor(renderer, 25, 25, 50, 255);
-            SDL_RenderClear(renderer);
-
-            int display_y = 10;
-            int font_line_height = 20;
-
-            if (!g_hexFileBuffer.empty()) {
-                for (int i = 0; i < G_HEX_LINES_PER_SCREEN; ++i) {
-                    size_t current_line_index_in_file = static_cast<size_t>(g_hexScrollOffset) + i;
-                    size_t current_byte_offset = current_line_index_in_file * G_HEX_BYTES_PER_LINE;
-                    if (current_byte_offset < g_hexFileBuffer.size()) {
-                        std::wstring line_content = formatHexLine(g_hexFileBuffer, current_byte_offset, G_HEX_BYTES_PER_LINE);
-                        renderText(renderer, font, line_content, 10, display_y);
-                        display_y += font_line_height;
-                    }
-                    else {
-                        break;
-                    }
-                }
-            }
-            else {
-                renderText(renderer, font, L"File is empty or could not be loaded.", 10, display_y);
-            }
-
-            Text("Mouse Wheel: Scroll Hex Data", 10, Y - 40, 200, 200, 200);
-            Text("Esc: Close Hex Viewer", 10, Y - 20, 200, 200, 200);
+            drawHexViewer();
         }
         else if (currentState == STATE_SOUND_PLAYER) {
             SDL_SetRenderDrawColor(renderer, 40, 20, 40, 255);
             SDL_RenderClear(renderer);
 
+            updatePlaylist();
+            PlaylistStatus playlist = getPlaylistStatus();
+            if (playlist.active && !playlist.path.empty()) {
+                g_currentPlayingSoundPath = playlist.path;
+            }
+
             int display_y = 50;
             std::wstring displayText;
             if (!g_currentPlayingSoundPath.empty()) {
@@ -1551,17 +2548,34 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
             else {
                 displayText = L"Playing sound...";
             }
+            if (playlist.active) {
+                displayText += playlist.finished ? L" (end of playlist)" :
+                    L" (" + std::to_wstring(playlist.index + 1) + L"/" + std::to_wstring(playlist.count) + L")";
+            }
 
-            int textWidth = displayText.length() * 8;
+            int textWidth = measureText(displayText);
             int text_x = (X - textWidth) / 2;
             if (text_x < 10) text_x = 10;
             renderText(renderer, font, displayText, text_x, display_y);
             display_y += 30;
+            if (playlist.active && playlist.duration > 0.0) {
+                char timeLine[32];
+                int pos = (int)playlist.position, total = (int)playlist.duration;
+                snprintf(timeLine, sizeof(timeLine), "%d:%02d / %d:%02d", pos / 60, pos % 60, total / 60, total % 60);
+                Text(timeLine, X / 2 - 50, display_y, 200, 200, 200);
+            }
 
             rotorAngle += 3.0f;
             if (rotorAngle >= 360.0f) rotorAngle -= 360.0f;
-            Spin(X / 2, Y / 2, 0, 255, 255, rotorAngle);
+            if (!g_currentPlayingSoundPath.empty()) {
+                drawWaveform(g_currentPlayingSoundPath, playlist.active ? playlist.position : 0.0, rotorAngle);
+            }
+            drawSpectrum();
 
+            if (playlist.active) {
+                Text("Left/Right: Seek 5 s (Shift: 60 s)", 10, Y - 60, 200, 200, 200);
+                Text("PgUp/PgDn: Previous/Next Track", 10, Y - 40, 200, 200, 200);
+            }
             Text("Esc: Stop and Close Player", 10, Y - 20, 200, 200, 200);
         }
         else if (currentState == STATE_VIDEO_PLAYER) {
@@ -1570,8 +2584,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 
             Uint32 frameStartTime = SDL_GetTicks(); // Time before decoding and rendering
 
-            // Attempt to decode and get the next video frame as a texture
-            if (g_videoContext.formatContext && g_videoContext.videoStreamIndex != -1 && decodeVideoFrame(g_videoContext, &g_videoTexture, renderer)) {
+            // Present the frame due at the current clock (may keep the previous texture)
+            if (g_videoContext.formatContext && g_videoContext.videoStreamIndex != -1 && updateVideoPlayback(g_videoContext, &g_videoTexture, renderer)) {
                 if (g_videoTexture) {
                     // Render the video texture, maintaining its aspect ratio.
                     // Calculations are based on the logical rendering dimensions (X, Y) defined
@@ -1612,6 +2626,14 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 
                     if (dstRect.w > 0 && dstRect.h > 0) { // Only render if dimensions are valid
                         SDL_RenderCopy(renderer, g_videoTexture, nullptr, &dstRect);
+                        if (g_showSubtitles && g_videoContext.subtitleStreamIndex != -1) {
+                            drawVideoSubtitles(renderer, g_videoContext, dstRect, getMasterClock(g_videoContext));
+                        }
+
+                        // Let the decoder scale frames to the rect's size in output pixels
+                        float scaleX = 1.0f, scaleY = 1.0f;
+                        SDL_RenderGetScale(renderer, &scaleX, &scaleY);
+                        setVideoTargetSize(g_videoContext, (int)(dstRect.w * scaleX), (int)(dstRect.h * scaleY));
                     }
                 }
             }
@@ -1620,11 +2642,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
                 if (g_videoContext.formatContext) {
                     // Video was playing or attempting to play
                     logError("Video ended or failed to decode video frame. Returning to file browser."); // Simple
-                    if (g_videoContext.audioDevice != 0) {
-                        SDL_PauseAudioDevice(g_videoContext.audioDevice, 1); // Pause audio
-                        logError("FFmpeg: Audio playback paused due to video end/error (WinMain).");
-                    }
-                    closeVideoFile(g_videoContext); // This will also close the audio device
+                    closeVideoFile(g_videoContext); // This also detaches video audio from the output
                     if (g_videoTexture) { SDL_DestroyTexture(g_videoTexture); g_videoTexture = nullptr; }
                     g_currentPlayingVideoPath.clear();
                     currentState = STATE_FILE_BROWSER;
@@ -1632,12 +2650,6 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
                 else if (!g_currentPlayingVideoPath.empty() && currentState == STATE_VIDEO_PLAYER) {
                     // This case might happen if loadAndPlayVideo failed initially but state was set to VIDEO_PLAYER
                     logError("Video player state active but no video loaded/formatContext. Returning to file browser."); // Simple
-                    // Ensure audio device is handled if it somehow got opened without formatContext
-                    if (g_videoContext.audioDevice != 0) {
-                        SDL_PauseAudioDevice(g_videoContext.audioDevice, 1);
-                        logError("FFmpeg: Audio playback paused due to inconsistent state (WinMain).");
-                        // closeVideoFile will be called if we transition state, or at cleanup.
-                    }
                     g_currentPlayingVideoPath.clear();
                     currentState = STATE_FILE_BROWSER;
                 }
@@ -1651,7 +2663,76 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
                     videoName = videoName.substr(lastSlash + 1);
                 }
                 renderText(renderer, font, (L"Playing: " + videoName).c_str(), 10, 10);
-                renderText(renderer, font, L"ESC: Stop and Close Video", 10, Y - 20);
+                std::wstring controls = g_videoContext.paused.load() ? L"Paused - Space: Resume  Left/Right: Seek  [/]: Speed  +/-/M: Volume  S: Snapshot  ESC: Close" : L"Space: Pause  Left/Right: Seek  [/]: Speed  +/-/M: Volume  S: Snapshot  ESC: Close";
+                int audioTracks = 0, subtitleTracks = 0;
+                for (const MediaTrack& track : g_videoContext.tracks) {
+                    if (track.type == AVMEDIA_TYPE_AUDIO) audioTracks++;
+                    if (track.type == AVMEDIA_TYPE_SUBTITLE) subtitleTracks++;
+                }
+                if (audioTracks > 1) controls += L"  A: Audio track";
+                if (g_videoContext.subtitleStreamIndex != -1) {
+                    controls += g_showSubtitles ? L"  T: Subtitles off" : L"  T: Subtitles on";
+                }
+                if (subtitleTracks > 0) controls += L"  Shift+T: Subtitle track";
+                double speed = g_videoContext.playbackSpeed.load();
+                if (speed != 1.0) {
+                    wchar_t speedText[16];
+                    swprintf_s(speedText, 16, L"  (%.3gx)", speed);
+                    controls += speedText;
+                }
+                if (g_videoContext.muted.load()) {
+                    controls += L"  (muted)";
+                }
+                else if (g_videoContext.volume.load() < 1.0f) {
+                    wchar_t volumeText[16];
+                    swprintf_s(volumeText, 16, L"  (vol %d%%)", (int)lroundf(g_videoContext.volume.load() * 100.0f));
+                    controls += volumeText;
+                }
+                if (g_videoContext.downmixMono.load()) controls += L"  (mono)";
+                renderText(renderer, font, controls.c_str(), 10, Y - 20);
+                drawSeekBar();
+                if (!g_videoMessage.empty() && SDL_GetTicks() - g_videoMessageTicks < 2000) {
+                    renderText(renderer, font, g_videoMessage.c_str(), 10, Y - 60);
+                }
+                if (showRenderStats) {
+                    char syncLine[160];
+                    snprintf(syncLine, sizeof(syncLine), "clock %.3f s  drift %+.1f ms  shown %d  dropped %d  repeated %d  ring %d/%d  seek %.0f ms",
+                        getMasterClock(g_videoContext), g_videoContext.clockDrift * 1000.0,
+                        g_videoContext.presentedFrames, g_videoContext.droppedFrames.load(), g_videoContext.repeatedFrames,
+                        g_videoContext.frameRing.occupancy(), VIDEO_FRAME_RING_SIZE, g_videoContext.lastSeekMs);
+                    Text(syncLine, 10, 34, 255, 255, 0);
+
+                    PacketQueueStats vq = g_videoContext.videoQueue.stats();
+                    PacketQueueStats aq = g_videoContext.audioQueue.stats();
+                    char queueStatsLine[192];
+                    snprintf(queueStatsLine, sizeof(queueStatsLine), "vq %d (max %d, %zu KB, empty %llu, alloc %llu)  aq %d (max %d, %zu KB, empty %llu, alloc %llu)",
+                        vq.depth, vq.maxDepth, vq.bytes / 1024, (unsigned long long)vq.underruns, (unsigned long long)vq.shellAllocations,
+                        aq.depth, aq.maxDepth, aq.bytes / 1024, (unsigned long long)aq.underruns, (unsigned long long)aq.shellAllocations);
+                    Text(queueStatsLine, 10, 54, 255, 255, 0);
+
+                    if (g_videoContext.audioRing.capacity > 0) {
+                        int bytesPerSecond = g_videoContext.obtainedAudioSpec.freq * g_videoContext.obtainedAudioSpec.channels * 2;
+                        uint32_t minFill = g_videoContext.audioRing.minFill.load();
+                        char audioLine[128];
+                        snprintf(audioLine, sizeof(audioLine), "audio ring %.0f/%.0f ms (low %.0f ms)  underruns %llu  output latency %.1f ms",
+                            g_videoContext.audioRing.fill() * 1000.0 / bytesPerSecond, g_videoContext.audioRing.capacity * 1000.0 / bytesPerSecond,
+                            minFill != UINT32_MAX ? minFill * 1000.0 / bytesPerSecond : 0.0,
+                            (unsigned long long)g_videoContext.audioRing.underruns.load(), getAudioOutputLatency() * 1000.0);
+                        Text(audioLine, 10, 74, 255, 255, 0);
+                    }
+
+                    MediaReaderStats io = g_videoContext.reader.stats();
+                    char ioLine[128];
+                    if (io.mapped) {
+                        snprintf(ioLine, sizeof(ioLine), "io mapped");
+                    }
+                    else {
+                        snprintf(ioLine, sizeof(ioLine), "io cache %.1f/%.0f MB  stalls %llu (%.0f ms)  restarts %llu",
+                            io.cached / 1048576.0, io.cacheBytes / 1048576.0, (unsigned long long)io.stalls, io.stallMs,
+                            (unsigned long long)io.restarts);
+                    }
+                    Text(ioLine, 10, 94, 255, 255, 0);
+                }
             }
             else if (currentState == STATE_VIDEO_PLAYER) {
                 // If somehow in video player state without a path (e.g. initial failed load)
@@ -1663,10 +2744,46 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
             list(fileCount, Tag);
         }
 
-        SDL_RenderPresent(renderer);
+        if (showRenderStats) {
+            const RenderStats& stats = getRenderStats();
+            char statsLine[128];
+            snprintf(statsLine, sizeof(statsLine), "draws %d  prims %d  quads %d  glyphs %d  runs %d/%d",
+                stats.drawCalls, stats.primitives, stats.textQuads, stats.glyphsRasterized, stats.runCacheHits, stats.runCacheMisses);
+            Text(statsLine, X - 420, 8, 255, 255, 0);
+        }
+
+        if (g_headless.enabled) {
+            bool lastFrame = frameIndex + 1 >= g_headless.frames;
+            bool capture = !g_headless.captureDir.empty() &&
+                (lastFrame || (g_headless.captureEvery > 0 && frameIndex % g_headless.captureEvery == 0));
+            if (capture) {
+                flushRenderBatches(renderer);
+                wchar_t capturePath[MAX_PATH];
+                swprintf_s(capturePath, MAX_PATH, L"%s\\frame_%05d.png", g_headless.captureDir.c_str(), frameIndex);
+                if (!captureFrame(renderer, capturePath)) {
+                    logError("Headless: Failed to capture frame %d.", frameIndex);
+                }
+            }
+            if (lastFrame) running = false;
+        }
+
+        presentFrame(renderer);
+
+        Uint64 frameTime = SDL_GetPerformanceCounter() - frameBegin;
+        frameTimeTotal += frameTime;
+        if (frameTime < frameTimeMin) frameTimeMin = frameTime;
+        if (frameTime > frameTimeMax) frameTimeMax = frameTime;
+        frameIndex++;
+    }
+
+    if (frameIndex > 0) {
+        double toMs = 1000.0 / (double)SDL_GetPerformanceFrequency();
+        logError("Frame time over %d frames: avg %.3f ms, min %.3f ms, max %.3f ms",
+            frameIndex, frameTimeTotal * toMs / frameIndex, frameTimeMin * toMs, frameTimeMax * toMs);
     }
 
     // Cleanup after the main loop exits
+    stopCpuLoad();
     if (currentImage.pixels != nullptr) {
         freeImageData(&currentImage); // Fixed typo
     }
@@ -0,0 +1,182 @@
+#define NOMINMAX
+#include "Header.h"
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mixer.h>
+#include <algorithm>
+
+// Shared audio output.
+// SDL_mixer owns the only audio device. Music and sounds go through Mix_ as
+// before; video audio is added from the post-mix hook, already resampled by
+// swr to the device rate and layout, so nothing is resampled twice.
+//
+// Output latency is measured rather than assumed: the device pulls audio
+// ahead of real time by however much it buffers, so right after a callback
+// (bytes mixed so far / byte rate) - (time since the first callback) is what
+// has been handed over but not heard yet.
+//
+// While the tap is on, the post-mix hook also keeps the last TAP_FRAMES of
+// the final mix as mono floats for the spectrum display. Readers copy it
+// without locking; a copy racing the callback can mix two buffers' worth of
+// samples, which a visualization does not notice.
+
+#define TAP_FRAMES 4096   // Power of two
+
+struct AudioOutputState {
+    bool open = false;
+    AudioOutputInfo info;
+    int bytesPerSecond = 0;
+    AudioSourceCallback source = nullptr;   // Changed only while the post-mix hook is unregistered
+    void* sourceUserdata = nullptr;
+    Uint64 firstCallback = 0;
+    uint64_t bytesMixed = 0;
+    std::atomic<double> latency{ 0.0 };
+    std::atomic<bool> tapEnabled{ false };
+    std::atomic<uint32_t> tapWritten{ 0 };   // Frames written since the tap was enabled
+    float tap[TAP_FRAMES] = {};
+};
+
+static AudioOutputState g_output;
+
+static void tapOutput(const Uint8* stream, int len) {
+    const int channels = g_output.info.channels;
+    const Uint16 format = g_output.info.format;
+    if (channels <= 0 || (format != AUDIO_S16SYS && format != AUDIO_F32SYS)) return;
+    const int frames = len / (channels * (SDL_AUDIO_BITSIZE(format) / 8));
+    const float gain = 1.0f / channels;
+    uint32_t written = g_output.tapWritten.load(std::memory_order_relaxed);
+    for (int i = 0; i < frames; i++) {
+        float sum = 0.0f;
+        if (format == AUDIO_S16SYS) {
+            const Sint16* samples = reinterpret_cast<const Sint16*>(stream) + i * channels;
+            for (int c = 0; c < channels; c++) sum += samples[c] * (1.0f / 32768.0f);
+        }
+        else {
+            const float* samples = reinterpret_cast<const float*>(stream) + i * channels;
+            for (int c = 0; c < channels; c++) sum += samples[c];
+        }
+        g_output.tap[(written + i) & (TAP_FRAMES - 1)] = sum * gain;
+    }
+    g_output.tapWritten.store(written + frames, std::memory_order_release);
+}
+
+static void audioOutputPostMix(void* userdata, Uint8* stream, int len) {
+    (void)userdata;
+    Uint64 now = SDL_GetPerformanceCounter();
+    double bufferSeconds = (double)len / g_output.bytesPerSecond;
+    if (g_output.firstCallback == 0) {
+        g_output.firstCallback = now;
+        g_output.bytesMixed = 0;
+    }
+    g_output.bytesMixed += (uint64_t)len;
+    double elapsed = (double)(now - g_output.firstCallback) / (double)SDL_GetPerformanceFrequency();
+    double ahead = (double)g_output.bytesMixed / g_output.bytesPerSecond - elapsed;
+    if (ahead < bufferSeconds) {
+        // The device fell behind (a glitch or a stall); the buffer just mixed is
+        // at least this far from the speaker, so rebase on it
+        g_output.firstCallback = now;
+        g_output.bytesMixed = (uint64_t)len;
+        ahead = bufferSeconds;
+    }
+    double previous = g_output.latency.load(std::memory_order_relaxed);
+    g_output.latency.store(previous == 0.0 ? ahead : previous * 0.9 + ahead * 0.1, std::memory_order_relaxed);
+
+    if (g_output.source) {
+        g_output.source(g_output.sourceUserdata, stream, len);
+    }
+    if (g_output.tapEnabled.load(std::memory_order_relaxed)) {
+        tapOutput(stream, len);
+    }
+}
+
+// A latency target picks the device buffer: about two buffers are queued at
+// any time, so use the largest power of two that keeps two under the target.
+static int bufferSamplesFor(const AudioOutputOptions& options) {
+    int samples = options.bufferSamples;
+    if (options.targetLatencyMs > 0) {
+        int limit = options.frequency * options.targetLatencyMs / 2000;
+        samples = 256;
+        while (samples * 2 <= limit) samples *= 2;
+    }
+    return std::max(256, std::min(samples, 16384));
+}
+
+bool openAudioOutput(const AudioOutputOptions& options) {
+    if (g_output.open) return true;
+    int bufferSamples = bufferSamplesFor(options);
+    // Rate and channel changes are allowed so the device runs at its native
+    // rate; Mix_ and swr resample into it once
+    if (Mix_OpenAudioDevice(options.frequency, MIX_DEFAULT_FORMAT, 2, bufferSamples, nullptr,
+        SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE) < 0) {
+        logError("Mix_OpenAudioDevice failed: %s", Mix_GetError());
+        return false;
+    }
+    int frequency = 0;
+    Uint16 format = 0;
+    int channels = 0;
+    Mix_QuerySpec(&frequency, &format, &channels);
+
+    g_output.info.frequency = frequency;
+    g_output.info.format = format;
+    g_output.info.channels = channels;
+    g_output.info.bufferSamples = bufferSamples;
+    g_output.info.bufferLatency = frequency > 0 ? (double)bufferSamples / frequency : 0.0;
+    g_output.bytesPerSecond = frequency * channels * (SDL_AUDIO_BITSIZE(format) / 8);
+    g_output.firstCallback = 0;
+    g_output.bytesMixed = 0;
+    g_output.latency.store(0.0);
+    g_output.open = true;
+    Mix_SetPostMix(audioOutputPostMix, nullptr);
+    logError("Audio output: %d Hz, %d channels, format 0x%04x, %d-sample buffer (%.1f ms).",
+        frequency, channels, format, bufferSamples, g_output.info.bufferLatency * 1000.0);
+    return true;
+}
+
+void closeAudioOutput() {
+    if (!g_output.open) return;
+    Mix_SetPostMix(nullptr, nullptr);
+    logError("Audio output: measured latency %.1f ms.", g_output.latency.load() * 1000.0);
+    Mix_CloseAudio();
+    g_output.source = nullptr;
+    g_output.sourceUserdata = nullptr;
+    g_output.open = false;
+    g_output.tapEnabled = false;
+    g_output.info = AudioOutputInfo();
+}
+
+AudioOutputInfo getAudioOutputInfo() {
+    AudioOutputInfo info = g_output.info;
+    info.measuredLatency = g_output.latency.load();
+    return info;
+}
+
+double getAudioOutputLatency() {
+    double latency = g_output.latency.load(std::memory_order_relaxed);
+    return latency > 0.0 ? latency : 2.0 * g_output.info.bufferLatency;
+}
+
+// Mix_SetPostMix takes the device lock, so unhooking first guarantees the old
+// source is not running when it is replaced (or torn down by the caller).
+void setAudioOutputSource(AudioSourceCallback callback, void* userdata) {
+    if (!g_output.open) return;
+    Mix_SetPostMix(nullptr, nullptr);
+    g_output.source = callback;
+    g_output.sourceUserdata = userdata;
+    Mix_SetPostMix(audioOutputPostMix, nullptr);
+}
+
+void setAudioOutputTap(bool enabled) {
+    if (enabled && !g_output.tapEnabled.load()) {
+        g_output.tapWritten.store(0);
+    }
+    g_output.tapEnabled.store(enabled);
+}
+
+bool readAudioOutputTap(float* samples, int count) {
+    if (count <= 0 || count > TAP_FRAMES || !g_output.tapEnabled.load()) return false;
+    uint32_t written = g_output.tapWritten.load(std::memory_order_acquire);
+    if (written < (uint32_t)count) return false;
+    for (int i = 0; i < count; i++) {
+        samples[i] = g_output.tap[(written - count + i) & (TAP_FRAMES - 1)];
+    }
+    return true;
+}
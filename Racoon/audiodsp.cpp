@@ -0,0 +1,260 @@
+#define NOMINMAX
+#include "Header.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// Float processing kernels for decoded audio.
+// decodeNextAudioPacket resamples to interleaved float, runs atempo, downmix
+// and gain on that in place, and converts to the device's S16 once at the
+// end with convertAudioToS16. The kernels have SSE2 paths (every x64 target
+// and x86 built with /arch:SSE2) and a scalar tail that doubles as the
+// fallback; both produce bit-identical results, which the self-test checks.
+
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define AUDIO_DSP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+void scaleAudioSamples(float* samples, size_t count, float gain) {
+    size_t i = 0;
+#ifdef AUDIO_DSP_SSE2
+    __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), g));
+    }
+#endif
+    for (; i < count; i++) samples[i] *= gain;
+}
+
+// Linear ramp from `from` to `to` across the chunk, one step per frame, so a
+// volume change or a mute does not click. Only runs on the chunk where the
+// gain changes, so it stays scalar.
+void rampAudioSamples(float* samples, size_t frames, int channels, float from, float to) {
+    if (frames == 0) return;
+    float range = to - from;
+    for (size_t f = 0; f < frames; f++) {
+        float gain = from + range * (float)(f + 1) / (float)frames;
+        for (int c = 0; c < channels; c++) samples[f * channels + c] *= gain;
+    }
+}
+
+void downmixAudioToMono(float* samples, size_t frames, int channels) {
+    if (channels < 2) return;
+    size_t f = 0;
+    if (channels == 2) {
+#ifdef AUDIO_DSP_SSE2
+        // Two stereo frames per register: L0 R0 L1 R1 + R0 L0 R1 L1
+        __m128 half = _mm_set1_ps(0.5f);
+        for (; f + 2 <= frames; f += 2) {
+            __m128 v = _mm_loadu_ps(samples + f * 2);
+            __m128 swapped = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+            _mm_storeu_ps(samples + f * 2, _mm_mul_ps(_mm_add_ps(v, swapped), half));
+        }
+#endif
+        for (; f < frames; f++) {
+            float mid = (samples[f * 2] + samples[f * 2 + 1]) * 0.5f;
+            samples[f * 2] = mid;
+            samples[f * 2 + 1] = mid;
+        }
+        return;
+    }
+    float scale = 1.0f / (float)channels;
+    for (; f < frames; f++) {
+        float* frame = samples + f * channels;
+        float sum = 0.0f;
+        for (int c = 0; c < channels; c++) sum += frame[c];
+        sum *= scale;
+        for (int c = 0; c < channels; c++) frame[c] = sum;
+    }
+}
+
+// Same scaling as swresample's flt -> s16: x * 32768, rounded to nearest
+// even and saturated. The clamp comes before the conversion because
+// cvtps2dq turns anything out of int32 range into INT_MIN.
+void convertAudioToS16(const float* samples, int16_t* output, size_t count) {
+    size_t i = 0;
+#ifdef AUDIO_DSP_SSE2
+    __m128 scale = _mm_set1_ps(32768.0f);
+    __m128 low = _mm_set1_ps(-32768.0f);
+    __m128 high = _mm_set1_ps(32767.0f);
+    for (; i + 8 <= count; i += 8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(samples + i), scale), low), high);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(samples + i + 4), scale), low), high);
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), packed);
+    }
+#endif
+    for (; i < count; i++) {
+        float v = std::min(std::max(samples[i] * 32768.0f, -32768.0f), 32767.0f);
+        output[i] = (int16_t)lrintf(v);
+    }
+}
+
+// Self-test (--audio-selftest)
+
+static bool checkKernels() {
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> sampleValue(-1.5f, 1.5f);
+    const size_t lengths[] = { 0, 1, 3, 4, 7, 8, 9, 15, 1023, 4099 };
+    bool ok = true;
+
+    for (size_t length : lengths) {
+        std::vector<float> input(length);
+        for (float& v : input) v = sampleValue(random);
+        if (length > 3) {
+            input[0] = 1.0f;                // Exactly full scale: saturates to 32767
+            input[1] = -1.0f;
+            input[2] = 0.5f / 32768.0f;     // Ties round to even
+            input[3] = 1e9f;                // Far out of int32 range after scaling
+        }
+
+        std::vector<float> scaled = input;
+        scaleAudioSamples(scaled.data(), length, 0.3f);
+        for (size_t i = 0; i < length; i++) {
+            if (scaled[i] != input[i] * 0.3f) {
+                logError("AudioSelfTest: FAIL scale, length %zu, sample %zu", length, i);
+                ok = false;
+                break;
+            }
+        }
+
+        std::vector<int16_t> converted(length);
+        convertAudioToS16(input.data(), converted.data(), length);
+        for (size_t i = 0; i < length; i++) {
+            float v = std::min(std::max(input[i] * 32768.0f, -32768.0f), 32767.0f);
+            if (converted[i] != (int16_t)lrintf(v)) {
+                logError("AudioSelfTest: FAIL S16 conversion, length %zu, sample %zu: %d vs %ld", length, i, converted[i], lrintf(v));
+                ok = false;
+                break;
+            }
+        }
+
+        for (int channels : { 2, 6 }) {
+            size_t frames = length / channels;
+            std::vector<float> mixed(input.begin(), input.begin() + frames * channels);
+            downmixAudioToMono(mixed.data(), frames, channels);
+            bool mixedOk = true;
+            for (size_t f = 0; f < frames && mixedOk; f++) {
+                float sum = 0.0f;
+                for (int c = 0; c < channels; c++) sum += input[f * channels + c];
+                float expected = channels == 2 ? sum * 0.5f : sum * (1.0f / (float)channels);
+                for (int c = 0; c < channels; c++) {
+                    if (mixed[f * channels + c] != expected) {
+                        logError("AudioSelfTest: FAIL %d-channel downmix, length %zu, frame %zu", channels, length, f);
+                        mixedOk = false;
+                        break;
+                    }
+                }
+            }
+            ok = ok && mixedOk;
+        }
+    }
+
+    std::vector<float> ramp(200, 1.0f);
+    rampAudioSamples(ramp.data(), 100, 2, 1.0f, 0.0f);
+    if (ramp[198] != 0.0f || ramp[199] != 0.0f || !(ramp[0] < 1.0f && ramp[0] > 0.98f)) {
+        logError("AudioSelfTest: FAIL ramp end points");
+        ok = false;
+    }
+    return ok;
+}
+
+// Pushes `total` input frames through swr in chunks cycling through
+// `chunks`, sizing every output from swr_get_out_samples the way
+// decodeNextAudioPacket does, then flushes. Returns the output frame count,
+// or -1 if a call produced more than its bound (i.e. would have overrun the
+// preallocated buffer) or failed.
+static int64_t resampleFrameCount(int inRate, int outRate, int64_t total, const std::vector<int>& chunks) {
+    SwrContext* swr = nullptr;
+    AVChannelLayout stereo;
+    av_channel_layout_default(&stereo, 2);
+    if (swr_alloc_set_opts2(&swr, &stereo, AV_SAMPLE_FMT_FLT, outRate, &stereo, AV_SAMPLE_FMT_FLT, inRate, 0, nullptr) < 0 ||
+        swr_init(swr) < 0) {
+        swr_free(&swr);
+        return -1;
+    }
+
+    int largest = *std::max_element(chunks.begin(), chunks.end());
+    std::vector<float> input((size_t)largest * 2);
+    for (size_t i = 0; i < input.size(); i++) input[i] = (float)std::sin(i * 0.01);
+    std::vector<float> output;
+    int64_t produced = 0;
+    int64_t fed = 0;
+    size_t next = 0;
+    bool ok = true;
+
+    while (ok) {
+        int count = 0;
+        const uint8_t* in = nullptr;
+        if (fed < total) {
+            count = (int)std::min<int64_t>(chunks[next++ % chunks.size()], total - fed);
+            in = reinterpret_cast<const uint8_t*>(input.data());
+        }
+        int bound = swr_get_out_samples(swr, count);
+        if (bound < 0) {
+            ok = false;
+            break;
+        }
+        output.resize((size_t)std::max(bound, 1) * 2);
+        uint8_t* out = reinterpret_cast<uint8_t*>(output.data());
+        int got = swr_convert(swr, &out, bound, in ? &in : nullptr, count);
+        if (got < 0 || got > bound) {
+            logError("AudioSelfTest: FAIL %d -> %d Hz: %d frames in, %d out, bound %d", inRate, outRate, count, got, bound);
+            ok = false;
+            break;
+        }
+        produced += got;
+        fed += count;
+        if (count == 0 && got == 0) break;   // Flushed
+    }
+
+    swr_free(&swr);
+    av_channel_layout_uninit(&stereo);
+    return ok ? produced : -1;
+}
+
+static bool checkResampleCounts() {
+    struct RatePair { int in, out; };
+    const RatePair pairs[] = { { 44100, 48000 }, { 48000, 44100 }, { 22050, 48000 }, { 96000, 44100 }, { 8000, 48000 }, { 48000, 48000 } };
+    const std::vector<std::vector<int>> chunkings = { { 1024 }, { 1152 }, { 4096 }, { 997, 64, 2048, 1 } };
+    bool ok = true;
+
+    for (const RatePair& pair : pairs) {
+        int64_t total = (int64_t)pair.in * 2 + 123;
+        int64_t whole = resampleFrameCount(pair.in, pair.out, total, { (int)total });
+        double ideal = (double)total * pair.out / pair.in;
+        if (whole < 0 || std::fabs((double)whole - ideal) > 1.0) {
+            logError("AudioSelfTest: FAIL %d -> %d Hz: %lld frames in one call, expected %.1f", pair.in, pair.out, (long long)whole, ideal);
+            ok = false;
+            continue;
+        }
+        for (const std::vector<int>& chunks : chunkings) {
+            int64_t chunked = resampleFrameCount(pair.in, pair.out, total, chunks);
+            if (chunked != whole) {
+                logError("AudioSelfTest: FAIL %d -> %d Hz: %lld frames in chunks of %d..., %lld in one call",
+                    pair.in, pair.out, (long long)chunked, chunks[0], (long long)whole);
+                ok = false;
+            }
+        }
+        logError("AudioSelfTest: %d -> %d Hz: %lld -> %lld frames", pair.in, pair.out, (long long)total, (long long)whole);
+    }
+    return ok;
+}
+
+// Kernels against their scalar definitions, then resampler output counts:
+// every chunk fits the swr_get_out_samples bound the buffers are sized
+// from, and the total after the flush matches the rate ratio and does not
+// depend on how the input was chunked.
+bool runAudioProcessingSelfTest() {
+    bool kernels = checkKernels();
+    bool counts = checkResampleCounts();
+    logError("AudioSelfTest: kernels %s (%s), resampler counts %s.", kernels ? "PASSED" : "FAILED",
+#ifdef AUDIO_DSP_SSE2
+        "SSE2",
+#else
+        "scalar",
+#endif
+        counts ? "PASSED" : "FAILED");
+    return kernels && counts;
+}
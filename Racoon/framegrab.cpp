@@ -0,0 +1,322 @@
+#define NOMINMAX
+#include "Header.h"
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <stdlib.h>
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+// Stills from video.
+// A snapshot takes a new reference to the frame on screen (the decoded
+// source frame, not the display-sized texture), so the player gives up
+// nothing but a refcount; the RGBA conversion at source resolution and the
+// encode run on a worker.
+//
+// Batch export splits the file into equal time segments, one per thread,
+// each with its own demuxer and decoder, like the waveform overview. Frame
+// numbers come from timestamps (pts / frame duration), so every segment
+// agrees on which frames are every Nth without decoding the ones before it.
+
+static const int MAX_EXPORT_THREADS = 8;
+
+struct SnapshotJob {
+    AVFrame* frame = nullptr;
+    std::wstring path;
+    ImageSaveFormat format = SAVE_FORMAT_PNG;
+    int quality = 90;
+};
+
+struct SnapshotWorker {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<SnapshotJob> jobs;
+    bool stop = false;
+    std::atomic<int> pending{ 0 };
+};
+
+static SnapshotWorker g_snapshots;
+
+static int swsColorspaceFor(const AVFrame* frame) {
+    switch (frame->colorspace) {
+    case AVCOL_SPC_BT709: return SWS_CS_ITU709;
+    case AVCOL_SPC_BT2020_NCL:
+    case AVCOL_SPC_BT2020_CL: return SWS_CS_BT2020;
+    case AVCOL_SPC_SMPTE240M: return SWS_CS_SMPTE240M;
+    case AVCOL_SPC_UNSPECIFIED: return frame->height > 576 ? SWS_CS_ITU709 : SWS_CS_ITU601;
+    default: return SWS_CS_ITU601;
+    }
+}
+
+// Full-resolution, full-range RGBA with the frame's own matrix and range;
+// unlike playback, quality matters more than speed here
+static bool frameToImage(const AVFrame* frame, SwsContext** swsContext, ImageData& image) {
+    *swsContext = sws_getCachedContext(*swsContext, frame->width, frame->height, (AVPixelFormat)frame->format,
+        frame->width, frame->height, AV_PIX_FMT_RGBA, SWS_BICUBIC | SWS_ACCURATE_RND | SWS_FULL_CHR_H_INT,
+        nullptr, nullptr, nullptr);
+    unsigned char* pixels = static_cast<unsigned char*>(malloc((size_t)frame->width * frame->height * 4));
+    if (!*swsContext || !pixels) {
+        free(pixels);
+        return false;
+    }
+    const int* coefficients = sws_getCoefficients(swsColorspaceFor(frame));
+    int srcFullRange = frame->color_range == AVCOL_RANGE_JPEG || frame->format == AV_PIX_FMT_YUVJ420P ||
+        frame->format == AV_PIX_FMT_YUVJ422P || frame->format == AV_PIX_FMT_YUVJ444P;
+    sws_setColorspaceDetails(*swsContext, coefficients, srcFullRange, coefficients, 1, 0, 1 << 16, 1 << 16);
+
+    uint8_t* dst[4] = { pixels, nullptr, nullptr, nullptr };
+    int dstStride[4] = { frame->width * 4, 0, 0, 0 };
+    sws_scale(*swsContext, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+    image.pixels = pixels;
+    image.width = frame->width;
+    image.height = frame->height;
+    image.channels = 4;
+    return true;
+}
+
+static void snapshotWorkerMain() {
+    SwsContext* swsContext = nullptr;
+    std::unique_lock<std::mutex> lock(g_snapshots.mutex);
+    while (true) {
+        g_snapshots.wake.wait(lock, [] { return g_snapshots.stop || !g_snapshots.jobs.empty(); });
+        if (g_snapshots.jobs.empty()) break;   // Stopping, and everything queued is saved
+        SnapshotJob job = g_snapshots.jobs.front();
+        g_snapshots.jobs.pop_front();
+        lock.unlock();
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        ImageData image = {};
+        bool saved = frameToImage(job.frame, &swsContext, image) &&
+            saveImage(&image, job.path.c_str(), job.format, job.quality);
+        double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+        if (saved) {
+            logError("Snapshot: %dx%d saved to %s in %.1f ms.", job.frame->width, job.frame->height, cc(job.path.c_str()).c_str(), ms);
+        }
+        else {
+            logError("Snapshot: Could not save %s", cc(job.path.c_str()).c_str());
+        }
+        free(image.pixels);
+        av_frame_free(&job.frame);
+        g_snapshots.pending--;
+        lock.lock();
+    }
+    sws_freeContext(swsContext);
+}
+
+bool saveVideoSnapshot(const VideoContext& videoCtx, const std::wstring& outputPath, ImageSaveFormat format, int quality) {
+    if (!videoCtx.hasShownFrame || !videoCtx.shownFrame || !videoCtx.shownFrame->data[0]) return false;
+    AVFrame* frame = av_frame_clone(videoCtx.shownFrame);
+    if (!frame) return false;
+    std::lock_guard<std::mutex> lock(g_snapshots.mutex);
+    if (!g_snapshots.thread.joinable()) {
+        g_snapshots.stop = false;
+        g_snapshots.thread = std::thread(snapshotWorkerMain);
+    }
+    SnapshotJob job;
+    job.frame = frame;
+    job.path = outputPath;
+    job.format = format;
+    job.quality = quality;
+    g_snapshots.jobs.push_back(job);
+    g_snapshots.pending++;
+    g_snapshots.wake.notify_one();
+    return true;
+}
+
+int pendingVideoSnapshots() {
+    return g_snapshots.pending.load();
+}
+
+void shutdownVideoSnapshots() {
+    if (!g_snapshots.thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(g_snapshots.mutex);
+        g_snapshots.stop = true;
+    }
+    g_snapshots.wake.notify_one();
+    g_snapshots.thread.join();
+}
+
+const wchar_t* imageSaveExtension(ImageSaveFormat format) {
+    switch (format) {
+    case SAVE_FORMAT_BMP: return L"bmp";
+    case SAVE_FORMAT_TGA: return L"tga";
+    case SAVE_FORMAT_JPG: return L"jpg";
+    case SAVE_FORMAT_WEBP: return L"webp";
+    case SAVE_FORMAT_AVIF: return L"avif";
+    default: return L"png";
+    }
+}
+
+bool parseImageSaveFormat(const wchar_t* name, ImageSaveFormat* format) {
+    static const ImageSaveFormat formats[] = { SAVE_FORMAT_PNG, SAVE_FORMAT_BMP, SAVE_FORMAT_TGA, SAVE_FORMAT_JPG, SAVE_FORMAT_WEBP, SAVE_FORMAT_AVIF };
+    for (ImageSaveFormat candidate : formats) {
+        if (_wcsicmp(name, imageSaveExtension(candidate)) == 0) {
+            *format = candidate;
+            return true;
+        }
+    }
+    if (_wcsicmp(name, L"jpeg") == 0) {
+        *format = SAVE_FORMAT_JPG;
+        return true;
+    }
+    return false;
+}
+
+struct ExportSegment {
+    std::string path;
+    std::wstring outputPrefix;     // Directory and base name; the frame number and extension follow
+    int everyNth = 0;              // 0: keyframes
+    ImageSaveFormat format = SAVE_FORMAT_PNG;
+    int quality = 90;
+    double from = 0.0;             // Stream seconds, [from, to)
+    double to = 0.0;
+    int saved = 0;
+    int failed = 0;
+};
+
+static void exportSegmentMain(ExportSegment* segment) {
+    AVFormatContext* formatContext = nullptr;
+    if (avformat_open_input(&formatContext, segment->path.c_str(), nullptr, nullptr) != 0) return;
+    const AVCodec* codec = nullptr;
+    int streamIndex = -1;
+    if (avformat_find_stream_info(formatContext, nullptr) >= 0) {
+        streamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    }
+    AVCodecContext* codecContext = streamIndex >= 0 && codec ? avcodec_alloc_context3(codec) : nullptr;
+    if (!codecContext || avcodec_parameters_to_context(codecContext, formatContext->streams[streamIndex]->codecpar) < 0) {
+        avcodec_free_context(&codecContext);
+        avformat_close_input(&formatContext);
+        return;
+    }
+    for (unsigned int i = 0; i < formatContext->nb_streams; i++) {
+        if ((int)i != streamIndex) formatContext->streams[i]->discard = AVDISCARD_ALL;
+    }
+    bool keyframesOnly = segment->everyNth <= 0;
+    codecContext->thread_count = 1;    // The segments are the parallelism
+    if (keyframesOnly) codecContext->skip_frame = AVDISCARD_NONKEY;
+    if (avcodec_open2(codecContext, codec, nullptr) < 0) {
+        avcodec_free_context(&codecContext);
+        avformat_close_input(&formatContext);
+        return;
+    }
+
+    AVStream* stream = formatContext->streams[streamIndex];
+    double timeBase = av_q2d(stream->time_base);
+    double startTime = stream->start_time != AV_NOPTS_VALUE ? stream->start_time * timeBase : 0.0;
+    AVRational frameRate = av_guess_frame_rate(formatContext, stream, nullptr);
+    double frameDuration = (frameRate.num > 0 && frameRate.den > 0) ? av_q2d(av_inv_q(frameRate)) : 1.0 / 30.0;
+    if (segment->from > startTime) {
+        av_seek_frame(formatContext, streamIndex, (int64_t)(segment->from / timeBase), AVSEEK_FLAG_BACKWARD);
+    }
+
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    SwsContext* swsContext = nullptr;
+    bool draining = false;
+    while (packet && frame) {
+        int ret = avcodec_receive_frame(codecContext, frame);
+        if (ret == AVERROR(EAGAIN)) {
+            if (draining) break;
+            if (av_read_frame(formatContext, packet) < 0) {
+                avcodec_send_packet(codecContext, nullptr);
+                draining = true;
+                continue;
+            }
+            // Keyframe export never needs the packets in between
+            if (packet->stream_index == streamIndex && (!keyframesOnly || (packet->flags & AV_PKT_FLAG_KEY))) {
+                avcodec_send_packet(codecContext, packet);
+            }
+            av_packet_unref(packet);
+            continue;
+        }
+        if (ret < 0) break;
+
+        if (frame->best_effort_timestamp == AV_NOPTS_VALUE) {
+            av_frame_unref(frame);
+            continue;
+        }
+        double pts = frame->best_effort_timestamp * timeBase;
+        if (pts >= segment->to) break;
+        int64_t number = llround((pts - startTime) / frameDuration);
+        if (pts >= segment->from && (keyframesOnly || number % segment->everyNth == 0)) {
+            wchar_t suffix[48];
+            swprintf(suffix, 48, L"_%06lld.%s", (long long)number, imageSaveExtension(segment->format));
+            std::wstring outputPath = segment->outputPrefix + suffix;
+            ImageData image = {};
+            if (frameToImage(frame, &swsContext, image) && saveImage(&image, outputPath.c_str(), segment->format, segment->quality)) {
+                segment->saved++;
+            }
+            else {
+                segment->failed++;
+            }
+            free(image.pixels);
+        }
+        av_frame_unref(frame);
+    }
+
+    sws_freeContext(swsContext);
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&codecContext);
+    avformat_close_input(&formatContext);
+}
+
+int extractVideoFrames(const std::wstring& path, const std::wstring& outputDir, int everyNth, ImageSaveFormat format, int quality, int threads) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    std::string narrowPath = cc(path.c_str());
+    AVFormatContext* formatContext = nullptr;
+    if (avformat_open_input(&formatContext, narrowPath.c_str(), nullptr, nullptr) != 0) {
+        logError("Frame export: Could not open %s", narrowPath.c_str());
+        return -1;
+    }
+    int streamIndex = -1;
+    if (avformat_find_stream_info(formatContext, nullptr) >= 0) {
+        streamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    }
+    double startTime = 0.0, duration = 0.0;
+    if (streamIndex >= 0) {
+        AVStream* stream = formatContext->streams[streamIndex];
+        if (stream->start_time != AV_NOPTS_VALUE) startTime = stream->start_time * av_q2d(stream->time_base);
+        if (formatContext->duration > 0) duration = (double)formatContext->duration / AV_TIME_BASE;
+    }
+    avformat_close_input(&formatContext);
+    if (streamIndex < 0) {
+        logError("Frame export: %s has no video stream.", narrowPath.c_str());
+        return -1;
+    }
+    CreateDirectoryW(outputDir.c_str(), nullptr);
+
+    // Without a duration the segments cannot be placed; one thread does it all
+    if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+    threads = duration > 0.0 ? std::max(1, std::min(threads, MAX_EXPORT_THREADS)) : 1;
+    std::wstring baseName = path.substr(path.find_last_of(L"\\/") + 1);
+    baseName = baseName.substr(0, baseName.find_last_of(L'.'));
+    std::vector<ExportSegment> segments(threads);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        ExportSegment& segment = segments[i];
+        segment.path = narrowPath;
+        segment.outputPrefix = outputDir + L"\\" + baseName;
+        segment.everyNth = everyNth;
+        segment.format = format;
+        segment.quality = quality;
+        segment.from = i == 0 ? -1e300 : startTime + duration * i / threads;
+        segment.to = i == threads - 1 ? 1e300 : startTime + duration * (i + 1) / threads;
+    }
+    for (ExportSegment& segment : segments) workers.emplace_back(exportSegmentMain, &segment);
+    int saved = 0, failed = 0;
+    for (int i = 0; i < threads; i++) {
+        workers[i].join();
+        saved += segments[i].saved;
+        failed += segments[i].failed;
+    }
+
+    double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    logError("Frame export: %d %s saved (%d failed) from %s to %s with %d thread(s) in %.0f ms (%.1f frames/s).",
+        saved, everyNth > 0 ? "frames" : "keyframes", failed, narrowPath.c_str(), cc(outputDir.c_str()).c_str(),
+        threads, ms, ms > 0.0 ? saved * 1000.0 / ms : 0.0);
+    return saved;
+}
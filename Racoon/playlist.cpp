@@ -0,0 +1,433 @@
+#define NOMINMAX
+#include "Header.h"
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mixer.h>
+#include <algorithm>
+#include <memory>
+
+// Gapless playlist for the sound player.
+// Mix_Music plays one file and has to be freed and reloaded for the next,
+// which leaves a gap. Here each track is an audio-only FFmpeg stream
+// (openAudioStream): its own demux and decode threads keep about a second of
+// audio, already in the device format, waiting in the track's AudioRing, so
+// memory stays the same however long the file is. The next track is opened
+// by a loader thread while the previous one plays and fills its ring ahead
+// of time; the music hook reads from the end of one ring straight into the
+// start of the next inside the same callback, so the switch lands on an
+// exact sample. An optional crossfade overlaps the two instead.
+//
+// Ownership: the loader opens tracks and hands the next one over through
+// `next`; the hook only moves forward through them and publishes the track
+// it plays in `playing`; the main thread (updatePlaylist) closes tracks that
+// were passed. Nothing on the audio thread allocates, frees or locks.
+
+static const Uint32 FADE_SCRATCH_BYTES = 16384;
+
+struct PlaylistTrack {
+    std::unique_ptr<VideoContext> stream;  // nullptr for synthetic test tracks
+    AudioRing* ring = nullptr;
+    std::atomic<bool>* finished = nullptr; // Decoder drained; the rest is in the ring
+    int index = -1;                        // Into PlaylistEngine::paths
+};
+
+struct PlaylistEngine {
+    std::vector<std::wstring> paths;
+    int frameBytes = 4;            // One sample frame, all channels (S16)
+    Uint32 crossfadeBytes = 0;
+
+    // Audio thread
+    PlaylistTrack* current = nullptr;
+    bool fading = false;
+    Uint32 fadeLength = 0;         // Bytes of current left when the fade began
+    Uint32 fadeDone = 0;
+    std::vector<Uint8> fadeFrom;   // Scratch for both sides of a crossfade, sized up front
+    std::vector<Uint8> fadeTo;
+
+    std::atomic<PlaylistTrack*> next{ nullptr };
+    std::atomic<PlaylistTrack*> playing{ nullptr };
+    std::atomic<bool> loaderDone{ false };     // Every remaining path has been handed over or skipped
+    std::atomic<bool> finished{ false };
+    std::atomic<int> transitions{ 0 };
+
+    // Loader thread; tracks is shared with the main thread under mutex
+    std::thread loaderThread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stop = false;
+    int loadIndex = 0;             // Next path to load
+    std::deque<PlaylistTrack*> tracks;   // Loaded, in play order
+};
+
+static PlaylistEngine g_playlist;
+static bool g_playlistHooked = false;
+
+static void freeTrack(PlaylistTrack* track) {
+    if (!track) return;
+    if (track->stream) closeVideoFile(*track->stream);
+    delete track;
+}
+
+static PlaylistTrack* loadTrack(const PlaylistEngine& engine, int index) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    std::string path = cc(engine.paths[index].c_str());
+    std::unique_ptr<VideoContext> stream(new VideoContext());
+    if (!openAudioStream(path.c_str(), *stream)) {
+        logError("Playlist: Skipping %s: no playable audio.", path.c_str());
+        return nullptr;
+    }
+    PlaylistTrack* track = new PlaylistTrack();
+    track->ring = &stream->audioRing;
+    track->finished = &stream->audioFinished;
+    track->stream = std::move(stream);
+    track->index = index;
+    logError("Playlist: Opened track %d (%s), %.1f s, in %.1f ms.", index + 1, path.c_str(), track->stream->duration,
+        (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency());
+    return track;
+}
+
+// Keeps exactly one opened track waiting in `next`. Failed files are skipped.
+static void playlistLoaderMain(PlaylistEngine* engine) {
+    std::unique_lock<std::mutex> lock(engine->mutex);
+    while (!engine->stop) {
+        if (engine->loadIndex >= (int)engine->paths.size()) engine->loaderDone.store(true);
+        if (engine->next.load() != nullptr || engine->loadIndex >= (int)engine->paths.size()) {
+            engine->wake.wait(lock);
+            continue;
+        }
+        int index = engine->loadIndex++;
+        lock.unlock();
+        PlaylistTrack* track = loadTrack(*engine, index);
+        lock.lock();
+        if (!track) continue;
+        if (engine->stop) {
+            freeTrack(track);
+            break;
+        }
+        engine->tracks.push_back(track);
+        engine->next.store(track, std::memory_order_release);
+    }
+}
+
+// False while a seek on the track is in flight: its ring still holds audio
+// from before the seek, or nothing yet
+static bool trackReadable(const PlaylistTrack* track) {
+    if (!track->stream) return true;
+    const VideoContext& stream = *track->stream;
+    return stream.seekRequests.load() == stream.seeksCompleted.load() &&
+        track->ring->serial.load(std::memory_order_acquire) == stream.audioQueue.serial();
+}
+
+// The decoder sets `finished` only after its last write to the ring
+static bool trackEnded(const PlaylistTrack* track) {
+    return track->finished->load(std::memory_order_acquire) && track->ring->fill() == 0;
+}
+
+// Moves to the waiting track. Returns false if none is ready.
+static bool advanceTrack(PlaylistEngine& engine) {
+    PlaylistTrack* track = engine.next.exchange(nullptr, std::memory_order_acquire);
+    if (!track) return false;
+    engine.current = track;
+    engine.fading = false;
+    engine.playing.store(track, std::memory_order_release);
+    engine.transitions++;
+    return true;
+}
+
+static void crossfadeInto(Uint8* out, const Uint8* from, const Uint8* to, Uint32 bytes, Uint32 doneBytes, Uint32 fadeBytes, int channels) {
+    const Sint16* a = reinterpret_cast<const Sint16*>(from);
+    const Sint16* b = reinterpret_cast<const Sint16*>(to);
+    Sint16* dst = reinterpret_cast<Sint16*>(out);
+    const Uint32 frameBytes = channels * sizeof(Sint16);
+    int frames = (int)(bytes / frameBytes);
+    float step = 1.0f / (float)(fadeBytes / frameBytes);
+    float gain = (float)(doneBytes / frameBytes) * step;   // 0 -> 1 for the incoming track
+    for (int i = 0; i < frames; i++, gain += step) {
+        for (int c = 0; c < channels; c++) {
+            float mixed = a[c] * (1.0f - gain) + b[c] * gain;
+            *dst++ = (Sint16)std::max(-32768.0f, std::min(32767.0f, mixed));
+        }
+        a += channels;
+        b += channels;
+    }
+}
+
+// Music hook on SDL_mixer's audio thread. `stream` arrives silent.
+static void playlistMix(void* userdata, Uint8* stream, int len) {
+    PlaylistEngine& engine = *static_cast<PlaylistEngine*>(userdata);
+    const int channels = engine.frameBytes / (int)sizeof(Sint16);
+    Uint32 written = 0;
+    while (written < (Uint32)len) {
+        PlaylistTrack* current = engine.current;
+        if (!current || (trackReadable(current) && trackEnded(current))) {
+            if (!advanceTrack(engine)) {
+                // Next track not open yet (silence until it is), or the end of the list
+                if (current && engine.loaderDone.load() && engine.next.load() == nullptr) engine.finished.store(true);
+                break;
+            }
+            continue;
+        }
+        if (!trackReadable(current)) break;   // Seek in flight
+
+        Uint32 want = (Uint32)len - written;
+        bool currentFinished = current->finished->load(std::memory_order_acquire);
+        if (engine.fading && !currentFinished) engine.fading = false;   // A seek restarted the track
+        if (engine.crossfadeBytes > 0 && !engine.fading && currentFinished) {
+            // Once the decoder is done the ring holds exactly what is left.
+            // Stop short of the fade, then start it if the next track has
+            // enough buffered; otherwise the tracks are joined gaplessly.
+            Uint32 left = current->ring->fill();
+            PlaylistTrack* next = engine.next.load(std::memory_order_acquire);
+            if (left > engine.crossfadeBytes) {
+                want = std::min(want, left - engine.crossfadeBytes);
+            }
+            else if (next && left > 0 && trackReadable(next) && next->ring->fill() >= left) {
+                engine.fading = true;
+                engine.fadeLength = left;
+                engine.fadeDone = 0;
+            }
+        }
+
+        if (engine.fading) {
+            PlaylistTrack* next = engine.next.load(std::memory_order_relaxed);
+            Uint32 chunk = std::min({ want, engine.fadeLength - engine.fadeDone, (Uint32)engine.fadeFrom.size() });
+            Uint32 got = current->ring->read(engine.fadeFrom.data(), chunk);
+            Uint32 incoming = next->ring->read(engine.fadeTo.data(), got);
+            memset(engine.fadeTo.data() + incoming, 0, got - incoming);
+            crossfadeInto(stream + written, engine.fadeFrom.data(), engine.fadeTo.data(), got, engine.fadeDone, engine.fadeLength, channels);
+            engine.fadeDone += got;
+            written += got;
+            if (got < chunk) break;
+            continue;
+        }
+
+        Uint32 got = current->ring->read(stream + written, want);
+        written += got;
+        if (got < want && !trackEnded(current)) {
+            if (current->ring->primed.load()) current->ring->underruns++;
+            break;
+        }
+    }
+}
+
+static void stopLoader(PlaylistEngine& engine) {
+    if (engine.loaderThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(engine.mutex);
+            engine.stop = true;
+        }
+        engine.wake.notify_all();
+        engine.loaderThread.join();
+    }
+}
+
+// Unhooked first, so nothing below races the audio thread
+static void resetPlaylist(PlaylistEngine& engine) {
+    if (g_playlistHooked) {
+        Mix_HookMusic(nullptr, nullptr);
+        g_playlistHooked = false;
+    }
+    stopLoader(engine);
+    for (PlaylistTrack* track : engine.tracks) freeTrack(track);
+    engine.tracks.clear();
+    engine.current = nullptr;
+    engine.fading = false;
+    engine.next.store(nullptr);
+    engine.playing.store(nullptr);
+    engine.loaderDone.store(false);
+    engine.finished.store(false);
+    engine.stop = false;
+}
+
+// The first track is opened here, as Mix_LoadMUS did; the loader takes over
+// from the one after it. Unplayable files are skipped only when stepping
+// through the list.
+static void playFrom(int index, bool skipUnplayable) {
+    PlaylistEngine& engine = g_playlist;
+    resetPlaylist(engine);
+    PlaylistTrack* track = nullptr;
+    do {
+        track = loadTrack(engine, index++);
+    } while (!track && skipUnplayable && index < (int)engine.paths.size());
+    engine.loadIndex = index;
+    if (!track) {
+        engine.finished.store(true);
+        return;
+    }
+    engine.tracks.push_back(track);
+    engine.next.store(track);
+    engine.loaderThread = std::thread(playlistLoaderMain, &engine);
+    Mix_HookMusic(playlistMix, &engine);
+    g_playlistHooked = true;
+}
+
+bool startPlaylist(const std::vector<std::wstring>& paths, int startIndex, int crossfadeMs) {
+    AudioOutputInfo output = getAudioOutputInfo();
+    if (output.frequency <= 0 || output.format != AUDIO_S16SYS) {
+        logError("Playlist: No S16 audio output available.");
+        return false;
+    }
+    resetPlaylist(g_playlist);
+    g_playlist.paths = paths;
+    g_playlist.frameBytes = output.channels * (int)sizeof(Sint16);
+    g_playlist.crossfadeBytes = (Uint32)((int64_t)crossfadeMs * output.frequency / 1000) * g_playlist.frameBytes;
+    g_playlist.fadeFrom.assign(FADE_SCRATCH_BYTES - FADE_SCRATCH_BYTES % g_playlist.frameBytes, 0);
+    g_playlist.fadeTo.assign(g_playlist.fadeFrom.size(), 0);
+    g_playlist.transitions.store(0);
+    playFrom(startIndex, false);
+    if (!g_playlistHooked) {
+        logError("Playlist: Could not play track %d of %zu.", startIndex + 1, paths.size());
+        return false;
+    }
+    logError("Playlist: %zu tracks, starting at %d, crossfade %d ms.", paths.size(), startIndex + 1, crossfadeMs);
+    return true;
+}
+
+void stopPlaylist() {
+    if (!g_playlist.paths.empty()) {
+        logError("Playlist: Stopped after %d track changes.", g_playlist.transitions.load());
+    }
+    resetPlaylist(g_playlist);
+    g_playlist.paths.clear();
+}
+
+// Closes the tracks the hook has moved past and lets the loader open the next
+void updatePlaylist() {
+    PlaylistEngine& engine = g_playlist;
+    if (!g_playlistHooked) return;
+    PlaylistTrack* playing = engine.playing.load(std::memory_order_acquire);
+    if (!playing) return;
+    std::vector<PlaylistTrack*> passed;
+    {
+        std::lock_guard<std::mutex> lock(engine.mutex);
+        while (!engine.tracks.empty() && engine.tracks.front() != playing) {
+            passed.push_back(engine.tracks.front());
+            engine.tracks.pop_front();
+        }
+    }
+    for (PlaylistTrack* track : passed) freeTrack(track);
+    engine.wake.notify_all();
+}
+
+void skipPlaylistTrack(int delta) {
+    PlaylistEngine& engine = g_playlist;
+    if (engine.paths.empty()) return;
+    PlaylistTrack* playing = engine.playing.load();
+    int index = playing ? playing->index + delta : 0;
+    index = std::max(0, std::min(index, (int)engine.paths.size() - 1));
+    playFrom(index, delta >= 0);
+}
+
+// Within the playing track; the demuxer seeks and the hook plays silence
+// until the first audio from the new position is in the ring
+void seekPlaylist(double deltaSeconds) {
+    PlaylistTrack* playing = g_playlist.playing.load();
+    if (!g_playlistHooked || !playing || !playing->stream) return;
+    seekVideo(*playing->stream, getAudioStreamPosition(*playing->stream) + deltaSeconds, true);
+}
+
+PlaylistStatus getPlaylistStatus() {
+    PlaylistStatus status;
+    PlaylistTrack* playing = g_playlist.playing.load();
+    status.active = g_playlistHooked;
+    status.count = (int)g_playlist.paths.size();
+    status.finished = g_playlist.finished.load();
+    if (playing) {
+        status.index = playing->index;
+        status.path = g_playlist.paths[playing->index];
+        if (playing->stream) {
+            status.position = std::max(playing->stream->startTime, getAudioStreamPosition(*playing->stream) - getAudioOutputLatency());
+            status.duration = playing->stream->duration;
+        }
+        status.underruns = playing->ring->underruns.load();
+    }
+    return status;
+}
+
+// Sample-level check of the hook: synthetic tracks of odd lengths carry one
+// continuous ramp, and the mixed output has to reproduce it exactly, with no
+// sample missing, repeated or zero-filled at any track boundary. Then the
+// same tracks with a crossfade must come out exactly one fade shorter per
+// boundary (the fade is short enough that every track outlasts a callback
+// after the previous fade, so the next one is always queued in time). Each
+// track sits whole in its ring, already drained, so this exercises the hook
+// alone; runs without the audio device.
+bool runGaplessPlaylistTest() {
+    const int channels = 2;
+    const Uint32 trackFrames[] = { 44100 * 3 / 7, 1237, 22050 + 1, 48000 };
+    const int trackCount = sizeof(trackFrames) / sizeof(trackFrames[0]);
+    const int callbackBytes[] = { 4096, 1764, 8 };
+    const Uint32 fadeFrames = 64;
+    bool passed = true;
+
+    std::vector<std::vector<Sint16>> samples(trackCount);
+    Uint32 totalFrames = 0;
+    for (int t = 0; t < trackCount; t++) {
+        samples[t].resize(trackFrames[t] * channels);
+        for (Uint32 f = 0; f < trackFrames[t]; f++) {
+            Sint16 value = (Sint16)((totalFrames + f) % 30000 + 1);   // Never 0, so silence shows
+            samples[t][f * channels] = value;
+            samples[t][f * channels + 1] = (Sint16)-value;
+        }
+        totalFrames += trackFrames[t];
+    }
+
+    for (int crossfade = 0; crossfade <= 1; crossfade++) {
+        for (int len : callbackBytes) {
+            PlaylistEngine engine;
+            engine.frameBytes = channels * (int)sizeof(Sint16);
+            engine.crossfadeBytes = crossfade ? fadeFrames * engine.frameBytes : 0;
+            engine.fadeFrom.assign(FADE_SCRATCH_BYTES, 0);
+            engine.fadeTo.assign(FADE_SCRATCH_BYTES, 0);
+            std::atomic<bool> drained{ true };
+            std::unique_ptr<AudioRing[]> rings(new AudioRing[trackCount]);
+            std::vector<PlaylistTrack> tracks(trackCount);
+            for (int t = 0; t < trackCount; t++) {
+                Uint32 bytes = trackFrames[t] * engine.frameBytes;
+                rings[t].allocate(bytes);
+                rings[t].write(reinterpret_cast<const uint8_t*>(samples[t].data()), bytes);
+                tracks[t].ring = &rings[t];
+                tracks[t].finished = &drained;
+                tracks[t].index = t;
+            }
+
+            // Act as the loader: hand over the next track as soon as the slot frees
+            std::vector<Sint16> output;
+            std::vector<Uint8> buffer(len);
+            int queued = 0;
+            while (!engine.finished.load()) {
+                if (queued < trackCount && engine.next.load() == nullptr) engine.next.store(&tracks[queued++]);
+                if (queued == trackCount) engine.loaderDone.store(true);
+                memset(buffer.data(), 0, len);
+                playlistMix(&engine, buffer.data(), len);
+                const Sint16* mixed = reinterpret_cast<const Sint16*>(buffer.data());
+                output.insert(output.end(), mixed, mixed + len / sizeof(Sint16));
+                if (output.size() > (size_t)totalFrames * channels * 2) break;
+            }
+            for (int t = 0; t < trackCount; t++) rings[t].release();
+
+            // Trim the silent tail of the last callback
+            while (!output.empty() && output.back() == 0) output.pop_back();
+            Uint32 expectedFrames = totalFrames - (crossfade ? (trackCount - 1) * fadeFrames : 0);
+            Uint32 gotFrames = (Uint32)(output.size() / channels);
+            if (gotFrames != expectedFrames) {
+                logError("Playlist test: crossfade %d, %d-byte callbacks: %u frames out, expected %u.",
+                    crossfade, len, gotFrames, expectedFrames);
+                passed = false;
+                continue;
+            }
+            if (crossfade) continue;
+            for (Uint32 f = 0; f < gotFrames; f++) {
+                Sint16 expected = (Sint16)(f % 30000 + 1);
+                if (output[f * channels] != expected || output[f * channels + 1] != -expected) {
+                    logError("Playlist test: %d-byte callbacks: sample frame %u is %d, expected %d.",
+                        len, f, output[f * channels], expected);
+                    passed = false;
+                    break;
+                }
+            }
+        }
+    }
+    logError("Playlist test: %s (%d tracks, %u frames, %d callback sizes, with and without crossfade).",
+        passed ? "PASSED, no gaps" : "FAILED", trackCount, totalFrames, (int)(sizeof(callbackBytes) / sizeof(callbackBytes[0])));
+    return passed;
+}
@@ -0,0 +1,407 @@
+#define NOMINMAX
+#include "Header.h"
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <stdlib.h>
+
+// 2D command batcher and glyph atlas text renderer.
+// Points, lines, rectangles and text are not drawn immediately. Each command is
+// merged into the latest batch with the same kind and color, as long as no
+// batch queued after that one overlaps it, so painter's order is preserved.
+// presentFrame() flushes every batch with one SDL call.
+//
+// Glyphs are rasterized once (white, blended) into a single atlas texture and
+// tinted through vertex colors, so all text shares one geometry batch.
+
+#define ATLAS_SIZE 1024
+#define ATLAS_PADDING 1
+#define MAX_CACHED_RUNS 2048
+
+struct GlyphInfo {
+    SDL_Rect src = { 0, 0, 0, 0 };  // Location in the atlas
+    int offsetX = 0;                // Horizontal offset of the bitmap from the pen position
+    int advance = 0;
+    bool valid = false;
+};
+
+struct GlyphQuad {
+    SDL_FRect dst;   // Relative to the run origin
+    SDL_FPoint uv0;
+    SDL_FPoint uv1;
+};
+
+enum BatchKind {
+    BATCH_POINTS,
+    BATCH_FILL_RECTS,
+    BATCH_OUTLINE_RECTS,
+    BATCH_TEXT
+};
+
+struct DrawBatch {
+    BatchKind kind = BATCH_POINTS;
+    SDL_Color color = { 0, 0, 0, 0 };  // Unused for BATCH_TEXT (vertex colors)
+    SDL_Rect bounds = { 0, 0, 0, 0 };
+    std::vector<SDL_Point> points;
+    std::vector<SDL_Rect> rects;
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+};
+
+struct TextRun {
+    std::vector<GlyphQuad> quads;
+    int width = 0;
+    uint32_t atlasGeneration = 0;
+    uint32_t lastUsedFrame = 0;
+};
+
+static SDL_Renderer* g_textRenderer = nullptr;
+static TTF_Font* g_textFont = nullptr;
+static SDL_Texture* g_atlasTexture = nullptr;
+static int g_atlasPenX = 0;
+static int g_atlasPenY = 0;
+static int g_atlasRowHeight = 0;
+static uint32_t g_atlasGeneration = 1;
+static int g_fontHeight = 0;
+
+static std::unordered_map<Uint16, GlyphInfo> g_glyphs;
+static std::unordered_map<std::wstring, TextRun> g_runCache;
+
+// Batches are recycled between frames to keep their vector capacity
+static std::vector<DrawBatch> g_batches;
+static size_t g_batchCount = 0;
+
+static uint32_t g_frameNumber = 0;
+static RenderStats g_currentStats;
+static RenderStats g_lastFrameStats;
+
+static void resetAtlas() {
+    g_glyphs.clear();
+    g_runCache.clear();
+    g_atlasPenX = 0;
+    g_atlasPenY = 0;
+    g_atlasRowHeight = 0;
+    g_atlasGeneration++;
+    logError("Text: Glyph atlas reset (generation %u).", g_atlasGeneration);
+}
+
+// Rasterize a glyph and copy it into the next free shelf slot of the atlas
+static const GlyphInfo& cacheGlyph(Uint16 ch) {
+    auto it = g_glyphs.find(ch);
+    if (it != g_glyphs.end()) return it->second;
+
+    GlyphInfo info;
+    int minx = 0, maxx = 0, miny = 0, maxy = 0, advance = 0;
+    if (TTF_GlyphMetrics(g_textFont, ch, &minx, &maxx, &miny, &maxy, &advance) != 0) {
+        // Missing glyph: keep an empty entry so we don't retry every frame
+        return g_glyphs.emplace(ch, info).first->second;
+    }
+    info.advance = advance;
+    info.offsetX = minx < 0 ? minx : 0;
+
+    SDL_Color white = { 255, 255, 255, 255 };
+    SDL_Surface* glyph = TTF_RenderGlyph_Blended(g_textFont, ch, white);
+    if (!glyph) {
+        // Whitespace renders to nothing; it still advances the pen
+        return g_glyphs.emplace(ch, info).first->second;
+    }
+
+    SDL_Surface* converted = SDL_ConvertSurfaceFormat(glyph, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(glyph);
+    if (!converted) {
+        logError("Text: SDL_ConvertSurfaceFormat failed for glyph %u: %s", (unsigned)ch, SDL_GetError());
+        return g_glyphs.emplace(ch, info).first->second;
+    }
+
+    if (converted->w + ATLAS_PADDING > ATLAS_SIZE || converted->h + ATLAS_PADDING > ATLAS_SIZE) {
+        logError("Text: Glyph %u too large for atlas (%dx%d).", (unsigned)ch, converted->w, converted->h);
+        SDL_FreeSurface(converted);
+        return g_glyphs.emplace(ch, info).first->second;
+    }
+
+    if (g_atlasPenX + converted->w + ATLAS_PADDING > ATLAS_SIZE) {
+        g_atlasPenX = 0;
+        g_atlasPenY += g_atlasRowHeight + ATLAS_PADDING;
+        g_atlasRowHeight = 0;
+    }
+    if (g_atlasPenY + converted->h + ATLAS_PADDING > ATLAS_SIZE) {
+        // Atlas full: start over. Runs referencing the old layout are invalidated
+        // through the generation counter. Text already queued this frame points
+        // at the old glyphs, so it is drawn before they are overwritten.
+        if (g_batchCount > 0) flushRenderBatches(g_textRenderer);
+        resetAtlas();
+    }
+
+    info.src = { g_atlasPenX, g_atlasPenY, converted->w, converted->h };
+    if (SDL_UpdateTexture(g_atlasTexture, &info.src, converted->pixels, converted->pitch) != 0) {
+        logError("Text: SDL_UpdateTexture failed for glyph %u: %s", (unsigned)ch, SDL_GetError());
+    }
+    else {
+        info.valid = true;
+        g_currentStats.glyphsRasterized++;
+    }
+    g_atlasPenX += converted->w + ATLAS_PADDING;
+    if (converted->h > g_atlasRowHeight) g_atlasRowHeight = converted->h;
+    SDL_FreeSurface(converted);
+
+    return g_glyphs.emplace(ch, info).first->second;
+}
+
+// Shape a string into atlas quads relative to (0, 0). Returns false if the atlas
+// was reset while rasterizing, in which case the earlier quads are stale.
+static bool layoutRun(const std::wstring& text, TextRun& run) {
+    uint32_t generation = g_atlasGeneration;
+    run.quads.clear();
+    run.quads.reserve(text.size());
+    int penX = 0;
+    Uint16 prev = 0;
+    for (wchar_t wc : text) {
+        Uint16 ch = (Uint16)wc;
+        if (prev) penX += TTF_GetFontKerningSizeGlyphs(g_textFont, prev, ch);
+        const GlyphInfo& glyph = cacheGlyph(ch);
+        if (glyph.valid) {
+            GlyphQuad quad;
+            quad.dst = { (float)(penX + glyph.offsetX), 0.0f, (float)glyph.src.w, (float)glyph.src.h };
+            quad.uv0 = { (float)glyph.src.x / ATLAS_SIZE, (float)glyph.src.y / ATLAS_SIZE };
+            quad.uv1 = { (float)(glyph.src.x + glyph.src.w) / ATLAS_SIZE, (float)(glyph.src.y + glyph.src.h) / ATLAS_SIZE };
+            run.quads.push_back(quad);
+        }
+        penX += glyph.advance;
+        prev = ch;
+    }
+    run.width = penX;
+    run.atlasGeneration = g_atlasGeneration;
+    return generation == g_atlasGeneration;
+}
+
+static TextRun* findRun(const std::wstring& text) {
+    auto it = g_runCache.find(text);
+    if (it != g_runCache.end() && it->second.atlasGeneration == g_atlasGeneration) {
+        g_currentStats.runCacheHits++;
+        it->second.lastUsedFrame = g_frameNumber;
+        return &it->second;
+    }
+
+    g_currentStats.runCacheMisses++;
+    if (g_runCache.size() >= MAX_CACHED_RUNS) {
+        // Drop runs that were not drawn in the previous frame
+        for (auto iter = g_runCache.begin(); iter != g_runCache.end();) {
+            if (iter->second.lastUsedFrame + 1 < g_frameNumber) iter = g_runCache.erase(iter);
+            else ++iter;
+        }
+    }
+
+    // Lay out into a local first: an atlas reset clears g_runCache
+    TextRun run;
+    if (!layoutRun(text, run)) layoutRun(text, run);
+    run.lastUsedFrame = g_frameNumber;
+    TextRun& cached = g_runCache[text];
+    cached = std::move(run);
+    return &cached;
+}
+
+bool initTextRenderer(SDL_Renderer* renderer, TTF_Font* font) {
+    shutdownTextRenderer();
+    if (!renderer || !font) {
+        logError("Text: initTextRenderer called with null renderer or font.");
+        return false;
+    }
+
+    g_atlasTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, ATLAS_SIZE, ATLAS_SIZE);
+    if (!g_atlasTexture) {
+        logError("Text: Failed to create glyph atlas texture: %s", SDL_GetError());
+        return false;
+    }
+    SDL_SetTextureBlendMode(g_atlasTexture, SDL_BLENDMODE_BLEND);
+
+    // Start from a transparent atlas
+    std::vector<Uint32> clear(ATLAS_SIZE * ATLAS_SIZE, 0);
+    SDL_UpdateTexture(g_atlasTexture, nullptr, clear.data(), ATLAS_SIZE * sizeof(Uint32));
+
+    g_textRenderer = renderer;
+    g_textFont = font;
+    g_fontHeight = TTF_FontHeight(font);
+    resetAtlas();
+
+    // Pre-rasterize printable ASCII and Latin-1 so the common case never misses
+    for (Uint16 ch = 32; ch < 256; ch++) {
+        if (ch >= 127 && ch < 160) continue;
+        cacheGlyph(ch);
+    }
+    logError("Text: Glyph atlas initialized (%dx%d, %zu glyphs, line height %d).", ATLAS_SIZE, ATLAS_SIZE, g_glyphs.size(), g_fontHeight);
+    return true;
+}
+
+void shutdownTextRenderer() {
+    if (g_atlasTexture) {
+        SDL_DestroyTexture(g_atlasTexture);
+        g_atlasTexture = nullptr;
+    }
+    g_glyphs.clear();
+    g_runCache.clear();
+    g_batches.clear();
+    g_batchCount = 0;
+    g_textRenderer = nullptr;
+    g_textFont = nullptr;
+}
+
+static bool sameColor(SDL_Color a, SDL_Color b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static void unionBounds(SDL_Rect& bounds, const SDL_Rect& add) {
+    int x0 = std::min(bounds.x, add.x);
+    int y0 = std::min(bounds.y, add.y);
+    int x1 = std::max(bounds.x + bounds.w, add.x + add.w);
+    int y1 = std::max(bounds.y + bounds.h, add.y + add.h);
+    bounds = { x0, y0, x1 - x0, y1 - y0 };
+}
+
+// Find the batch a new command can join without changing what ends up on screen
+static DrawBatch& batchFor(BatchKind kind, SDL_Color color, const SDL_Rect& bounds) {
+    for (size_t i = g_batchCount; i > 0; i--) {
+        DrawBatch& batch = g_batches[i - 1];
+        if (batch.kind == kind && (kind == BATCH_TEXT || sameColor(batch.color, color))) {
+            unionBounds(batch.bounds, bounds);
+            return batch;
+        }
+        if (SDL_HasIntersection(&batch.bounds, &bounds)) break;
+    }
+
+    if (g_batchCount == g_batches.size()) g_batches.emplace_back();
+    DrawBatch& batch = g_batches[g_batchCount++];
+    batch.kind = kind;
+    batch.color = color;
+    batch.bounds = bounds;
+    batch.points.clear();
+    batch.rects.clear();
+    batch.vertices.clear();
+    batch.indices.clear();
+    return batch;
+}
+
+void queuePoint(int x, int y, SDL_Color color) {
+    SDL_Rect bounds = { x, y, 1, 1 };
+    batchFor(BATCH_POINTS, color, bounds).points.push_back({ x, y });
+}
+
+// Bresenham, rasterized straight into a point batch
+void queueLine(int x1, int y1, int x2, int y2, SDL_Color color) {
+    SDL_Rect bounds = { std::min(x1, x2), std::min(y1, y2), abs(x2 - x1) + 1, abs(y2 - y1) + 1 };
+    std::vector<SDL_Point>& points = batchFor(BATCH_POINTS, color, bounds).points;
+
+    int dx = abs(x2 - x1), dy = abs(y2 - y1);
+    int sx = x1 < x2 ? 1 : -1;
+    int sy = y1 < y2 ? 1 : -1;
+    int err = dx - dy;
+    while (true) {
+        points.push_back({ x1, y1 });
+        if (x1 == x2 && y1 == y2) break;
+        int e2 = 2 * err;
+        if (e2 > -dy) { err -= dy; x1 += sx; }
+        if (e2 < dx) { err += dx; y1 += sy; }
+    }
+}
+
+void queueRect(const SDL_Rect& rect, SDL_Color color, bool filled) {
+    if (rect.w <= 0 || rect.h <= 0) return;
+    batchFor(filled ? BATCH_FILL_RECTS : BATCH_OUTLINE_RECTS, color, rect).rects.push_back(rect);
+}
+
+void queueText(int x, int y, const std::wstring& text, SDL_Color color) {
+    if (text.empty() || !g_atlasTexture) return;
+
+    TextRun* run = findRun(text);
+    if (!run || run->quads.empty()) return;
+
+    SDL_Rect bounds = { x, y, std::max(run->width, 1), std::max(g_fontHeight, 1) };
+    DrawBatch& batch = batchFor(BATCH_TEXT, color, bounds);
+    for (const GlyphQuad& quad : run->quads) {
+        int base = (int)batch.vertices.size();
+        float x0 = x + quad.dst.x;
+        float y0 = y + quad.dst.y;
+        float x1 = x0 + quad.dst.w;
+        float y1 = y0 + quad.dst.h;
+        batch.vertices.push_back({ { x0, y0 }, color, { quad.uv0.x, quad.uv0.y } });
+        batch.vertices.push_back({ { x1, y0 }, color, { quad.uv1.x, quad.uv0.y } });
+        batch.vertices.push_back({ { x1, y1 }, color, { quad.uv1.x, quad.uv1.y } });
+        batch.vertices.push_back({ { x0, y1 }, color, { quad.uv0.x, quad.uv1.y } });
+        batch.indices.push_back(base);
+        batch.indices.push_back(base + 1);
+        batch.indices.push_back(base + 2);
+        batch.indices.push_back(base);
+        batch.indices.push_back(base + 2);
+        batch.indices.push_back(base + 3);
+    }
+}
+
+void queueText(int x, int y, const char* text, SDL_Color color) {
+    if (!text || !*text) return;
+    // Text() callers pass Latin-1 strings; widen byte by byte
+    std::wstring wide;
+    for (const unsigned char* p = (const unsigned char*)text; *p; ++p) {
+        wide.push_back((wchar_t)*p);
+    }
+    queueText(x, y, wide, color);
+}
+
+int measureText(const std::wstring& text) {
+    if (text.empty() || !g_atlasTexture) return 0;
+    TextRun* run = findRun(text);
+    return run ? run->width : 0;
+}
+
+void flushRenderBatches(SDL_Renderer* renderer) {
+    for (size_t i = 0; i < g_batchCount; i++) {
+        DrawBatch& batch = g_batches[i];
+        int ret = 0;
+        switch (batch.kind) {
+        case BATCH_POINTS:
+            if (batch.points.empty()) continue;
+            SDL_SetRenderDrawColor(renderer, batch.color.r, batch.color.g, batch.color.b, batch.color.a);
+            ret = SDL_RenderDrawPoints(renderer, batch.points.data(), (int)batch.points.size());
+            g_currentStats.primitives += (int)batch.points.size();
+            break;
+        case BATCH_FILL_RECTS:
+            if (batch.rects.empty()) continue;
+            SDL_SetRenderDrawColor(renderer, batch.color.r, batch.color.g, batch.color.b, batch.color.a);
+            ret = SDL_RenderFillRects(renderer, batch.rects.data(), (int)batch.rects.size());
+            g_currentStats.primitives += (int)batch.rects.size();
+            break;
+        case BATCH_OUTLINE_RECTS:
+            if (batch.rects.empty()) continue;
+            SDL_SetRenderDrawColor(renderer, batch.color.r, batch.color.g, batch.color.b, batch.color.a);
+            ret = SDL_RenderDrawRects(renderer, batch.rects.data(), (int)batch.rects.size());
+            g_currentStats.primitives += (int)batch.rects.size();
+            break;
+        case BATCH_TEXT:
+            if (batch.indices.empty() || !g_atlasTexture) continue;
+            ret = SDL_RenderGeometry(renderer, g_atlasTexture,
+                batch.vertices.data(), (int)batch.vertices.size(),
+                batch.indices.data(), (int)batch.indices.size());
+            g_currentStats.textQuads += (int)(batch.indices.size() / 6);
+            break;
+        }
+        if (ret != 0) {
+            logError("Render: batch flush failed (kind %d): %s", (int)batch.kind, SDL_GetError());
+        }
+        g_currentStats.drawCalls++;
+    }
+    g_batchCount = 0;
+}
+
+void presentFrame(SDL_Renderer* renderer) {
+    flushRenderBatches(renderer);
+    SDL_RenderPresent(renderer);
+
+    g_lastFrameStats = g_currentStats;
+    g_currentStats = RenderStats();
+    g_frameNumber++;
+}
+
+const RenderStats& getRenderStats() {
+    return g_lastFrameStats;
+}
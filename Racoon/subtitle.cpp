@@ -0,0 +1,332 @@
+#define NOMINMAX
+#include "Header.h"
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+#include <algorithm>
+#include <string.h>
+
+// Subtitles for the video player.
+// Packets of the selected subtitle stream are decoded on the demux thread as
+// they are read, which is well ahead of playback, into subtitleEvents: text
+// (ASS markup stripped) or palette bitmaps already expanded to ARGB, each
+// with its start and end on the stream clock. The render thread draws the
+// events active at the master clock. Every event becomes a texture the first
+// time it shows and that texture is reused until the event ends, so a frame
+// with unchanged subtitles costs a lookup and a copy; TTF only runs when the
+// text changes (or the video is resized).
+
+static const size_t MAX_SUBTITLE_EVENTS = 256;     // Decoded ahead; older ones are dropped past this
+// Event ids key the texture cache, so they are never reused, not even by the
+// next file or after a track switch
+static std::atomic<uint64_t> g_subtitleEventIds{ 0 };
+
+// Decoding (demux thread)
+
+bool openSubtitleDecoder(VideoContext& videoCtx, int streamIndex) {
+    AVStream* stream = videoCtx.formatContext->streams[streamIndex];
+    const AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec) {
+        logError("Subtitles: No decoder for %s (stream %d).", avcodec_get_name(stream->codecpar->codec_id), streamIndex);
+        return false;
+    }
+    AVCodecContext* codecContext = avcodec_alloc_context3(codec);
+    if (!codecContext || avcodec_parameters_to_context(codecContext, stream->codecpar) < 0) {
+        logError("Subtitles: Could not set up the %s decoder.", codec->name);
+        avcodec_free_context(&codecContext);
+        return false;
+    }
+    codecContext->pkt_timebase = stream->time_base;   // For AVSubtitle::pts
+    if (avcodec_open2(codecContext, codec, nullptr) < 0) {
+        logError("Subtitles: Could not open the %s decoder.", codec->name);
+        avcodec_free_context(&codecContext);
+        return false;
+    }
+
+    videoCtx.subtitleCodecContext = codecContext;
+    videoCtx.subtitleStreamIndex = streamIndex;
+    const AVCodecDescriptor* descriptor = avcodec_descriptor_get(codec->id);
+    AVDictionaryEntry* language = av_dict_get(stream->metadata, "language", nullptr, 0);
+    logError("Subtitles: Stream %d, %s (%s), language %s.", streamIndex, codec->name,
+        descriptor && (descriptor->props & AV_CODEC_PROP_BITMAP_SUB) ? "bitmap" : "text", language ? language->value : "unknown");
+    return true;
+}
+
+void closeSubtitleDecoder(VideoContext& videoCtx) {
+    if (videoCtx.subtitleCodecContext) {
+        logError("Subtitles: %llu events decoded.", (unsigned long long)videoCtx.subtitleEventCount);
+    }
+    avcodec_free_context(&videoCtx.subtitleCodecContext);
+    videoCtx.subtitleStreamIndex = -1;
+    std::lock_guard<std::mutex> lock(videoCtx.subtitleMutex);
+    videoCtx.subtitleEvents.clear();
+    videoCtx.subtitleEventCount = 0;
+}
+
+// Dialogue lines come as "ReadOrder,Layer,Style,Name,MarginL,MarginR,MarginV,Effect,Text";
+// keep the text, drop {override} blocks and turn \N and \h into a newline and a space
+static std::string assToPlainText(const char* ass) {
+    const char* text = ass;
+    for (int field = 0; field < 8; field++) {
+        const char* comma = strchr(text, ',');
+        if (!comma) {
+            text = ass;   // Not a dialogue line; show it as is
+            break;
+        }
+        text = comma + 1;
+    }
+
+    std::string plain;
+    bool inOverride = false;
+    for (const char* p = text; *p; p++) {
+        if (inOverride) {
+            if (*p == '}') inOverride = false;
+        }
+        else if (*p == '{') {
+            inOverride = true;
+        }
+        else if (*p == '\\' && (p[1] == 'N' || p[1] == 'n')) {
+            plain += '\n';
+            p++;
+        }
+        else if (*p == '\\' && p[1] == 'h') {
+            plain += ' ';
+            p++;
+        }
+        else if (*p != '\r') {
+            plain += *p;
+        }
+    }
+    while (!plain.empty() && (plain.back() == '\n' || plain.back() == ' ')) plain.pop_back();
+    return plain;
+}
+
+void decodeSubtitlePacket(VideoContext& videoCtx, AVPacket* packet) {
+    AVCodecContext* codecContext = videoCtx.subtitleCodecContext;
+    AVSubtitle subtitle;
+    int gotSubtitle = 0;
+    if (avcodec_decode_subtitle2(codecContext, &subtitle, &gotSubtitle, packet) < 0 || !gotSubtitle) {
+        return;
+    }
+
+    AVRational timeBase = videoCtx.formatContext->streams[videoCtx.subtitleStreamIndex]->time_base;
+    double base = 0.0;
+    if (subtitle.pts != AV_NOPTS_VALUE) base = (double)subtitle.pts / AV_TIME_BASE;
+    else if (packet->pts != AV_NOPTS_VALUE) base = packet->pts * av_q2d(timeBase);
+
+    SubtitleEvent event;
+    event.start = base + subtitle.start_display_time / 1000.0;
+    if (subtitle.end_display_time > subtitle.start_display_time && subtitle.end_display_time != UINT32_MAX) {
+        event.end = base + subtitle.end_display_time / 1000.0;
+    }
+    else if (packet->duration > 0) {
+        event.end = event.start + packet->duration * av_q2d(timeBase);
+    }
+    // Bitmap coordinates are in the subtitle's own canvas, usually the video size
+    event.canvasWidth = codecContext->width > 0 ? codecContext->width : (videoCtx.videoCodecContext ? videoCtx.videoCodecContext->width : 0);
+    event.canvasHeight = codecContext->height > 0 ? codecContext->height : (videoCtx.videoCodecContext ? videoCtx.videoCodecContext->height : 0);
+
+    for (unsigned i = 0; i < subtitle.num_rects; i++) {
+        const AVSubtitleRect* rect = subtitle.rects[i];
+        if (rect->type == SUBTITLE_BITMAP && rect->w > 0 && rect->h > 0 && rect->data[0] && rect->data[1]) {
+            SubtitleBitmap bitmap;
+            bitmap.area = { rect->x, rect->y, rect->w, rect->h };
+            bitmap.pixels.resize((size_t)rect->w * rect->h);
+            const uint32_t* palette = reinterpret_cast<const uint32_t*>(rect->data[1]);   // AARRGGBB
+            for (int y = 0; y < rect->h; y++) {
+                const uint8_t* row = rect->data[0] + (size_t)y * rect->linesize[0];
+                uint32_t* out = bitmap.pixels.data() + (size_t)y * rect->w;
+                for (int x = 0; x < rect->w; x++) out[x] = row[x] < rect->nb_colors ? palette[row[x]] : 0;
+            }
+            event.bitmaps.push_back(std::move(bitmap));
+        }
+        else if (rect->type == SUBTITLE_ASS && rect->ass) {
+            std::string line = assToPlainText(rect->ass);
+            if (!line.empty()) event.text += (event.text.empty() ? "" : "\n") + line;
+        }
+        else if (rect->type == SUBTITLE_TEXT && rect->text) {
+            event.text += (event.text.empty() ? "" : "\n") + std::string(rect->text);
+        }
+    }
+    avsubtitle_free(&subtitle);
+
+    std::lock_guard<std::mutex> lock(videoCtx.subtitleMutex);
+    std::deque<SubtitleEvent>& events = videoCtx.subtitleEvents;
+    // Events without an end last until the next one; an empty event (bitmap
+    // formats clear the screen this way) only does that
+    for (SubtitleEvent& earlier : events) {
+        if (earlier.end < 0.0 && earlier.start <= event.start) earlier.end = event.start;
+    }
+    if (event.text.empty() && event.bitmaps.empty()) return;
+
+    event.id = ++g_subtitleEventIds;
+    videoCtx.subtitleEventCount++;
+    auto position = std::upper_bound(events.begin(), events.end(), event.start,
+        [](double start, const SubtitleEvent& other) { return start < other.start; });
+    events.insert(position, std::move(event));
+    if (events.size() > MAX_SUBTITLE_EVENTS) events.pop_front();
+}
+
+// After a seek: whatever was decoded ahead is from the old position
+void flushSubtitles(VideoContext& videoCtx) {
+    if (videoCtx.subtitleCodecContext) avcodec_flush_buffers(videoCtx.subtitleCodecContext);
+    std::lock_guard<std::mutex> lock(videoCtx.subtitleMutex);
+    videoCtx.subtitleEvents.clear();
+}
+
+// Rendering (render thread)
+
+struct SubtitleTexture {
+    uint64_t id = 0;                     // SubtitleEvent::id
+    int part = -1;                       // Index into the event's bitmaps; -1 for its text
+    SDL_Texture* texture = nullptr;
+    int width = 0;                       // Output pixels
+    int height = 0;
+    bool shown = false;                  // Drawn this frame
+};
+
+static std::vector<SubtitleTexture> g_subtitleTextures;
+static TTF_Font* g_subtitleFont = nullptr;
+static int g_subtitleFontSize = 0;       // Size g_subtitleFont was opened at (or failed to)
+static uint64_t g_subtitleTexturesBuilt = 0;
+
+static void releaseSubtitleTextures() {
+    for (SubtitleTexture& cached : g_subtitleTextures) SDL_DestroyTexture(cached.texture);
+    g_subtitleTextures.clear();
+}
+
+// Text is rasterized at its size in output pixels, so it follows the window
+static bool ensureSubtitleFont(int size) {
+    if (size == g_subtitleFontSize) return g_subtitleFont != nullptr;
+    releaseSubtitleTextures();
+    if (g_subtitleFont) TTF_CloseFont(g_subtitleFont);
+    g_subtitleFontSize = size;
+    g_subtitleFont = TTF_OpenFont("arial.ttf", size);
+    if (!g_subtitleFont) g_subtitleFont = TTF_OpenFont("C:\\Windows\\Fonts\\arial.ttf", size);
+    if (!g_subtitleFont) {
+        logError("Subtitles: Could not open a font at size %d: %s", size, TTF_GetError());
+        return false;
+    }
+    TTF_SetFontWrappedAlign(g_subtitleFont, TTF_WRAPPED_ALIGN_CENTER);
+    return true;
+}
+
+// White text with a black border: the black rendering is stamped around the
+// white one within a small radius, so both share one layout
+static SDL_Texture* rasterizeSubtitleText(SDL_Renderer* renderer, const std::string& text, int wrapWidth, int* width, int* height) {
+    SDL_Color white = { 255, 255, 255, 255 };
+    SDL_Color black = { 0, 0, 0, 255 };
+    SDL_Surface* fill = TTF_RenderUTF8_Blended_Wrapped(g_subtitleFont, text.c_str(), white, wrapWidth);
+    SDL_Surface* border = TTF_RenderUTF8_Blended_Wrapped(g_subtitleFont, text.c_str(), black, wrapWidth);
+    SDL_Texture* texture = nullptr;
+    if (fill && border) {
+        int radius = std::max(1, g_subtitleFontSize / 14);
+        SDL_Surface* canvas = SDL_CreateRGBSurfaceWithFormat(0, fill->w + 2 * radius, fill->h + 2 * radius, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (canvas) {
+            SDL_SetSurfaceBlendMode(fill, SDL_BLENDMODE_BLEND);
+            SDL_SetSurfaceBlendMode(border, SDL_BLENDMODE_BLEND);
+            for (int dy = -radius; dy <= radius; dy++) {
+                for (int dx = -radius; dx <= radius; dx++) {
+                    if (dx * dx + dy * dy > radius * radius) continue;
+                    SDL_Rect at = { radius + dx, radius + dy, border->w, border->h };
+                    SDL_BlitSurface(border, nullptr, canvas, &at);
+                }
+            }
+            SDL_Rect at = { radius, radius, fill->w, fill->h };
+            SDL_BlitSurface(fill, nullptr, canvas, &at);
+            texture = SDL_CreateTextureFromSurface(renderer, canvas);
+            *width = canvas->w;
+            *height = canvas->h;
+            SDL_FreeSurface(canvas);
+        }
+    }
+    SDL_FreeSurface(fill);
+    SDL_FreeSurface(border);
+    return texture;
+}
+
+static SubtitleTexture* findSubtitleTexture(SDL_Renderer* renderer, const SubtitleEvent& event, int part, int wrapWidth) {
+    for (SubtitleTexture& cached : g_subtitleTextures) {
+        if (cached.id == event.id && cached.part == part) return &cached;
+    }
+
+    SubtitleTexture cached;
+    cached.id = event.id;
+    cached.part = part;
+    if (part < 0) {
+        cached.texture = rasterizeSubtitleText(renderer, event.text, wrapWidth, &cached.width, &cached.height);
+    }
+    else {
+        const SubtitleBitmap& bitmap = event.bitmaps[part];
+        cached.texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, bitmap.area.w, bitmap.area.h);
+        if (cached.texture) SDL_UpdateTexture(cached.texture, nullptr, bitmap.pixels.data(), bitmap.area.w * (int)sizeof(uint32_t));
+        cached.width = bitmap.area.w;
+        cached.height = bitmap.area.h;
+    }
+    if (!cached.texture) return nullptr;
+    SDL_SetTextureBlendMode(cached.texture, SDL_BLENDMODE_BLEND);
+    g_subtitleTexturesBuilt++;
+    g_subtitleTextures.push_back(cached);
+    return &g_subtitleTextures.back();
+}
+
+void drawVideoSubtitles(SDL_Renderer* renderer, VideoContext& videoCtx, const SDL_Rect& videoRect, double clock) {
+    float scaleX = 1.0f, scaleY = 1.0f;
+    SDL_RenderGetScale(renderer, &scaleX, &scaleY);
+    bool haveFont = ensureSubtitleFont(std::max(12, (int)(videoRect.h * scaleY / 18.0f)));
+    for (SubtitleTexture& cached : g_subtitleTextures) cached.shown = false;
+
+    {
+        std::lock_guard<std::mutex> lock(videoCtx.subtitleMutex);
+        std::deque<SubtitleEvent>& events = videoCtx.subtitleEvents;
+        events.erase(std::remove_if(events.begin(), events.end(),
+            [clock](const SubtitleEvent& event) { return event.end >= 0.0 && event.end <= clock; }), events.end());
+
+        // Text lines stack upwards from just above the bottom of the video
+        int textBottom = videoRect.y + videoRect.h - videoRect.h / 20;
+        for (const SubtitleEvent& event : events) {
+            if (event.start > clock) break;
+            for (int part = 0; part < (int)event.bitmaps.size(); part++) {
+                SubtitleTexture* cached = event.canvasWidth > 0 && event.canvasHeight > 0 ? findSubtitleTexture(renderer, event, part, 0) : nullptr;
+                if (!cached) continue;
+                const SDL_Rect& area = event.bitmaps[part].area;
+                SDL_Rect dst = {
+                    videoRect.x + area.x * videoRect.w / event.canvasWidth,
+                    videoRect.y + area.y * videoRect.h / event.canvasHeight,
+                    area.w * videoRect.w / event.canvasWidth,
+                    area.h * videoRect.h / event.canvasHeight };
+                SDL_RenderCopy(renderer, cached->texture, nullptr, &dst);
+                cached->shown = true;
+            }
+            if (!event.text.empty() && haveFont) {
+                SubtitleTexture* cached = findSubtitleTexture(renderer, event, -1, (int)(videoRect.w * scaleX * 0.9f));
+                if (!cached) continue;
+                int w = (int)(cached->width / scaleX);
+                int h = (int)(cached->height / scaleY);
+                SDL_Rect dst = { videoRect.x + (videoRect.w - w) / 2, textBottom - h, w, h };
+                SDL_RenderCopy(renderer, cached->texture, nullptr, &dst);
+                textBottom = dst.y;
+                cached->shown = true;
+            }
+        }
+    }
+
+    // Events that stopped showing (ended, flushed by a seek) let go of their textures
+    for (size_t i = 0; i < g_subtitleTextures.size();) {
+        if (g_subtitleTextures[i].shown) {
+            i++;
+            continue;
+        }
+        SDL_DestroyTexture(g_subtitleTextures[i].texture);
+        g_subtitleTextures.erase(g_subtitleTextures.begin() + i);
+    }
+}
+
+void shutdownSubtitleRenderer() {
+    if (g_subtitleTexturesBuilt > 0) {
+        logError("Subtitles: %llu textures built.", (unsigned long long)g_subtitleTexturesBuilt);
+    }
+    releaseSubtitleTextures();
+    if (g_subtitleFont) TTF_CloseFont(g_subtitleFont);
+    g_subtitleFont = nullptr;
+    g_subtitleFontSize = 0;
+}
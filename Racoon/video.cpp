@@ -1,7 +1,10 @@
+#define NOMINMAX
 #include "Header.h"
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_audio.h>
 #include <algorithm>
+#include <cmath>
+#include <memory>
 #include <string>
 
 #ifdef min
@@ -12,665 +15,2830 @@ extern "C" {
 #include <libswresample/swresample.h>
 #include <libavutil/channel_layout.h>
 #include <libavutil/error.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersrc.h>
+#include <libavfilter/buffersink.h>
 }
 
-bool initializeFFmpeg() {
-    logError("FFmpeg initialized.");
+// Fast-start probe limits (bytes, microseconds)
+static const int FAST_PROBE_SIZE = 1024 * 1024;
+static const int FAST_ANALYZE_DURATION = 500000;
+
+// Playback speed range, and the display rate frames are thinned to above 1x
+static const double MIN_PLAYBACK_SPEED = 0.5;
+static const double MAX_PLAYBACK_SPEED = 4.0;
+static const double SPEED_DISPLAY_HZ = 60.0;
+
+// Read-ahead for the keyframe index's own reader; it only reads forward
+static const size_t KEYFRAME_INDEX_CACHE_BYTES = 1024 * 1024;
+
+PacketQueue::~PacketQueue() {
+    flush();
+    for (AVPacket* shell : spare) {
+        av_packet_free(&shell);
+    }
+}
+
+// Packet shells are recycled through `spare` and queued in a fixed ring, so
+// once the queue has been as deep as it gets, put() and get() allocate nothing.
+bool PacketQueue::put(AVPacket* packet) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this] { return aborted || !fullLocked(); });
+    if (aborted) {
+        return false;
+    }
+    AVPacket* queued;
+    if (!spare.empty()) {
+        queued = spare.back();
+        spare.pop_back();
+    }
+    else {
+        queued = av_packet_alloc();
+        if (!queued) {
+            logError("FFmpeg: PacketQueue failed to allocate packet.");
+            return false;
+        }
+        counters.shellAllocations++;
+    }
+    av_packet_move_ref(queued, packet);
+    packets[(head + count) % packets.size()] = { queued, currentSerial.load() };
+    count++;
+    bytes += queued->size;
+    counters.packetsIn++;
+    if (count > counters.maxDepth) counters.maxDepth = count;
+    if (bytes > counters.maxBytesQueued) counters.maxBytesQueued = bytes;
+    notEmpty.notify_one();
     return true;
 }
 
-bool openVideoFile(const char* filePath, VideoContext& videoCtx) {
-    // 1. Initialize AVFormatContext
-    if (avformat_open_input(&videoCtx.formatContext, filePath, nullptr, nullptr) != 0) {
-        logError("FFmpeg: ERROR could not open video file %s", filePath);
+int PacketQueue::get(AVPacket* packet, bool block, int* serial) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (block) {
+        notEmpty.wait(lock, [this] { return aborted || eof || count > 0; });
+    }
+    if (aborted) return AVERROR_EXIT;
+    if (serial) *serial = currentSerial.load();
+    if (count == 0) {
+        if (eof) return AVERROR_EOF;
+        counters.underruns++;
+        return 0;
+    }
+    AVPacket* front = packets[head].packet;
+    if (serial) *serial = packets[head].serial;
+    head = (head + 1) % packets.size();
+    count--;
+    bytes -= front->size;
+    counters.packetsOut++;
+    av_packet_move_ref(packet, front);
+    spare.push_back(front);
+    notFull.notify_one();
+    return 1;
+}
+
+void PacketQueue::setEof() {
+    std::lock_guard<std::mutex> lock(mutex);
+    eof = true;
+    notEmpty.notify_all();
+}
+
+void PacketQueue::flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = 0; i < count; i++) {
+        AVPacket* queued = packets[(head + i) % packets.size()].packet;
+        av_packet_unref(queued);
+        spare.push_back(queued);
+    }
+    counters.packetsFlushed += count;
+    count = 0;
+    bytes = 0;
+    eof = false;
+    currentSerial++;
+    notFull.notify_all();
+}
+
+void PacketQueue::abort() {
+    std::lock_guard<std::mutex> lock(mutex);
+    aborted = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+}
+
+void PacketQueue::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    aborted = false;
+    eof = false;
+    counters = PacketQueueStats();
+}
+
+PacketQueueStats PacketQueue::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    PacketQueueStats result = counters;
+    result.depth = count;
+    result.bytes = bytes;
+    return result;
+}
+
+bool AudioRing::allocate(uint32_t minBytes) {
+    release();
+    uint32_t size = 4096;
+    while (size < minBytes) size <<= 1;
+    data = static_cast<uint8_t*>(av_malloc(size));
+    if (!data) return false;
+    capacity = size;
+    return true;
+}
+
+void AudioRing::release() {
+    av_freep(&data);
+    capacity = 0;
+    writeIndex.store(0);
+    readIndex.store(0);
+    discardIndex.store(0);
+    baseIndex.store(0);
+    basePts.store(0.0);
+    serial.store(-1);
+    primed.store(false);
+    underruns.store(0);
+    minFill.store(UINT32_MAX);
+}
+
+// Free space is measured against readIndex only, so bytes the consumer may
+// still be copying are never overwritten, even if they were discarded.
+uint32_t AudioRing::write(const uint8_t* src, uint32_t len) {
+    uint64_t write = writeIndex.load(std::memory_order_relaxed);
+    uint64_t read = readIndex.load(std::memory_order_acquire);
+    uint32_t space = capacity - (uint32_t)(write - read);
+    if (len > space) len = space;
+    uint32_t offset = (uint32_t)(write & (capacity - 1));
+    uint32_t first = std::min(len, capacity - offset);
+    memcpy(data + offset, src, first);
+    memcpy(data, src + first, len - first);
+    writeIndex.store(write + len, std::memory_order_release);
+    return len;
+}
+
+uint32_t AudioRing::read(uint8_t* dst, uint32_t len) {
+    uint64_t read = readIndex.load(std::memory_order_relaxed);
+    uint64_t skip = discardIndex.load(std::memory_order_acquire);
+    if (read < skip) read = skip;
+    uint64_t write = writeIndex.load(std::memory_order_acquire);
+    uint32_t available = (uint32_t)(write - read);
+    if (len > available) len = available;
+    uint32_t offset = (uint32_t)(read & (capacity - 1));
+    uint32_t first = std::min(len, capacity - offset);
+    memcpy(dst, data + offset, first);
+    memcpy(dst + first, data, len - first);
+    readIndex.store(read + len, std::memory_order_release);
+    return len;
+}
+
+void AudioRing::discard() {
+    discardIndex.store(writeIndex.load(std::memory_order_relaxed), std::memory_order_release);
+}
+
+// Greatest indexed keyframe at or before timestamp. Fails if the index does
+// not cover timestamp yet (still scanning) or is empty.
+static bool findKeyframeBefore(VideoContext* videoCtx, int64_t timestamp, int64_t* keyframe) {
+    std::lock_guard<std::mutex> lock(videoCtx->keyframeMutex);
+    const std::vector<int64_t>& keyframes = videoCtx->keyframes;
+    if (keyframes.empty() || (!videoCtx->keyframeIndexComplete && timestamp > keyframes.back())) {
+        return false;
+    }
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), timestamp);
+    if (next == keyframes.begin()) {
         return false;
     }
+    *keyframe = *(next - 1);
+    return true;
+}
 
-    // 2. Find stream information
-    if (avformat_find_stream_info(videoCtx.formatContext, nullptr) < 0) {
-        logError("FFmpeg: ERROR could not find stream info for %s", filePath);
-        closeVideoFile(videoCtx);
+// Runs on the demux thread, the only thread touching formatContext.
+// Lands on the keyframe before the target; accurate seeks then decode
+// forward to it, discarding the frames in between.
+static void performSeek(VideoContext* videoCtx) {
+    double target = videoCtx->seekTarget.load();
+    bool accurate = videoCtx->seekAccurate.load();
+    // Audio-only streams seek on the audio stream (every packet is a keyframe)
+    int streamIndex = videoCtx->videoStreamIndex >= 0 ? videoCtx->videoStreamIndex : videoCtx->audioStreamIndex.load();
+    AVStream* seekStream = videoCtx->formatContext->streams[streamIndex];
+    int64_t timestamp = (int64_t)llround(target / av_q2d(seekStream->time_base));
+
+    int64_t keyframe = 0;
+    bool indexed = findKeyframeBefore(videoCtx, timestamp, &keyframe);
+    int ret = av_seek_frame(videoCtx->formatContext, streamIndex, indexed ? keyframe : timestamp, AVSEEK_FLAG_BACKWARD);
+    if (ret < 0) {
+        int64_t globalTimestamp = (int64_t)(target * AV_TIME_BASE);
+        ret = avformat_seek_file(videoCtx->formatContext, -1, INT64_MIN, globalTimestamp, globalTimestamp, 0);
+    }
+    if (ret < 0) {
+        char errBuf[AV_ERROR_MAX_STRING_SIZE];
+        av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
+        logError("FFmpeg: Seek to %.3f s failed: %s", target, errBuf);
+    }
+    else {
+        logError("FFmpeg: Seek to %.3f s (%s) via %s.", target, accurate ? "accurate" : "keyframe",
+            indexed ? "keyframe index" : "demuxer seek");
+    }
+
+    videoCtx->accurateSeekPts.store(accurate ? target : -1.0);
+    videoCtx->audioResumePts.store(-1.0);
+    // Anything queued while the seek was in flight predates it
+    videoCtx->videoQueue.flush();
+    videoCtx->audioQueue.flush();
+    flushSubtitles(*videoCtx);
+}
+
+static AVCodecContext* openAudioDecoder(AVStream* stream, const char* source);
+
+// Runs on the demux thread. Swaps the discard flags over to the requested
+// audio and/or subtitle stream and, unless a seek is about to re-read
+// everything anyway, goes back to the keyframe before the switch position:
+// the new stream has been skipped so far and is read again from there. The
+// audio decoder for the new stream is opened here and adopted by the audio
+// thread on the new serial; the subtitle decoder simply changes hands.
+// Returns true if the demuxer went back.
+static bool performTrackSwitch(VideoContext* videoCtx, bool reread) {
+    AVFormatContext* formatContext = videoCtx->formatContext;
+    int audio = videoCtx->requestedAudioTrack.exchange(-1);
+    int subtitle = videoCtx->requestedSubtitleTrack.exchange(-1);
+    double clock = videoCtx->trackSwitchClock.load();
+    bool switched = false;
+
+    int previousAudio = videoCtx->audioStreamIndex.load();
+    if (audio >= 0 && audio != previousAudio && audio < (int)formatContext->nb_streams) {
+        AVCodecContext* decoder = openAudioDecoder(formatContext->streams[audio], "the selected audio track");
+        if (decoder) {
+            if (previousAudio >= 0) formatContext->streams[previousAudio]->discard = AVDISCARD_ALL;
+            formatContext->streams[audio]->discard = AVDISCARD_DEFAULT;
+            videoCtx->audioStreamIndex.store(audio);
+            videoCtx->audioResumePts.store(clock);
+            AVCodecContext* unused = videoCtx->switchedAudioDecoder.exchange(decoder);
+            avcodec_free_context(&unused);   // An earlier switch the audio thread never got to
+            videoCtx->audioQueue.flush();
+            switched = true;
+            logError("FFmpeg: Audio track %d -> %d at %.3f s.", previousAudio, audio, clock);
+        }
+    }
+
+    // -1 is posted as -2 (subtitles off), since -1 means no request
+    int previousSubtitle = videoCtx->subtitleStreamIndex.load();
+    if (subtitle != -1) {
+        subtitle = subtitle == -2 ? -1 : subtitle;
+        if (subtitle != previousSubtitle && subtitle < (int)formatContext->nb_streams) {
+            if (previousSubtitle >= 0) formatContext->streams[previousSubtitle]->discard = AVDISCARD_ALL;
+            closeSubtitleDecoder(*videoCtx);
+            if (subtitle >= 0) {
+                formatContext->streams[subtitle]->discard = AVDISCARD_DEFAULT;
+                if (!openSubtitleDecoder(*videoCtx, subtitle)) formatContext->streams[subtitle]->discard = AVDISCARD_ALL;
+            }
+            switched = subtitle >= 0 || switched;
+            logError("FFmpeg: Subtitle track %d -> %d at %.3f s.", previousSubtitle, videoCtx->subtitleStreamIndex.load(), clock);
+        }
+    }
+
+    if (!switched || !reread) return false;
+    int64_t timestamp = (int64_t)llround(clock * AV_TIME_BASE);
+    int ret = avformat_seek_file(formatContext, -1, INT64_MIN, timestamp, timestamp, 0);
+    if (ret < 0) {
+        char errBuf[AV_ERROR_MAX_STRING_SIZE];
+        av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
+        logError("FFmpeg: Re-reading from %.3f s for the new track failed: %s", clock, errBuf);
         return false;
     }
+    return true;
+}
 
-    // 3. Find Video and Audio Streams
-    videoCtx.videoStreamIndex = -1;
-    videoCtx.audioStreamIndex = -1;
-    for (unsigned int i = 0; i < videoCtx.formatContext->nb_streams; i++) {
-        AVCodecParameters* pCodecParams = videoCtx.formatContext->streams[i]->codecpar;
-        if (pCodecParams->codec_type == AVMEDIA_TYPE_VIDEO) {
-            if (videoCtx.videoStreamIndex == -1) videoCtx.videoStreamIndex = i;
+// The only caller of av_read_frame: routes packets to the per-stream queues.
+// Blocks in put() while the destination queue is full. Stays alive at end of
+// file so a later seek can resume reading.
+static void demuxThreadMain(VideoContext* videoCtx) {
+    AVPacket* packet = av_packet_alloc();
+    if (!packet) {
+        logError("FFmpeg: Demuxer failed to allocate packet.");
+        videoCtx->videoQueue.setEof();
+        videoCtx->audioQueue.setEof();
+        return;
+    }
+
+    // After a track switch the demuxer goes back and reads again; streams that
+    // were already playing skip what they have queued, up to the last dts
+    std::vector<int64_t> lastDts(videoCtx->formatContext->nb_streams, AV_NOPTS_VALUE);
+    std::vector<char> rereading(lastDts.size(), 0);
+
+    bool atEof = false;
+    while (!videoCtx->demuxStop.load()) {
+        int seekRequest = videoCtx->seekRequests.load();
+        bool seeking = seekRequest != videoCtx->seeksCompleted.load();
+        if (videoCtx->requestedAudioTrack.load() != -1 || videoCtx->requestedSubtitleTrack.load() != -1) {
+            int audioBefore = videoCtx->audioStreamIndex.load();
+            int subtitleBefore = videoCtx->subtitleStreamIndex.load();
+            bool reread = performTrackSwitch(videoCtx, !seeking);
+            int audioAfter = videoCtx->audioStreamIndex.load();
+            int subtitleAfter = videoCtx->subtitleStreamIndex.load();
+            for (size_t i = 0; i < lastDts.size(); i++) {
+                bool added = ((int)i == audioAfter && audioAfter != audioBefore) || ((int)i == subtitleAfter && subtitleAfter != subtitleBefore);
+                if (added) lastDts[i] = AV_NOPTS_VALUE;
+                rereading[i] = reread && lastDts[i] != AV_NOPTS_VALUE;
+            }
+            if (reread) atEof = false;
+            else if (atEof && !seeking) videoCtx->audioQueue.setEof();   // The switch flushed it; nothing more to read
+        }
+        if (seeking) {
+            // Requests that arrived meanwhile are picked up on the next pass
+            performSeek(videoCtx);
+            videoCtx->seeksCompleted.store(seekRequest);
+            std::fill(rereading.begin(), rereading.end(), 0);
+            atEof = false;
+        }
+        if (atEof) {
+            SDL_Delay(10);
+            continue;
+        }
+
+        int ret = av_read_frame(videoCtx->formatContext, packet);
+        if (ret < 0) {
+            if (ret != AVERROR_EOF) {
+                char errBuf[AV_ERROR_MAX_STRING_SIZE];
+                av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
+                logError("FFmpeg: Demuxer av_read_frame error: %s. Treating as end of file.", errBuf);
+            }
+            else {
+                logError("FFmpeg: Demuxer reached end of file.");
+            }
+            videoCtx->videoQueue.setEof();
+            videoCtx->audioQueue.setEof();
+            atEof = true;
+            continue;
         }
-        else if (pCodecParams->codec_type == AVMEDIA_TYPE_AUDIO) {
-            if (videoCtx.audioStreamIndex == -1) videoCtx.audioStreamIndex = i;
+
+        size_t index = (size_t)packet->stream_index;
+        if (index < lastDts.size()) {
+            if (rereading[index]) {
+                if (packet->dts == AV_NOPTS_VALUE || packet->dts <= lastDts[index]) {
+                    av_packet_unref(packet);
+                    continue;   // Queued before the track switch
+                }
+                rereading[index] = 0;
+            }
+            if (packet->dts != AV_NOPTS_VALUE) lastDts[index] = packet->dts;
         }
 
-        const AVCodec* pVideoCodec = avcodec_find_decoder_by_name("hevc_dxva2"); // Use DXVA2 for HEVC
-        if (!pVideoCodec) {
-            pVideoCodec = avcodec_find_decoder(pCodecParams->codec_id); // Use pCodecParams instead of pVideoCodecParams
+        if (packet->stream_index == videoCtx->videoStreamIndex) {
+            videoCtx->videoQueue.put(packet);
+        }
+        else if (packet->stream_index == videoCtx->audioStreamIndex && videoCtx->audioEnabled) {
+            // Audio before an accurate seek target (or a track switch) is never played; don't let it fill the queue
+            double seekPts = std::max(videoCtx->accurateSeekPts.load(), videoCtx->audioResumePts.load());
+            AVRational timeBase = videoCtx->formatContext->streams[packet->stream_index]->time_base;
+            if (seekPts < 0.0 || packet->pts == AV_NOPTS_VALUE || (packet->pts + packet->duration) * av_q2d(timeBase) >= seekPts) {
+                videoCtx->audioQueue.put(packet);
+            }
+        }
+        else if (packet->stream_index == videoCtx->subtitleStreamIndex && videoCtx->subtitleCodecContext) {
+            decodeSubtitlePacket(*videoCtx, packet);
         }
+        av_packet_unref(packet);
     }
 
-    if (videoCtx.videoStreamIndex == -1) {
-        logError("FFmpeg: ERROR video stream not found for %s", filePath);
-        closeVideoFile(videoCtx);
-        return false;
+    av_packet_free(&packet);
+}
+
+static void videoDecodeThreadMain(VideoContext* videoCtx);
+static void videoConvertThreadMain(VideoContext* videoCtx);
+static void audioDecodeThreadMain(VideoContext* videoCtx);
+static void resetAudioTempo(VideoContext& videoCtx);
+
+static int keyframeIndexInterrupt(void* opaque) {
+    return static_cast<VideoContext*>(opaque)->keyframeStop.load() ? 1 : 0;
+}
+
+// Builds videoCtx->keyframes on its own demuxer instance at low priority,
+// reading through a second MediaReader with a small cache so the scan does
+// not share the playback reader's window. Containers with a seek index (MP4
+// stss, Matroska cues) already list their keyframes; anything else is
+// scanned packet by packet without decoding, but only for local files. A
+// remote file would be read end to end over the network, so it keeps an
+// empty index and seeks by timestamp.
+static void keyframeIndexThreadMain(VideoContext* videoCtx, std::string path, int streamIndex) {
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    MediaReader reader;
+    MediaReaderOptions readerOptions;
+    readerOptions.cacheBytes = KEYFRAME_INDEX_CACHE_BYTES;
+    AVFormatContext* formatContext = avformat_alloc_context();
+    if (!formatContext) return;
+    formatContext->interrupt_callback.callback = keyframeIndexInterrupt;
+    formatContext->interrupt_callback.opaque = videoCtx;
+    if (reader.open(path.c_str(), readerOptions)) {
+        formatContext->pb = reader.avio();
+        formatContext->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+    if (avformat_open_input(&formatContext, path.c_str(), nullptr, nullptr) != 0) {
+        logError("FFmpeg: Keyframe index could not open %s", path.c_str());
+        return;
+    }
+    if (streamIndex >= (int)formatContext->nb_streams && avformat_find_stream_info(formatContext, nullptr) < 0) {
+        avformat_close_input(&formatContext);
+        return;
+    }
+    if (streamIndex >= (int)formatContext->nb_streams) {
+        avformat_close_input(&formatContext);
+        return;
     }
 
-    // 4. Initialize Video Codec
+    AVStream* stream = formatContext->streams[streamIndex];
+    bool fromContainer = false;
+    int entries = avformat_index_get_entries_count(stream);
+    if (entries > 1) {
+        std::vector<int64_t> found;
+        for (int i = 0; i < entries; i++) {
+            const AVIndexEntry* entry = avformat_index_get_entry(stream, i);
+            if (entry && (entry->flags & AVINDEX_KEYFRAME)) found.push_back(entry->timestamp);
+        }
+        std::sort(found.begin(), found.end());
+        std::lock_guard<std::mutex> lock(videoCtx->keyframeMutex);
+        videoCtx->keyframes.swap(found);
+        fromContainer = true;
+    }
+    else if (reader.avio() && !reader.isLocal()) {
+        avformat_close_input(&formatContext);
+        logError("FFmpeg: No keyframe index in %s; remote file, not scanned. Seeks go by timestamp.", path.c_str());
+        return;
+    }
+    else {
+        for (unsigned int i = 0; i < formatContext->nb_streams; i++) {
+            if ((int)i != streamIndex) formatContext->streams[i]->discard = AVDISCARD_ALL;
+        }
+        AVPacket* packet = av_packet_alloc();
+        while (packet && !videoCtx->keyframeStop.load() && av_read_frame(formatContext, packet) >= 0) {
+            if (packet->stream_index == streamIndex && (packet->flags & AV_PKT_FLAG_KEY)) {
+                int64_t timestamp = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+                if (timestamp != AV_NOPTS_VALUE) {
+                    std::lock_guard<std::mutex> lock(videoCtx->keyframeMutex);
+                    std::vector<int64_t>& keyframes = videoCtx->keyframes;
+                    keyframes.insert(std::upper_bound(keyframes.begin(), keyframes.end(), timestamp), timestamp);
+                }
+            }
+            av_packet_unref(packet);
+        }
+        av_packet_free(&packet);
+    }
+    avformat_close_input(&formatContext);
+
+    if (videoCtx->keyframeStop.load()) return;
+    std::lock_guard<std::mutex> lock(videoCtx->keyframeMutex);
+    videoCtx->keyframeIndexComplete = true;
+    double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    logError("FFmpeg: Keyframe index: %zu keyframes from %s in %.1f ms.", videoCtx->keyframes.size(),
+        fromContainer ? "container index" : "packet scan", ms);
+}
+
+static int streamInfoInterrupt(void* opaque) {
+    return static_cast<VideoContext*>(opaque)->streamInfoStop.load() ? 1 : 0;
+}
+
+// Full stream analysis for a fast-start open, on its own demuxer at low
+// priority with FFmpeg's default probe limits. Only the results the render
+// thread can apply later (start time, duration) are published.
+static void streamInfoThreadMain(VideoContext* videoCtx, std::string path) {
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    Uint64 start = SDL_GetPerformanceCounter();
+    AVFormatContext* formatContext = avformat_alloc_context();
+    if (!formatContext) return;
+    formatContext->interrupt_callback.callback = streamInfoInterrupt;
+    formatContext->interrupt_callback.opaque = videoCtx;
+    if (avformat_open_input(&formatContext, path.c_str(), nullptr, nullptr) != 0) {
+        return;   // Freed by avformat_open_input
+    }
+    if (avformat_find_stream_info(formatContext, nullptr) >= 0 && !videoCtx->streamInfoStop.load()) {
+        if (formatContext->start_time != AV_NOPTS_VALUE) {
+            videoCtx->analyzedStartTime.store((double)formatContext->start_time / AV_TIME_BASE);
+        }
+        if (formatContext->duration != AV_NOPTS_VALUE) {
+            videoCtx->analyzedDuration.store((double)formatContext->duration / AV_TIME_BASE);
+        }
+        videoCtx->streamInfoReady.store(true);
+        logError("FFmpeg: Background stream analysis finished in %.1f ms (duration %.3f s).",
+            (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency(),
+            videoCtx->analyzedDuration.load());
+    }
+    avformat_close_input(&formatContext);
+}
+
+static void stopVideoThreads(VideoContext& videoCtx) {
+    videoCtx.demuxStop.store(true);
+    videoCtx.decodeStop.store(true);
+    videoCtx.keyframeStop.store(true);
+    videoCtx.streamInfoStop.store(true);
+    videoCtx.audioStop.store(true);
+    videoCtx.videoQueue.abort();
+    videoCtx.audioQueue.abort();
+    if (videoCtx.demuxThread.joinable()) {
+        videoCtx.demuxThread.join();
+    }
+    if (videoCtx.decodeThread.joinable()) {
+        videoCtx.decodeThread.join();
+    }
+    if (videoCtx.convertThread.joinable()) {
+        videoCtx.convertThread.join();
+    }
+    if (videoCtx.keyframeThread.joinable()) {
+        videoCtx.keyframeThread.join();
+    }
+    if (videoCtx.streamInfoThread.joinable()) {
+        videoCtx.streamInfoThread.join();
+    }
+    if (videoCtx.audioThread.joinable()) {
+        videoCtx.audioThread.join();
+    }
+    videoCtx.videoQueue.flush();
+    videoCtx.audioQueue.flush();
+}
+
+static int convertThreadCount(const VideoDecoderOptions& options) {
+    if (options.convertThreads > 0) return options.convertThreads;
+    int threads = SDL_GetCPUCount();
+    return threads > 8 ? 8 : threads;   // Bands get too short to pay for the handoff beyond this
+}
+
+static void logDecodeStatistics(VideoContext& videoCtx) {
+    if (videoCtx.seekCount > 0) {
+        size_t keyframeCount;
+        {
+            std::lock_guard<std::mutex> lock(videoCtx.keyframeMutex);
+            keyframeCount = videoCtx.keyframes.size();
+        }
+        logError("FFmpeg: %d seeks: latency avg %.1f ms, max %.1f ms; %.1f frames decoded forward per accurate seek; %zu keyframes indexed (avg GOP %.2f s).",
+            videoCtx.seekCount, videoCtx.seekLatencyTotalMs / videoCtx.seekCount, videoCtx.seekLatencyMaxMs,
+            (double)videoCtx.seekDecodedTotal / videoCtx.seekCount, keyframeCount,
+            keyframeCount > 0 ? videoCtx.duration / keyframeCount : 0.0);
+    }
+    if (videoCtx.presentedFrames == 0 && !videoCtx.audioOnly) return;
+    int decoded = videoCtx.decodedFrameCount.load();
+    double decodeSeconds = (double)videoCtx.decodeTicks.load() / (double)SDL_GetPerformanceFrequency();
+    if (decoded > 0 && decodeSeconds > 0.0) {
+        logError("FFmpeg: Decoded %d frames in %.3f s of decoder time: %.1f fps with %d threads.",
+            decoded, decodeSeconds, decoded / decodeSeconds,
+            videoCtx.videoCodecContext ? videoCtx.videoCodecContext->thread_count : 0);
+        double convertMs = (double)videoCtx.convertTicks.load() * 1000.0 / (double)SDL_GetPerformanceFrequency();
+        double uploadMs = (double)videoCtx.uploadTicks * 1000.0 / (double)SDL_GetPerformanceFrequency();
+        int converted = videoCtx.convertedFrameCount.load();
+        logError("FFmpeg: Per-frame CPU: convert %.3f ms (%s, %d threads, %dx%d -> %dx%d), texture upload %.3f ms.",
+            converted > 0 ? convertMs / converted : 0.0, videoCtx.decoderOptions.yuvTextures ? "YUV planes" : "swscale RGBA",
+            convertThreadCount(videoCtx.decoderOptions),
+            videoCtx.videoCodecContext ? videoCtx.videoCodecContext->width : 0,
+            videoCtx.videoCodecContext ? videoCtx.videoCodecContext->height : 0,
+            videoCtx.targetWidth.load(), videoCtx.targetHeight.load(),
+            videoCtx.uploadedFrames > 0 ? uploadMs / videoCtx.uploadedFrames : 0.0);
+    }
+    if (videoCtx.audioRing.capacity > 0) {
+        int bytesPerSecond = videoCtx.obtainedAudioSpec.freq * videoCtx.obtainedAudioSpec.channels * 2;
+        uint32_t minFill = videoCtx.audioRing.minFill.load();
+        logError("FFmpeg: Audio ring %u KB (%.0f ms): %llu underruns, lowest fill %.0f ms.",
+            videoCtx.audioRing.capacity / 1024, bytesPerSecond > 0 ? videoCtx.audioRing.capacity * 1000.0 / bytesPerSecond : 0.0,
+            (unsigned long long)videoCtx.audioRing.underruns.load(),
+            bytesPerSecond > 0 && minFill != UINT32_MAX ? minFill * 1000.0 / bytesPerSecond : 0.0);
+    }
+    MediaReaderStats io = videoCtx.reader.stats();
+    if (io.cacheBytes > 0) {
+        logError("FFmpeg: Read-ahead: %llu KB read, %llu stalls (%.1f ms), %llu restarts.",
+            (unsigned long long)(io.bytesRead / 1024), (unsigned long long)io.stalls, io.stallMs, (unsigned long long)io.restarts);
+    }
+    PacketQueueStats vq = videoCtx.videoQueue.stats();
+    PacketQueueStats aq = videoCtx.audioQueue.stats();
+    logError("FFmpeg: Packet shells allocated: video %llu (max depth %d), audio %llu (max depth %d); conversion and audio buffers allocated: %llu.",
+        (unsigned long long)vq.shellAllocations, vq.maxDepth, (unsigned long long)aq.shellAllocations, aq.maxDepth,
+        (unsigned long long)videoCtx.bufferAllocations.load());
+    if (videoCtx.audioOnly) return;
+    logError("FFmpeg: Decode time histogram (ms) <1:%d <2:%d <4:%d <8:%d <16:%d <33:%d <66:%d >=66:%d",
+        videoCtx.decodeTimeHistogram[0].load(), videoCtx.decodeTimeHistogram[1].load(),
+        videoCtx.decodeTimeHistogram[2].load(), videoCtx.decodeTimeHistogram[3].load(),
+        videoCtx.decodeTimeHistogram[4].load(), videoCtx.decodeTimeHistogram[5].load(),
+        videoCtx.decodeTimeHistogram[6].load(), videoCtx.decodeTimeHistogram[7].load());
+    std::string occupancy;
+    for (int i = 0; i <= VIDEO_FRAME_RING_SIZE; i++) {
+        occupancy += " " + std::to_string(i) + ":" + std::to_string(videoCtx.ringOccupancyHistogram[i]);
+    }
+    logError("FFmpeg: Frame ring occupancy histogram%s. Presented %d, dropped %d, repeated %d, thinned for speed %d.",
+        occupancy.c_str(), videoCtx.presentedFrames, videoCtx.droppedFrames.load(), videoCtx.repeatedFrames,
+        videoCtx.thinnedFrames.load());
+}
+
+bool initializeFFmpeg() {
+    logError("FFmpeg initialized.");
+    return true;
+}
+
+// SDL texture format that can take this pixel format's planes unconverted
+static Uint32 yuvTextureFormatFor(int pixelFormat) {
+    switch (pixelFormat) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        return SDL_PIXELFORMAT_IYUV;
+    case AV_PIX_FMT_NV12:
+        return SDL_PIXELFORMAT_NV12;
+    case AV_PIX_FMT_NV21:
+        return SDL_PIXELFORMAT_NV21;
+    default:
+        return SDL_PIXELFORMAT_UNKNOWN;
+    }
+}
+
+// Pick the decoder requested in options if it handles codecId, else FFmpeg's default
+static const AVCodec* findVideoDecoder(const VideoDecoderOptions& options, AVCodecID codecId) {
+    if (!options.decoderName.empty()) {
+        const AVCodec* named = avcodec_find_decoder_by_name(options.decoderName.c_str());
+        if (named && named->id == codecId) {
+            return named;
+        }
+        logError("FFmpeg: Requested decoder '%s' %s; using the default decoder for %s.",
+            options.decoderName.c_str(), named ? "does not handle this codec" : "not found", avcodec_get_name(codecId));
+    }
+    return avcodec_find_decoder(codecId);
+}
+
+// Fast start trusts the container headers when they already describe every
+// stream well enough to open its decoder
+static bool streamHeadersSufficient(const AVFormatContext* formatContext) {
+    bool haveVideo = false;
+    for (unsigned int i = 0; i < formatContext->nb_streams; i++) {
+        const AVCodecParameters* params = formatContext->streams[i]->codecpar;
+        if (params->codec_type == AVMEDIA_TYPE_VIDEO) {
+            if (params->codec_id == AV_CODEC_ID_NONE || params->width <= 0 || params->height <= 0) return false;
+            haveVideo = true;
+        }
+        else if (params->codec_type == AVMEDIA_TYPE_AUDIO) {
+            if (params->codec_id == AV_CODEC_ID_NONE || params->sample_rate <= 0 || params->ch_layout.nb_channels <= 0) return false;
+        }
+    }
+    return haveVideo;
+}
+
+static SDL_YUV_CONVERSION_MODE yuvConversionModeFor(const AVFrame* frame) {
+    if (frame->color_range == AVCOL_RANGE_JPEG || frame->format == AV_PIX_FMT_YUVJ420P) {
+        return SDL_YUV_CONVERSION_JPEG;
+    }
+    if (frame->colorspace == AVCOL_SPC_BT709 || (frame->colorspace == AVCOL_SPC_UNSPECIFIED && frame->height > 576)) {
+        return SDL_YUV_CONVERSION_BT709;
+    }
+    return SDL_YUV_CONVERSION_BT601;
+}
+
+// Frame and slice threading sized to the core count. Low-delay preview mode
+// drops frame threading, which buffers one frame per thread.
+static void applyDecoderThreading(const VideoDecoderOptions& options, AVCodecContext* codecContext) {
+    int threads = options.threadCount;
+    if (threads <= 0) {
+        threads = SDL_GetCPUCount();
+        if (threads > 16) threads = 16; // Beyond this, frame threading mostly adds latency and memory
+    }
+    codecContext->thread_count = threads;
+    codecContext->thread_type = 0;
+    if (options.frameThreads && !options.lowDelay) codecContext->thread_type |= FF_THREAD_FRAME;
+    if (options.sliceThreads) codecContext->thread_type |= FF_THREAD_SLICE;
+    if (options.lowDelay) {
+        codecContext->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        codecContext->flags2 |= AV_CODEC_FLAG2_FAST;
+    }
+}
+
+// Step 4 of openVideoFile; the caller closes the file on failure
+static bool openVideoDecoder(VideoContext& videoCtx, const char* filePath) {
     AVCodecParameters* pVideoCodecParams = videoCtx.formatContext->streams[videoCtx.videoStreamIndex]->codecpar;
-    const AVCodec* pVideoCodec = avcodec_find_decoder(pVideoCodecParams->codec_id);
+    const AVCodec* pVideoCodec = findVideoDecoder(videoCtx.decoderOptions, pVideoCodecParams->codec_id);
     if (!pVideoCodec) {
         logError("FFmpeg: ERROR video codec not found for %s", filePath);
-        closeVideoFile(videoCtx);
         return false;
     }
     videoCtx.videoCodecContext = avcodec_alloc_context3(pVideoCodec);
     if (!videoCtx.videoCodecContext) {
         logError("FFmpeg: ERROR could not allocate video codec context for %s", filePath);
-        closeVideoFile(videoCtx);
         return false;
     }
     if (avcodec_parameters_to_context(videoCtx.videoCodecContext, pVideoCodecParams) < 0) {
         logError("FFmpeg: ERROR could not copy video codec params for %s", filePath);
-        closeVideoFile(videoCtx);
         return false;
     }
+    applyDecoderThreading(videoCtx.decoderOptions, videoCtx.videoCodecContext);
     if (avcodec_open2(videoCtx.videoCodecContext, pVideoCodec, nullptr) < 0) {
         logError("FFmpeg: ERROR could not open video codec for %s", filePath);
+        return false;
+    }
+    logError("FFmpeg: Video codec initialized: %s (decoder %s), Resolution: %dx%d, threads: %d, threading: %s%s%s",
+        avcodec_get_name(pVideoCodec->id), pVideoCodec->name,
+        videoCtx.videoCodecContext->width, videoCtx.videoCodecContext->height,
+        videoCtx.videoCodecContext->thread_count,
+        (videoCtx.videoCodecContext->active_thread_type & FF_THREAD_FRAME) ? "frame " : "",
+        (videoCtx.videoCodecContext->active_thread_type & FF_THREAD_SLICE) ? "slice " : "",
+        (videoCtx.videoCodecContext->flags & AV_CODEC_FLAG_LOW_DELAY) ? "low-delay" : "");
+
+    AVRational frameRate = av_guess_frame_rate(videoCtx.formatContext, videoCtx.formatContext->streams[videoCtx.videoStreamIndex], nullptr);
+    videoCtx.frameDuration = (frameRate.num > 0 && frameRate.den > 0) ? av_q2d(av_inv_q(frameRate)) : 1.0 / 30.0;
+    logError("FFmpeg: Video frame rate %d/%d, frame duration %.4f s", frameRate.num, frameRate.den, videoCtx.frameDuration);
+    return true;
+}
+
+// The file's video, audio and subtitle streams, in stream order. Cover art is
+// stored as a video stream with one packet; it is not a track.
+static std::vector<MediaTrack> listMediaTracks(const AVFormatContext* formatContext) {
+    std::vector<MediaTrack> tracks;
+    for (unsigned int i = 0; i < formatContext->nb_streams; i++) {
+        const AVStream* stream = formatContext->streams[i];
+        const AVCodecParameters* params = stream->codecpar;
+        if (params->codec_type != AVMEDIA_TYPE_VIDEO && params->codec_type != AVMEDIA_TYPE_AUDIO &&
+            params->codec_type != AVMEDIA_TYPE_SUBTITLE) continue;
+        if (stream->disposition & AV_DISPOSITION_ATTACHED_PIC) continue;
+
+        MediaTrack track;
+        track.streamIndex = (int)i;
+        track.type = params->codec_type;
+        track.codec = avcodec_get_name(params->codec_id);
+        AVDictionaryEntry* language = av_dict_get(stream->metadata, "language", nullptr, 0);
+        if (language && std::string(language->value) != "und") track.language = language->value;
+        AVDictionaryEntry* title = av_dict_get(stream->metadata, "title", nullptr, 0);
+        if (title) track.title = title->value;
+        track.isDefault = (stream->disposition & AV_DISPOSITION_DEFAULT) != 0;
+        track.channels = params->ch_layout.nb_channels;
+        track.width = params->width;
+        track.height = params->height;
+        tracks.push_back(track);
+    }
+    return tracks;
+}
+
+// The track of `type` to play at open: the one the container marks default,
+// else the first. -1 if there is none.
+static int defaultTrack(const std::vector<MediaTrack>& tracks, AVMediaType type) {
+    int first = -1;
+    for (const MediaTrack& track : tracks) {
+        if (track.type != type) continue;
+        if (track.isDefault) return track.streamIndex;
+        if (first == -1) first = track.streamIndex;
+    }
+    return first;
+}
+
+// Opens a decoder for an audio stream: at step 5 of openVideoFile, and on the
+// demux thread for a track switch. Streams whose headers leave the sample
+// format open get it from the decoder. Returns null on failure.
+static AVCodecContext* openAudioDecoder(AVStream* stream, const char* source) {
+    AVCodecParameters* params = stream->codecpar;
+    const AVCodec* codec = avcodec_find_decoder(params->codec_id);
+    if (!codec) {
+        logError("FFmpeg: WARN audio codec not found for %s", source);
+        return nullptr;
+    }
+    AVCodecContext* codecContext = avcodec_alloc_context3(codec);
+    if (!codecContext) {
+        logError("FFmpeg: WARN could not allocate audio codec context for %s", source);
+        return nullptr;
+    }
+    if (avcodec_parameters_to_context(codecContext, params) < 0) {
+        logError("FFmpeg: WARN could not copy audio codec parameters for %s", source);
+        avcodec_free_context(&codecContext);
+        return nullptr;
+    }
+    codecContext->pkt_timebase = stream->time_base;   // The audio thread's time base for frame timestamps
+    if (avcodec_open2(codecContext, codec, nullptr) < 0) {
+        logError("FFmpeg: WARN could not open audio codec for %s", source);
+        avcodec_free_context(&codecContext);
+        return nullptr;
+    }
+    if (params->format == AV_SAMPLE_FMT_NONE) {
+        // Headers only: the decoder knows its output format once opened
+        params->format = codecContext->sample_fmt;
+    }
+    return codecContext;
+}
+
+// (Re)configures swr from the given input to interleaved float at the
+// output's rate and channel count. Runs at open on the stream parameters and
+// again on the audio decode thread when decoded frames differ from them
+// (HE-AAC headers carry half the real rate; some streams switch mid-way).
+static bool configureAudioResampler(VideoContext& videoCtx, int sampleRate, AVSampleFormat format, const AVChannelLayout* layout) {
+    AVChannelLayout out_ch_layout;
+    av_channel_layout_default(&out_ch_layout, videoCtx.obtainedAudioSpec.channels);
+    char in_layout_desc[128], out_layout_desc[128];
+    av_channel_layout_describe(layout, in_layout_desc, sizeof(in_layout_desc));
+    av_channel_layout_describe(&out_ch_layout, out_layout_desc, sizeof(out_layout_desc));
+    logError("FFmpeg: SwrContext options: in_ch_layout: %s (%d channels), in_sample_rate: %d, in_sample_fmt: %s, out_ch_layout: %s (%d channels), out_sample_rate: %d, out_sample_fmt: %s",
+        in_layout_desc, layout->nb_channels, sampleRate, av_get_sample_fmt_name(format),
+        out_layout_desc, out_ch_layout.nb_channels, videoCtx.obtainedAudioSpec.freq, av_get_sample_fmt_name(AV_SAMPLE_FMT_FLT));
+
+    swr_free(&videoCtx.swrContext);
+    int ret = swr_alloc_set_opts2(&videoCtx.swrContext,
+        &out_ch_layout, AV_SAMPLE_FMT_FLT, videoCtx.obtainedAudioSpec.freq,
+        layout, format, sampleRate, 0, nullptr);
+    if (ret >= 0) ret = swr_init(videoCtx.swrContext);
+    av_channel_layout_uninit(&out_ch_layout);
+    if (ret < 0) {
+        char errBuf[AV_ERROR_MAX_STRING_SIZE];
+        av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
+        logError("FFmpeg: WARN Cannot initialize SwrContext. Error: %s. Audio may not play.", errBuf);
+        swr_free(&videoCtx.swrContext);
+        return false;
+    }
+    videoCtx.swrInputRate = sampleRate;
+    videoCtx.swrInputFormat = format;
+    av_channel_layout_uninit(&videoCtx.audioChannelLayout);
+    av_channel_layout_copy(&videoCtx.audioChannelLayout, layout);
+    return true;
+}
+
+// Makes room for `frames` sample frames in audioFloatBuffer and audioBuffer.
+// Sized at open; grows only for a frame larger than the codec announced or
+// atempo letting out a backlog, and keeps what the buffers hold.
+static bool reserveAudioBuffers(VideoContext& videoCtx, int frames) {
+    if (frames <= videoCtx.audioFloatFrames) return true;
+    size_t samples = (size_t)frames * videoCtx.obtainedAudioSpec.channels;
+    float* floats = static_cast<float*>(av_realloc(videoCtx.audioFloatBuffer, samples * sizeof(float)));
+    if (!floats) return false;
+    videoCtx.audioFloatBuffer = floats;
+    uint8_t* output = static_cast<uint8_t*>(av_realloc(videoCtx.audioBuffer, samples * sizeof(int16_t)));
+    if (!output) return false;
+    videoCtx.audioBuffer = output;
+    videoCtx.audioBufferAllocatedSize = (uint32_t)(samples * sizeof(int16_t));
+    videoCtx.bufferAllocations++;
+    if (videoCtx.audioFloatFrames > 0) {
+        logError("FFmpeg: Audio buffers grown from %d to %d frames.", videoCtx.audioFloatFrames, frames);
+    }
+    videoCtx.audioFloatFrames = frames;
+    return true;
+}
+
+bool openVideoFile(const char* filePath, VideoContext& videoCtx) {
+    videoCtx.openStartCounter = SDL_GetPerformanceCounter();
+
+    // 1. Initialize AVFormatContext, reading through the read-ahead cache when
+    // it opens (FFmpeg's own file protocol otherwise)
+    videoCtx.formatContext = avformat_alloc_context();
+    if (!videoCtx.formatContext) {
+        logError("FFmpeg: ERROR could not allocate the format context.");
+        return false;
+    }
+    if (videoCtx.reader.open(filePath, videoCtx.readerOptions)) {
+        videoCtx.formatContext->pb = videoCtx.reader.avio();
+        videoCtx.formatContext->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+    // Fast start: probe at most FAST_PROBE_SIZE bytes and FAST_ANALYZE_DURATION
+    // of media instead of FFmpeg's 5 MB / 5 s
+    const bool fastStart = videoCtx.decoderOptions.fastStart;
+    AVDictionary* openOptions = nullptr;
+    if (fastStart) {
+        av_dict_set_int(&openOptions, "probesize", FAST_PROBE_SIZE, 0);
+        av_dict_set_int(&openOptions, "analyzeduration", FAST_ANALYZE_DURATION, 0);
+    }
+    int openResult = avformat_open_input(&videoCtx.formatContext, filePath, nullptr, &openOptions);
+    av_dict_free(&openOptions);
+    if (openResult != 0) {
+        logError("FFmpeg: ERROR could not open video file %s", filePath);
+        videoCtx.reader.close();
+        return false;
+    }
+
+    videoCtx.sourcePath = filePath;
+
+    // 2. Find stream information. Fast start skips the analysis when the
+    // headers are enough to open the decoders (MP4, most MKV) and otherwise
+    // runs it within the tight limits, widening them only if that falls short.
+    bool analyzed = false;
+    if (!fastStart || !streamHeadersSufficient(videoCtx.formatContext)) {
+        if (avformat_find_stream_info(videoCtx.formatContext, nullptr) < 0) {
+            logError("FFmpeg: ERROR could not find stream info for %s", filePath);
+            closeVideoFile(videoCtx);
+            return false;
+        }
+        if (fastStart && !streamHeadersSufficient(videoCtx.formatContext)) {
+            logError("FFmpeg: Fast probe was not enough for %s; analyzing with default limits.", filePath);
+            videoCtx.formatContext->probesize = 5000000;
+            videoCtx.formatContext->max_analyze_duration = 0;
+            if (avformat_find_stream_info(videoCtx.formatContext, nullptr) < 0) {
+                logError("FFmpeg: ERROR could not find stream info for %s", filePath);
+                closeVideoFile(videoCtx);
+                return false;
+            }
+        }
+        analyzed = true;
+    }
+    logError("FFmpeg: Stream info for %s ready after %.1f ms (%s).", filePath,
+        (double)(SDL_GetPerformanceCounter() - videoCtx.openStartCounter) * 1000.0 / (double)SDL_GetPerformanceFrequency(),
+        !fastStart ? "full analysis" : (analyzed ? "bounded analysis" : "container headers"));
+
+    // 3. Find Video, Audio and Subtitle Streams: one track of each kind is
+    // played, every other stream is discarded so the demuxer skips its
+    // packets instead of reading them out (the sound player also skips
+    // cover art and any other video)
+    videoCtx.tracks = listMediaTracks(videoCtx.formatContext);
+    videoCtx.videoStreamIndex = videoCtx.audioOnly ? -1 : defaultTrack(videoCtx.tracks, AVMEDIA_TYPE_VIDEO);
+    videoCtx.audioStreamIndex = defaultTrack(videoCtx.tracks, AVMEDIA_TYPE_AUDIO);
+    int subtitleStreamIndex = videoCtx.audioOnly ? -1 : defaultTrack(videoCtx.tracks, AVMEDIA_TYPE_SUBTITLE);
+    int discarded = 0;
+    for (unsigned int i = 0; i < videoCtx.formatContext->nb_streams; i++) {
+        bool selected = (int)i == videoCtx.videoStreamIndex || (int)i == videoCtx.audioStreamIndex || (int)i == subtitleStreamIndex;
+        videoCtx.formatContext->streams[i]->discard = selected ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+        if (!selected) discarded++;
+    }
+    logError("FFmpeg: %zu tracks; playing video %d, audio %d, subtitles %d; %d of %u streams discarded.",
+        videoCtx.tracks.size(), videoCtx.videoStreamIndex, videoCtx.audioStreamIndex.load(), subtitleStreamIndex,
+        discarded, videoCtx.formatContext->nb_streams);
+
+    if (videoCtx.audioOnly) {
+        if (videoCtx.audioStreamIndex == -1) {
+            logError("FFmpeg: ERROR audio stream not found for %s", filePath);
+            closeVideoFile(videoCtx);
+            return false;
+        }
+    }
+    else if (videoCtx.videoStreamIndex == -1) {
+        logError("FFmpeg: ERROR video stream not found for %s", filePath);
+        closeVideoFile(videoCtx);
+        return false;
+    }
+    if (videoCtx.formatContext->start_time != AV_NOPTS_VALUE) {
+        videoCtx.startTime = (double)videoCtx.formatContext->start_time / AV_TIME_BASE;
+    }
+    if (videoCtx.formatContext->duration != AV_NOPTS_VALUE) {
+        videoCtx.duration = (double)videoCtx.formatContext->duration / AV_TIME_BASE;
+    }
+
+    // 4. Initialize Video Codec
+    if (!videoCtx.audioOnly && !openVideoDecoder(videoCtx, filePath)) {
         closeVideoFile(videoCtx);
         return false;
     }
-    logError("FFmpeg: Video codec initialized: %s, Resolution: %dx%d", avcodec_get_name(pVideoCodec->id), videoCtx.videoCodecContext->width, videoCtx.videoCodecContext->height);
 
     // 5. Initialize Audio Codec & SDL Audio Device
     if (videoCtx.audioStreamIndex != -1) {
         AVCodecParameters* pAudioCodecParams = videoCtx.formatContext->streams[videoCtx.audioStreamIndex]->codecpar;
-        const AVCodec* pAudioCodec = avcodec_find_decoder(pAudioCodecParams->codec_id);
-        if (pAudioCodec) {
-            videoCtx.audioCodecContext = avcodec_alloc_context3(pAudioCodec);
-            if (!videoCtx.audioCodecContext) {
-                logError("FFmpeg: WARN could not allocate audio codec context for %s", filePath);
+        videoCtx.audioCodecContext = openAudioDecoder(videoCtx.formatContext->streams[videoCtx.audioStreamIndex], filePath);
+        if (videoCtx.audioCodecContext) {
+            logError("FFmpeg: Audio codec initialized: %s, Sample Rate: %d, Channels: %d, Format: %s",
+                avcodec_get_name(pAudioCodecParams->codec_id),
+                static_cast<int>(pAudioCodecParams->sample_rate),
+                static_cast<int>(pAudioCodecParams->ch_layout.nb_channels),
+                av_get_sample_fmt_name(static_cast<AVSampleFormat>(pAudioCodecParams->format)));
+
+            // Audio goes into the shared output device, so swr converts
+            // straight to its rate and layout
+            AudioOutputInfo output = getAudioOutputInfo();
+            SDL_memset(&videoCtx.obtainedAudioSpec, 0, sizeof(SDL_AudioSpec));
+            if (output.frequency <= 0 || output.format != AUDIO_S16SYS) {
+                logError("FFmpeg: WARN No S16 audio output available; playing without audio.");
+                avcodec_free_context(&videoCtx.audioCodecContext);
+            }
+            else {
+                // Mixing starts once the audio decode thread is running (step 9)
+                videoCtx.obtainedAudioSpec.freq = output.frequency;
+                videoCtx.obtainedAudioSpec.format = output.format;
+                videoCtx.obtainedAudioSpec.channels = (Uint8)output.channels;
+                videoCtx.obtainedAudioSpec.samples = (Uint16)output.bufferSamples;
+                videoCtx.obtainedAudioSpec.size = (Uint32)(output.bufferSamples * output.channels * 2);
+                videoCtx.audioEnabled = true;
+                logError("FFmpeg: Video audio mixed into the shared output: freq=%d, channels=%d, %d-sample buffer",
+                    output.frequency, output.channels, output.bufferSamples);
+            }
+
+            videoCtx.decodedAudioFrame = av_frame_alloc();
+            videoCtx.audioPacket = av_packet_alloc();
+            if (!videoCtx.decodedAudioFrame || !videoCtx.audioPacket) {
+                logError("FFmpeg: Failed to allocate audio frame/packet");
+                av_frame_free(&videoCtx.decodedAudioFrame);
+                av_packet_free(&videoCtx.audioPacket);
+                avcodec_free_context(&videoCtx.audioCodecContext);
+                videoCtx.audioEnabled = false;
             }
             else {
-                if (avcodec_parameters_to_context(videoCtx.audioCodecContext, pAudioCodecParams) < 0) {
-                    logError("FFmpeg: WARN could not copy audio codec parameters for %s", filePath);
+                // Resample to float at the output's rate and channel count, through
+                // swr even when the source already matches (a plain copy then):
+                // the processing stage works on float and converts to S16 itself.
+                // The buffers hold one frame's output, twice over for atempo at
+                // its slowest speed.
+                int frameSamples = pAudioCodecParams->frame_size > 0 ? pAudioCodecParams->frame_size : 4096;
+                bool configured = configureAudioResampler(videoCtx, pAudioCodecParams->sample_rate,
+                    static_cast<AVSampleFormat>(pAudioCodecParams->format), &pAudioCodecParams->ch_layout);
+                int outFrames = configured ? swr_get_out_samples(videoCtx.swrContext, frameSamples) : 0;
+                if (configured && (outFrames <= 0 || !reserveAudioBuffers(videoCtx, (int)std::ceil(outFrames / MIN_PLAYBACK_SPEED)))) {
+                    logError("FFmpeg: WARN Failed to allocate audio buffers");
+                    configured = false;
+                }
+                if (!configured) {
+                    swr_free(&videoCtx.swrContext);
+                    av_freep(&videoCtx.audioBuffer);
+                    av_freep(&videoCtx.audioFloatBuffer);
+                    videoCtx.audioBufferAllocatedSize = 0;
+                    videoCtx.audioFloatFrames = 0;
+                    av_frame_free(&videoCtx.decodedAudioFrame);
+                    av_packet_free(&videoCtx.audioPacket);
                     avcodec_free_context(&videoCtx.audioCodecContext);
+                    videoCtx.audioEnabled = false;
                 }
                 else {
-                    if (avcodec_open2(videoCtx.audioCodecContext, pAudioCodec, nullptr) < 0) {
-                        logError("FFmpeg: WARN could not open audio codec for %s", filePath);
-                        avcodec_free_context(&videoCtx.audioCodecContext);
-                    }
-                    else {
-                        av_channel_layout_copy(&videoCtx.audioChannelLayout, &pAudioCodecParams->ch_layout);
-                        logError("FFmpeg: Audio codec initialized: %s, Sample Rate: %d, Channels: %d, Format: %s",
-                            avcodec_get_name(pAudioCodec->id),
-                            static_cast<int>(pAudioCodecParams->sample_rate),
-                            static_cast<int>(pAudioCodecParams->ch_layout.nb_channels),
-                            av_get_sample_fmt_name(static_cast<AVSampleFormat>(pAudioCodecParams->format)));
-
-                        // Initialize SDL Audio Device
-                        SDL_memset(&videoCtx.desiredAudioSpec, 0, sizeof(SDL_AudioSpec));
-                        videoCtx.desiredAudioSpec.freq = pAudioCodecParams->sample_rate;
-                        videoCtx.desiredAudioSpec.format = AUDIO_S16SYS;
-                        videoCtx.desiredAudioSpec.channels = 2; // Stereo
-                        videoCtx.desiredAudioSpec.samples = 8192; // Increased buffer size
-                        videoCtx.desiredAudioSpec.callback = audioCallback;
-                        videoCtx.desiredAudioSpec.userdata = &videoCtx;
-
-                        videoCtx.audioDevice = SDL_OpenAudioDevice(nullptr, 0, &videoCtx.desiredAudioSpec, &videoCtx.obtainedAudioSpec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
-                        if (videoCtx.audioDevice == 0) {
-                            logError("FFmpeg: WARN Failed to open SDL audio device: %s", SDL_GetError());
-                            avcodec_free_context(&videoCtx.audioCodecContext);
-                        }
-                        else {
-                            logError("FFmpeg: SDL audio device opened. Obtained: freq=%d, channels=%d, format=%d",
-                                videoCtx.obtainedAudioSpec.freq, videoCtx.obtainedAudioSpec.channels, videoCtx.obtainedAudioSpec.format);
-                            SDL_PauseAudioDevice(videoCtx.audioDevice, 0); // Start playback
-                        }
-
-                        videoCtx.decodedAudioFrame = av_frame_alloc();
-                        videoCtx.audioPacket = av_packet_alloc();
-                        if (!videoCtx.decodedAudioFrame || !videoCtx.audioPacket) {
-                            logError("FFmpeg: Failed to allocate audio frame/packet");
-                            av_frame_free(&videoCtx.decodedAudioFrame);
-                            av_packet_free(&videoCtx.audioPacket);
-                            avcodec_free_context(&videoCtx.audioCodecContext);
-                            if (videoCtx.audioDevice) {
-                                SDL_CloseAudioDevice(videoCtx.audioDevice);
-                                videoCtx.audioDevice = 0;
-                            }
-                        }
-                        else {
-                            // Allocate audio buffer
-                            videoCtx.audioBufferAllocatedSize = 8192 * videoCtx.obtainedAudioSpec.channels * 2; // 2 bytes per sample for S16
-                            videoCtx.audioBuffer = static_cast<uint8_t*>(av_malloc(videoCtx.audioBufferAllocatedSize));
-                            if (!videoCtx.audioBuffer) {
-                                logError("FFmpeg: WARN Failed to allocate audio buffer");
-                                av_frame_free(&videoCtx.decodedAudioFrame);
-                                av_packet_free(&videoCtx.audioPacket);
-                                avcodec_free_context(&videoCtx.audioCodecContext);
-                                if (videoCtx.audioDevice) {
-                                    SDL_CloseAudioDevice(videoCtx.audioDevice);
-                                    videoCtx.audioDevice = 0;
-                                }
-                            }
-                            else {
-                                videoCtx.audioBufferSize = 0;
-                                videoCtx.audioBufferPos = 0;
-
-                                // Check if resampling is needed
-                                bool needsResampling = pAudioCodecParams->format != AV_SAMPLE_FMT_S16 ||
-                                    pAudioCodecParams->ch_layout.nb_channels != videoCtx.obtainedAudioSpec.channels ||
-                                    pAudioCodecParams->sample_rate != videoCtx.obtainedAudioSpec.freq;
-
-                                if (!needsResampling) {
-                                    logError("FFmpeg: Audio format matches SDL spec (S16, %d channels, %d Hz). Skipping SwrContext.",
-                                        videoCtx.obtainedAudioSpec.channels, videoCtx.obtainedAudioSpec.freq);
-                                }
-                                else {
-                                    // Setup SwrContext for resampling to S16
-                                    videoCtx.swrContext = swr_alloc();
-                                    if (!videoCtx.swrContext) {
-                                        logError("FFmpeg: WARN Cannot allocate SwrContext. Audio may not play.");
-                                        av_frame_free(&videoCtx.decodedAudioFrame);
-                                        av_packet_free(&videoCtx.audioPacket);
-                                        avcodec_free_context(&videoCtx.audioCodecContext);
-                                        av_free(videoCtx.audioBuffer);
-                                        videoCtx.audioBuffer = nullptr;
-                                        if (videoCtx.audioDevice) {
-                                            SDL_CloseAudioDevice(videoCtx.audioDevice);
-                                            videoCtx.audioDevice = 0;
-                                        }
-                                    }
-                                    else {
-                                        AVChannelLayout in_ch_layout;
-                                        AVChannelLayout out_ch_layout;
-                                        av_channel_layout_copy(&in_ch_layout, &videoCtx.audioChannelLayout);
-                                        av_channel_layout_default(&out_ch_layout, videoCtx.obtainedAudioSpec.channels); // Use SDL channels
-
-                                        char in_layout_desc[128], out_layout_desc[128];
-                                        av_channel_layout_describe(&in_ch_layout, in_layout_desc, sizeof(in_layout_desc));
-                                        av_channel_layout_describe(&out_ch_layout, out_layout_desc, sizeof(out_layout_desc));
-                                        logError("FFmpeg: SwrContext options: in_ch_layout: %s (%d channels), in_sample_rate: %d, in_sample_fmt: %s, out_ch_layout: %s (%d channels), out_sample_rate: %d, out_sample_fmt: %s",
-                                            in_layout_desc, in_ch_layout.nb_channels, pAudioCodecParams->sample_rate, av_get_sample_fmt_name(static_cast<AVSampleFormat>(pAudioCodecParams->format)),
-                                            out_layout_desc, out_ch_layout.nb_channels, videoCtx.obtainedAudioSpec.freq, av_get_sample_fmt_name(AV_SAMPLE_FMT_S16));
-
-                                        // Set SwrContext options
-                                        swr_alloc_set_opts2(&videoCtx.swrContext,
-                                            &out_ch_layout, AV_SAMPLE_FMT_S16, videoCtx.obtainedAudioSpec.freq,
-                                            &in_ch_layout, static_cast<AVSampleFormat>(pAudioCodecParams->format), pAudioCodecParams->sample_rate,
-                                            0, nullptr);
-
-                                        int swr_init_ret = swr_init(videoCtx.swrContext);
-                                        if (swr_init_ret < 0) {
-                                            char errBuf[AV_ERROR_MAX_STRING_SIZE];
-                                            av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, swr_init_ret);
-                                            logError("FFmpeg: WARN Cannot initialize SwrContext. Error: %s. Audio may not play.", errBuf);
-                                            swr_free(&videoCtx.swrContext);
-                                            av_frame_free(&videoCtx.decodedAudioFrame);
-                                            av_packet_free(&videoCtx.audioPacket);
-                                            avcodec_free_context(&videoCtx.audioCodecContext);
-                                            av_free(videoCtx.audioBuffer);
-                                            videoCtx.audioBuffer = nullptr;
-                                            if (videoCtx.audioDevice) {
-                                                SDL_CloseAudioDevice(videoCtx.audioDevice);
-                                                videoCtx.audioDevice = 0;
-                                            }
-                                            av_channel_layout_uninit(&in_ch_layout);
-                                            av_channel_layout_uninit(&out_ch_layout);
-                                            return true; // Continue with video
-                                        }
-                                        else {
-                                            logError("FFmpeg: Audio SwrContext initialized for S16 conversion.");
-                                        }
-
-                                        av_channel_layout_uninit(&in_ch_layout);
-                                        av_channel_layout_uninit(&out_ch_layout);
-                                    }
-                                }
-                            }
-                        }
-                    }
+                    videoCtx.audioBufferSize = 0;
+                    logError("FFmpeg: Audio resampled to float, %d-frame processing buffers.", videoCtx.audioFloatFrames);
                 }
             }
         }
-        else {
-            logError("FFmpeg: WARN audio codec not found for %s", filePath);
-        }
     }
 
-    // 6. Initialize SwsContext for video frame conversion with SWS_BICUBIC
+    if (!videoCtx.audioEnabled && videoCtx.audioStreamIndex != -1) {
+        videoCtx.formatContext->streams[videoCtx.audioStreamIndex]->discard = AVDISCARD_ALL;   // Nothing to play it with
+    }
+    if (videoCtx.audioOnly && !videoCtx.audioEnabled) {
+        logError("FFmpeg: ERROR no playable audio in %s", filePath);
+        closeVideoFile(videoCtx);
+        return false;
+    }
+
+    // 5b. Subtitles, decoded by the demuxer as their packets come in
+    if (subtitleStreamIndex != -1 && !openSubtitleDecoder(videoCtx, subtitleStreamIndex)) {
+        videoCtx.formatContext->streams[subtitleStreamIndex]->discard = AVDISCARD_ALL;
+    }
+
+    // 6. Choose the texture path. YUV 4:2:0 goes straight to an IYUV/NV12
+    // texture; anything else is converted to RGBA by swscale on the worker.
+    // The YUV matrix is taken from the first frame, since the headers alone
+    // may not carry the pixel format or colorspace.
     if (videoCtx.videoCodecContext) {
-        videoCtx.swsContext = sws_getContext(
-            videoCtx.videoCodecContext->width, videoCtx.videoCodecContext->height, videoCtx.videoCodecContext->pix_fmt,
-            videoCtx.videoCodecContext->width, videoCtx.videoCodecContext->height, AV_PIX_FMT_RGBA,
-            SWS_BICUBIC, nullptr, nullptr, nullptr);
-        if (!videoCtx.swsContext) {
-            logError("FFmpeg: ERROR Could not initialize SwsContext for video conversion.");
-            closeVideoFile(videoCtx);
-            return false;
-        }
+        AVCodecContext* codecContext = videoCtx.videoCodecContext;
+        Uint32 textureFormat = videoCtx.decoderOptions.yuvTextures ? yuvTextureFormatFor(codecContext->pix_fmt) : SDL_PIXELFORMAT_UNKNOWN;
+        logError("FFmpeg: Video texture path: %s (%s)",
+            textureFormat != SDL_PIXELFORMAT_UNKNOWN ? SDL_GetPixelFormatName(textureFormat) : "swscale to RGBA32",
+            av_get_pix_fmt_name(codecContext->pix_fmt) ? av_get_pix_fmt_name(codecContext->pix_fmt) : "unknown");
     }
 
     // 7. Allocate Video Frames
     videoCtx.decodedFrame = av_frame_alloc();
-    if (!videoCtx.decodedFrame) {
+    videoCtx.shownFrame = av_frame_alloc();
+    videoCtx.videoPacket = av_packet_alloc();
+    if (!videoCtx.decodedFrame || !videoCtx.shownFrame || !videoCtx.videoPacket) {
         logError("FFmpeg: ERROR Could not allocate video decodedFrame.");
         closeVideoFile(videoCtx);
         return false;
     }
-    videoCtx.rgbFrame = av_frame_alloc();
-    if (!videoCtx.rgbFrame) {
-        logError("FFmpeg: ERROR Could not allocate video rgbFrame.");
-        closeVideoFile(videoCtx);
-        return false;
-    }
 
-    if (videoCtx.videoCodecContext) {
-        int numBytes = av_image_get_buffer_size(AV_PIX_FMT_RGBA, videoCtx.videoCodecContext->width, videoCtx.videoCodecContext->height, 1);
-        videoCtx.rgbBuffer = static_cast<uint8_t*>(av_malloc(numBytes * sizeof(uint8_t)));
-        if (!videoCtx.rgbBuffer) {
-            logError("FFmpeg: ERROR Could not allocate RGB buffer.");
+    // 8. Allocate the frame ring. Conversion buffers are only allocated by the
+    // worker if a frame needs the swscale path.
+    for (int i = 0; i < VIDEO_FRAME_RING_SIZE; i++) {
+        VideoFrameSlot& slot = videoCtx.frameRing.slots[i];
+        slot.frame = av_frame_alloc();
+        videoCtx.decodedRing.slots[i].frame = av_frame_alloc();
+        if (!slot.frame || !videoCtx.decodedRing.slots[i].frame) {
+            logError("FFmpeg: ERROR Could not allocate frame ring slot %d.", i);
             closeVideoFile(videoCtx);
             return false;
         }
-        av_image_fill_arrays(videoCtx.rgbFrame->data, videoCtx.rgbFrame->linesize, videoCtx.rgbBuffer, AV_PIX_FMT_RGBA,
-            videoCtx.videoCodecContext->width, videoCtx.videoCodecContext->height, 1);
     }
 
-    logError("FFmpeg: Successfully opened and configured video %s", filePath);
-    return true;
+    videoCtx.videoQueue.start();
+    videoCtx.audioQueue.start();
+    videoCtx.demuxStop.store(false);
+    videoCtx.demuxThread = std::thread(demuxThreadMain, &videoCtx);
+    videoCtx.decodeStop.store(false);
+    videoCtx.decodeDone.store(false);
+    videoCtx.decodeFinished.store(false);
+    if (!videoCtx.audioOnly) {
+        videoCtx.decodeThread = std::thread(videoDecodeThreadMain, &videoCtx);
+        videoCtx.convertThread = std::thread(videoConvertThreadMain, &videoCtx);
+    }
+
+    // 9. Audio: decode ahead into the ring, then hook into the output. Room
+    // for four device buffers or half a second, whichever is more; a second
+    // for audio-only streams, which the caller reads out of the ring itself.
+    if (videoCtx.audioEnabled && videoCtx.audioCodecContext && videoCtx.audioBuffer) {
+        int bytesPerSecond = videoCtx.obtainedAudioSpec.freq * videoCtx.obtainedAudioSpec.channels * 2;
+        videoCtx.audioMixBufferSize = videoCtx.obtainedAudioSpec.size;
+        videoCtx.audioMixBuffer = static_cast<uint8_t*>(av_malloc(videoCtx.audioMixBufferSize));
+        Uint32 ringBytes = std::max(4 * videoCtx.obtainedAudioSpec.size, (Uint32)bytesPerSecond / (videoCtx.audioOnly ? 1 : 2));
+        if (!videoCtx.audioMixBuffer || !videoCtx.audioRing.allocate(ringBytes)) {
+            logError("FFmpeg: WARN Failed to allocate audio ring; playing without audio.");
+            videoCtx.audioEnabled = false;
+            if (videoCtx.audioOnly) {
+                closeVideoFile(videoCtx);
+                return false;
+            }
+        }
+        else {
+            videoCtx.audioStop.store(false);
+            videoCtx.audioFinished.store(false);
+            videoCtx.audioThread = std::thread(audioDecodeThreadMain, &videoCtx);
+            if (!videoCtx.audioOnly) setAudioOutputSource(audioCallback, &videoCtx);
+        }
+    }
+
+    // 10. Fast start skipped the full analysis; finish it in the background
+    // for the seek bar (TS and some MKV only get a duration this way)
+    if (fastStart) {
+        videoCtx.streamInfoStop.store(false);
+        videoCtx.streamInfoThread = std::thread(streamInfoThreadMain, &videoCtx, std::string(filePath));
+    }
+
+    logError("FFmpeg: Successfully opened and configured video %s", filePath);
+    return true;
 }
 
 void closeVideoFile(VideoContext& videoCtx) {
     logError("FFmpeg: Closing video file.");
 
-    if (videoCtx.audioDevice != 0) {
-        SDL_PauseAudioDevice(videoCtx.audioDevice, 1);
-        SDL_CloseAudioDevice(videoCtx.audioDevice);
-        videoCtx.audioDevice = 0;
-        logError("FFmpeg: Closed SDL Audio Device.");
+    if (videoCtx.audioEnabled && !videoCtx.audioOnly) {
+        // Returns once the output callback is no longer running
+        setAudioOutputSource(nullptr, nullptr);
+        videoCtx.audioEnabled = false;
+        logError("FFmpeg: Detached video audio from the output.");
+    }
+
+    // The worker threads use the FFmpeg contexts; stop them before anything is freed
+    stopVideoThreads(videoCtx);
+    videoCtx.videoDraining = false;
+    logDecodeStatistics(videoCtx);
+
+    closeSubtitleDecoder(videoCtx);
+    AVCodecContext* switchedAudioDecoder = videoCtx.switchedAudioDecoder.exchange(nullptr);
+    avcodec_free_context(&switchedAudioDecoder);
+    av_frame_free(&videoCtx.decodedAudioFrame);
+    av_packet_free(&videoCtx.audioPacket);
+    av_freep(&videoCtx.audioBuffer);
+    av_freep(&videoCtx.audioFloatBuffer);
+    videoCtx.audioBufferSize = 0;
+    videoCtx.audioBufferAllocatedSize = 0;
+    videoCtx.audioFloatFrames = 0;
+    videoCtx.audioChunkDuration = 0.0;
+    videoCtx.audioRing.release();
+    av_freep(&videoCtx.audioMixBuffer);
+    videoCtx.audioMixBufferSize = 0;
+    videoCtx.audioFinished.store(false);
+
+    swr_free(&videoCtx.swrContext);
+    videoCtx.swrInputRate = 0;
+    videoCtx.swrInputFormat = AV_SAMPLE_FMT_NONE;
+    resetAudioTempo(videoCtx);
+    av_frame_free(&videoCtx.tempoFrame);
+    av_frame_free(&videoCtx.decodedFrame);
+    av_packet_free(&videoCtx.videoPacket);
+    videoCtx.videoPacketPending = false;
+    for (int i = 0; i < VIDEO_FRAME_RING_SIZE; i++) {
+        av_frame_free(&videoCtx.frameRing.slots[i].frame);
+        av_frame_free(&videoCtx.frameRing.slots[i].image);
+        videoCtx.frameRing.slots[i] = VideoFrameSlot();
+        av_frame_free(&videoCtx.decodedRing.slots[i].frame);
+        videoCtx.decodedRing.slots[i] = VideoFrameSlot();
+    }
+    videoCtx.decodedRing.writeIndex.store(0);
+    videoCtx.decodedRing.readIndex.store(0);
+    av_frame_free(&videoCtx.shownFrame);
+    av_frame_free(&videoCtx.refineSlot.image);
+    videoCtx.refineSlot = VideoFrameSlot();
+    sws_freeContext(videoCtx.refineSwsContext);
+    videoCtx.refineSwsContext = nullptr;
+    videoCtx.refined = false;
+    videoCtx.paused.store(false);
+    videoCtx.pausedClock = 0.0;
+    videoCtx.targetWidth.store(0);
+    videoCtx.targetHeight.store(0);
+    videoCtx.videoEofSerial.store(-1);
+    videoCtx.seekRequests.store(0);
+    videoCtx.seeksCompleted.store(0);
+    videoCtx.accurateSeekPts.store(-1.0);
+    videoCtx.seekDecodedFrames.store(0);
+    videoCtx.seekPending = false;
+    videoCtx.seekCount = 0;
+    videoCtx.lastSeekMs = 0.0;
+    videoCtx.seekLatencyTotalMs = 0.0;
+    videoCtx.seekLatencyMaxMs = 0.0;
+    videoCtx.seekDecodedTotal = 0;
+    videoCtx.keyframeStop.store(false);
+    {
+        std::lock_guard<std::mutex> lock(videoCtx.keyframeMutex);
+        videoCtx.keyframes.clear();
+        videoCtx.keyframeIndexComplete = false;
+    }
+    videoCtx.streamInfoStop.store(false);
+    videoCtx.streamInfoReady.store(false);
+    videoCtx.analyzedStartTime.store(0.0);
+    videoCtx.analyzedDuration.store(0.0);
+    videoCtx.openStartCounter = 0;
+    videoCtx.timeToFirstFrameMs = 0.0;
+    videoCtx.sourcePath.clear();
+    videoCtx.startTime = 0.0;
+    videoCtx.duration = 0.0;
+    videoCtx.frameRing.writeIndex.store(0);
+    videoCtx.frameRing.readIndex.store(0);
+    sws_freeContext(videoCtx.swsContext);
+    avcodec_free_context(&videoCtx.videoCodecContext);
+    avcodec_free_context(&videoCtx.audioCodecContext);
+    avformat_close_input(&videoCtx.formatContext);
+    videoCtx.reader.close();
+    av_channel_layout_uninit(&videoCtx.audioChannelLayout);
+
+    videoCtx.formatContext = nullptr;
+    videoCtx.videoCodecContext = nullptr;
+    videoCtx.audioCodecContext = nullptr;
+    videoCtx.videoStreamIndex = -1;
+    videoCtx.audioStreamIndex = -1;
+    videoCtx.tracks.clear();
+    videoCtx.requestedAudioTrack.store(-1);
+    videoCtx.requestedSubtitleTrack.store(-1);
+    videoCtx.audioResumePts.store(-1.0);
+    videoCtx.swsContext = nullptr;
+    videoCtx.decodedFrame = nullptr;
+    videoCtx.audioPacket = nullptr;
+    videoCtx.decodedAudioFrame = nullptr;
+
+    videoCtx.audioBufferPts = 0.0;
+    videoCtx.audioClockPts.store(0.0);
+    videoCtx.audioClockCounter.store(0);
+    videoCtx.audioClockValid.store(false);
+    videoCtx.wallClockStart = 0;
+    videoCtx.wallClockStartPts = 0.0;
+    videoCtx.fixedClock = 0.0;
+    videoCtx.frameDuration = 1.0 / 30.0;
+    videoCtx.hasShownFrame = false;
+    videoCtx.clockDrift = 0.0;
+    videoCtx.presentedFrames = 0;
+    videoCtx.droppedFrames.store(0);
+    videoCtx.thinnedFrames.store(0);
+    videoCtx.repeatedFrames = 0;
+    videoCtx.displayClock.store(0.0);
+    for (int i = 0; i < VIDEO_DECODE_TIME_BUCKETS; i++) videoCtx.decodeTimeHistogram[i].store(0);
+    videoCtx.decodedFrameCount.store(0);
+    videoCtx.decodeTicks.store(0);
+    videoCtx.convertTicks.store(0);
+    videoCtx.convertedFrameCount.store(0);
+    videoCtx.bufferAllocations.store(0);
+    videoCtx.uploadTicks = 0;
+    videoCtx.uploadedFrames = 0;
+    for (int i = 0; i <= VIDEO_FRAME_RING_SIZE; i++) videoCtx.ringOccupancyHistogram[i] = 0;
+
+    logError("FFmpeg: Video file closed and context reset.");
+}
+
+static void resetAudioTempo(VideoContext& videoCtx) {
+    avfilter_graph_free(&videoCtx.tempoGraph);
+    videoCtx.tempoSource = nullptr;
+    videoCtx.tempoSink = nullptr;
+    videoCtx.tempoRate = 1.0;
+}
+
+static bool buildAudioTempo(VideoContext& videoCtx, double speed) {
+    int rate = videoCtx.obtainedAudioSpec.freq;
+    AVChannelLayout layout;
+    av_channel_layout_default(&layout, videoCtx.obtainedAudioSpec.channels);
+    char layoutName[64];
+    av_channel_layout_describe(&layout, layoutName, sizeof(layoutName));
+    char sourceArgs[160];
+    snprintf(sourceArgs, sizeof(sourceArgs), "sample_rate=%d:sample_fmt=flt:channel_layout=%s:time_base=1/%d", rate, layoutName, rate);
+    char tempoArgs[32];
+    snprintf(tempoArgs, sizeof(tempoArgs), "tempo=%.4f", speed);
+
+    AVFilterContext* tempo = nullptr;
+    videoCtx.tempoGraph = avfilter_graph_alloc();
+    bool ok = videoCtx.tempoGraph &&
+        avfilter_graph_create_filter(&videoCtx.tempoSource, avfilter_get_by_name("abuffer"), "in", sourceArgs, nullptr, videoCtx.tempoGraph) >= 0 &&
+        avfilter_graph_create_filter(&tempo, avfilter_get_by_name("atempo"), "tempo", tempoArgs, nullptr, videoCtx.tempoGraph) >= 0 &&
+        avfilter_graph_create_filter(&videoCtx.tempoSink, avfilter_get_by_name("abuffersink"), "out", nullptr, nullptr, videoCtx.tempoGraph) >= 0 &&
+        avfilter_link(videoCtx.tempoSource, 0, tempo, 0) >= 0 &&
+        avfilter_link(tempo, 0, videoCtx.tempoSink, 0) >= 0 &&
+        avfilter_graph_config(videoCtx.tempoGraph, nullptr) >= 0;
+    if (!ok) {
+        logError("FFmpeg: Could not set up atempo=%.2f; audio stays at normal speed.", speed);
+        resetAudioTempo(videoCtx);
+        return false;
+    }
+    videoCtx.tempoRate = speed;
+    videoCtx.tempoStartPts = videoCtx.audioBufferPts;
+    return true;
+}
+
+// Playback speeds other than 1x: pass the resampled chunk in
+// audioFloatBuffer through atempo, which changes its duration but not its
+// pitch (WSOLA). The graph is rebuilt after every flush; atempo holds samples
+// back, so a chunk can come out empty or carry audio from earlier chunks.
+static bool applyAudioTempo(VideoContext& videoCtx, int& frames) {
+    double speed = videoCtx.playbackSpeed.load();
+    if (videoCtx.tempoGraph && videoCtx.tempoRate != speed) resetAudioTempo(videoCtx);
+    if (speed == 1.0 || frames == 0) return true;
+    if (!videoCtx.tempoGraph && !buildAudioTempo(videoCtx, speed)) return true;
+    if (!videoCtx.tempoFrame) videoCtx.tempoFrame = av_frame_alloc();
+    AVFrame* frame = videoCtx.tempoFrame;
+    if (!frame) return false;
+
+    int rate = videoCtx.obtainedAudioSpec.freq;
+    int channels = videoCtx.obtainedAudioSpec.channels;
+    frame->format = AV_SAMPLE_FMT_FLT;
+    frame->sample_rate = rate;
+    frame->nb_samples = frames;
+    av_channel_layout_default(&frame->ch_layout, channels);
+    frame->pts = llround(videoCtx.audioBufferPts * rate);
+    if (av_frame_get_buffer(frame, 0) < 0) return false;
+    memcpy(frame->data[0], videoCtx.audioFloatBuffer, (size_t)frames * channels * sizeof(float));
+    if (av_buffersrc_add_frame(videoCtx.tempoSource, frame) < 0) {   // Takes the frame's reference
+        av_frame_unref(frame);
+        return false;
+    }
+
+    frames = 0;
+    while (av_buffersink_get_frame(videoCtx.tempoSink, frame) >= 0) {
+        if (!reserveAudioBuffers(videoCtx, frames + frame->nb_samples)) {
+            av_frame_unref(frame);
+            return false;
+        }
+        memcpy(videoCtx.audioFloatBuffer + (size_t)frames * channels, frame->data[0], (size_t)frame->nb_samples * channels * sizeof(float));
+        frames += frame->nb_samples;
+        av_frame_unref(frame);
+    }
+    return true;
+}
+
+// The processing stage, on the float chunk of `frames` sample frames in
+// audioFloatBuffer: atempo, mono downmix and gain, then the one conversion
+// to the output's S16 into audioBuffer. A gain change (volume, mute) ramps
+// across the chunk it lands in.
+static bool processAudioChunk(VideoContext& videoCtx, int frames) {
+    if (!applyAudioTempo(videoCtx, frames)) return false;
+    int channels = videoCtx.obtainedAudioSpec.channels;
+    float* samples = videoCtx.audioFloatBuffer;
+    if (videoCtx.downmixMono.load()) downmixAudioToMono(samples, frames, channels);
+
+    float gain = videoCtx.muted.load() ? 0.0f : videoCtx.volume.load();
+    if (gain != videoCtx.appliedGain && frames > 0) {
+        rampAudioSamples(samples, frames, channels, videoCtx.appliedGain, gain);
+        videoCtx.appliedGain = gain;
+    }
+    else if (gain != 1.0f) {
+        scaleAudioSamples(samples, (size_t)frames * channels, gain);
+    }
+
+    convertAudioToS16(samples, reinterpret_cast<int16_t*>(videoCtx.audioBuffer), (size_t)frames * channels);
+    videoCtx.audioBufferSize = (uint32_t)((size_t)frames * channels * sizeof(int16_t));
+    return true;
+}
+
+// First packet of a new serial: drop what the decoder and resampler still
+// hold. A track switch starts a serial too and brings the new stream's
+// decoder, opened by the demux thread; swr follows with the first frame,
+// whose format will not match. Audio the output has already passed by the
+// time the new track is ready is dropped as well.
+static void startAudioSerial(VideoContext& videoCtx, int serial) {
+    AVCodecContext* switched = videoCtx.switchedAudioDecoder.exchange(nullptr);
+    if (switched) {
+        avcodec_free_context(&videoCtx.audioCodecContext);
+        videoCtx.audioCodecContext = switched;
+        if (!videoCtx.paused.load() && videoCtx.audioClockValid.load()) {
+            Uint64 elapsed = SDL_GetPerformanceCounter() - videoCtx.audioClockCounter.load();
+            double now = videoCtx.audioClockPts.load() + videoCtx.playbackSpeed.load() * (double)elapsed / (double)SDL_GetPerformanceFrequency();
+            videoCtx.audioResumePts.store(std::max(videoCtx.audioResumePts.load(), now));
+        }
+    }
+    else {
+        avcodec_flush_buffers(videoCtx.audioCodecContext);
+    }
+    if (videoCtx.swrContext) swr_init(videoCtx.swrContext);
+    resetAudioTempo(videoCtx);
+    videoCtx.audioSerial = serial;
+    videoCtx.audioFinished.store(false);
+}
+
+// Decode, resample and process the next audio frame into audioBuffer. Runs
+// on the audio decode thread; returns false at end of stream, while a seek is
+// in flight, after abort or on error.
+bool decodeNextAudioPacket(VideoContext& videoCtx) {
+    if (!videoCtx.formatContext || !videoCtx.audioCodecContext || !videoCtx.audioPacket || !videoCtx.decodedAudioFrame || !videoCtx.audioBuffer) {
+        logError("FFmpeg: decodeNextAudioPacket returning false due to null context members.");
+        return false;
+    }
+
+    AVPacket* packet = videoCtx.audioPacket;
+    int ret;
+
+    if (videoCtx.seekRequests.load() != videoCtx.seeksCompleted.load()) {
+        return false;   // Silence until the seek lands
+    }
+    if (videoCtx.audioQueue.serial() != videoCtx.audioSerial) {
+        startAudioSerial(videoCtx, videoCtx.audioQueue.serial());   // First call after a seek
+    }
+
+    while (true) {
+        ret = avcodec_receive_frame(videoCtx.audioCodecContext, videoCtx.decodedAudioFrame);
+        if (ret == AVERROR_EOF) {
+            if (!videoCtx.audioFinished.exchange(true)) {
+                logError("FFmpeg: Audio decoder fully flushed, EOF reached.");
+            }
+            return false;
+        }
+        if (ret == AVERROR(EAGAIN)) {
+            // The worker may block here until the demuxer catches up
+            int serial = videoCtx.audioSerial;
+            ret = videoCtx.audioQueue.get(packet, true, &serial);
+            if (ret > 0 && serial != videoCtx.audioSerial) {
+                startAudioSerial(videoCtx, serial);
+            }
+            if (ret == 0 || ret == AVERROR_EXIT) {
+                return false;
+            }
+            if (ret < 0) {
+                if (ret == AVERROR_EOF) {
+                    ret = avcodec_send_packet(videoCtx.audioCodecContext, nullptr);
+                    if (ret < 0) {
+                        char errBuf[AV_ERROR_MAX_STRING_SIZE];
+                        av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
+                        logError("FFmpeg: Error sending NULL flush packet to audio decoder: %s (code %d)", errBuf, ret);
+                        return false;
+                    }
+                    continue;
+                }
+                char errBuf[AV_ERROR_MAX_STRING_SIZE];
+                av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
+                logError("FFmpeg: Audio packet queue error: %s (code %d)", errBuf, ret);
+                return false;
+            }
+
+            ret = avcodec_send_packet(videoCtx.audioCodecContext, packet);
+            av_packet_unref(packet);
+            if (ret < 0 && ret != AVERROR(EAGAIN)) {
+                char errBuf[AV_ERROR_MAX_STRING_SIZE];
+                av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
+                logError("FFmpeg: Error sending audio packet to decoder: %s (code %d)", errBuf, ret);
+                if (ret != AVERROR_INVALIDDATA) return false;
+            }
+            continue;
+        }
+        if (ret < 0) {
+            char errBuf[AV_ERROR_MAX_STRING_SIZE];
+            av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
+            logError("FFmpeg: Error receiving audio frame from decoder: %s (code %d)", errBuf, ret);
+            return false;
+        }
+
+        // Accurate seek or track switch: skip audio that ends before the target
+        double seekPts = std::max(videoCtx.accurateSeekPts.load(), videoCtx.audioResumePts.load());
+        int64_t frameTimestamp = videoCtx.decodedAudioFrame->best_effort_timestamp;
+        if (seekPts >= 0.0 && frameTimestamp != AV_NOPTS_VALUE && videoCtx.decodedAudioFrame->sample_rate > 0) {
+            double frameEnd = frameTimestamp * av_q2d(videoCtx.audioCodecContext->pkt_timebase) +
+                (double)videoCtx.decodedAudioFrame->nb_samples / videoCtx.decodedAudioFrame->sample_rate;
+            if (frameEnd < seekPts) {
+                av_frame_unref(videoCtx.decodedAudioFrame);
+                continue;
+            }
+        }
+
+        // Track the stream position of the chunk we are about to produce
+        AVFrame* decoded = videoCtx.decodedAudioFrame;
+        int64_t audioTimestamp = decoded->best_effort_timestamp;
+        if (audioTimestamp != AV_NOPTS_VALUE) {
+            videoCtx.audioBufferPts = audioTimestamp * av_q2d(videoCtx.audioCodecContext->pkt_timebase);
+        }
+        else {
+            videoCtx.audioBufferPts += videoCtx.audioChunkDuration;
+        }
+        videoCtx.audioChunkDuration = decoded->sample_rate > 0 ? (double)decoded->nb_samples / decoded->sample_rate : 0.0;
+
+        if (decoded->sample_rate != videoCtx.swrInputRate || decoded->format != videoCtx.swrInputFormat ||
+            av_channel_layout_compare(&decoded->ch_layout, &videoCtx.audioChannelLayout) != 0) {
+            logError("FFmpeg: Decoded audio differs from the stream parameters; reconfiguring the resampler.");
+            if (!configureAudioResampler(videoCtx, decoded->sample_rate, static_cast<AVSampleFormat>(decoded->format), &decoded->ch_layout)) {
+                av_frame_unref(decoded);
+                continue;   // Dropped; the next frame tries again
+            }
+        }
+
+        // swr_get_out_samples bounds this call's output, including what swr
+        // still holds from earlier frames, so the convert never truncates
+        int maxFrames = swr_get_out_samples(videoCtx.swrContext, decoded->nb_samples);
+        if (maxFrames < 0 || !reserveAudioBuffers(videoCtx, maxFrames)) {
+            logError("FFmpeg: Could not make room for %d audio frames", maxFrames);
+            av_frame_unref(decoded);
+            return false;
+        }
+        uint8_t* out_buffer_ptr[1] = { reinterpret_cast<uint8_t*>(videoCtx.audioFloatBuffer) };
+        int out_samples = swr_convert(videoCtx.swrContext, out_buffer_ptr, maxFrames,
+            (const uint8_t**)decoded->extended_data, decoded->nb_samples);
+        av_frame_unref(decoded);
+        if (out_samples < 0) {
+            char errBuf[AV_ERROR_MAX_STRING_SIZE];
+            av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, out_samples);
+            logError("FFmpeg: swr_convert error: %s (code %d)", errBuf, out_samples);
+            return false;
+        }
+        return processAudioChunk(videoCtx, out_samples);
+    }
+}
+
+// Audio decode worker: keeps audioRing topped up so the SDL callback never
+// waits on the demuxer, the decoder or the log file. Each serial starts with
+// a discard of whatever the ring still holds and a new clock base, and so
+// does the first chunk stretched for a new playback speed.
+static void audioDecodeThreadMain(VideoContext* videoCtx) {
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+    AudioRing& ring = videoCtx->audioRing;
+    bool needBase = true;
+
+    while (!videoCtx->audioStop.load()) {
+        int serial = videoCtx->audioSerial;
+        bool decoded = decodeNextAudioPacket(*videoCtx);
+        if (videoCtx->audioSerial != serial) needBase = true;
+        if (!decoded) {
+            if (!videoCtx->audioStop.load()) SDL_Delay(5);   // End of stream or seek in flight
+            continue;
+        }
+        if (videoCtx->seekRequests.load() != videoCtx->seeksCompleted.load() || videoCtx->audioBufferSize == 0) {
+            continue;   // Stale; the next serial is on its way
+        }
+        // Speed change: the ring holds audio stretched for the old tempo
+        double tempo = videoCtx->tempoGraph ? videoCtx->tempoRate : 1.0;
+        if (tempo != ring.baseTempo.load()) needBase = true;
+
+        if (needBase) {
+            ring.discard();
+            ring.baseIndex.store(ring.writeIndex.load());
+            // Through atempo, the first sample out is the graph's first sample in
+            ring.basePts.store(videoCtx->tempoGraph ? videoCtx->tempoStartPts : videoCtx->audioBufferPts);
+            ring.baseTempo.store(tempo);
+            ring.primed.store(false);
+            ring.serial.store(videoCtx->audioSerial, std::memory_order_release);
+            needBase = false;
+        }
+
+        const uint8_t* src = videoCtx->audioBuffer;
+        uint32_t left = videoCtx->audioBufferSize;
+        while (left > 0 && !videoCtx->audioStop.load()) {
+            uint32_t written = ring.write(src, left);
+            src += written;
+            left -= written;
+            if (written > 0) ring.primed.store(true);
+            if (left > 0) {
+                if (videoCtx->audioQueue.serial() != videoCtx->audioSerial) break;   // Seek: drop the rest
+                SDL_Delay(5);   // Ring full; the callback frees a buffer's worth every few tens of ms
+            }
+        }
+    }
+}
+
+ 
+
+void toggle_fullscreen(VideoContext& videoCtx, SDL_Window* window, SDL_Renderer* renderer) {
+    videoCtx.is_fullscreen = !videoCtx.is_fullscreen;
+    Uint32 flags = videoCtx.is_fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0;
+    SDL_SetWindowFullscreen(window, flags);
+
+    int screen_width = 0; // Declare screen_width
+    int screen_height = 0; // Declare screenHeight
+
+    SDL_GetWindowSize(window, &screen_width, &screen_height);
+
+    float aspect_ratio = (float)videoCtx.videoCodecContext->width / videoCtx.videoCodecContext->height;
+    int render_width = screen_width;
+    int render_height = (int)(screen_width / aspect_ratio);
+
+    if (render_height > screen_height) {
+        render_height = screen_height;
+        render_width = (int)(screen_height * aspect_ratio);
+    }
+
+    SDL_Rect dst_rect = { (screen_width - render_width) / 2, (screen_height - render_height) / 2, render_width, render_height };
+    SDL_RenderSetViewport(renderer, &dst_rect); // Corrected function
+    logError("SDL: Toggled fullscreen: %s=%s, viewport x=%d, y=%d, w=%d, h=%d",
+        videoCtx.is_fullscreen ? "true" : "false", dst_rect.x, dst_rect.y, dst_rect.w, dst_rect.h);
+}
+
+// Decode the next video frame into videoCtx.decodedFrame.
+// Returns 0 on success, AVERROR_EOF at end of stream, AVERROR_EXIT when the
+// packet queue was aborted, or another negative error code.
+// Send/receive state machine: frames the decoder already has are drained
+// before another packet is sent, so avcodec_send_packet does not return
+// EAGAIN in practice. If it does, the packet stays pending in videoPacket and
+// is resent once a frame has been received. Nothing is allocated per call.
+int decodeVideoFrame(VideoContext& videoCtx) {
+    if (!videoCtx.formatContext || !videoCtx.videoCodecContext || !videoCtx.decodedFrame || !videoCtx.videoPacket) {
+        logError("FFmpeg: Invalid video context for decoding.");
+        return AVERROR(EINVAL);
+    }
+    AVCodecContext* codecContext = videoCtx.videoCodecContext;
+    AVPacket* packet = videoCtx.videoPacket;
+
+    while (true) {
+        int ret = avcodec_receive_frame(codecContext, videoCtx.decodedFrame);
+        if (ret == 0) {
+            return 0;
+        }
+        if (ret == AVERROR_EOF) {
+            logError("FFmpeg: Video decoder flushed, EOF reached.");
+            return AVERROR_EOF;
+        }
+        if (ret != AVERROR(EAGAIN)) {
+            char errBuf[AV_ERROR_MAX_STRING_SIZE];
+            av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
+            logError("FFmpeg: Error receiving video frame from decoder: %s", errBuf);
+            return ret;
+        }
+
+        // The decoder needs input
+        if (!videoCtx.videoPacketPending) {
+            // Runs on the decode worker, so waiting for the demuxer is fine
+            int serial = videoCtx.videoSerial;
+            int got = videoCtx.videoQueue.get(packet, true, &serial);
+            if (got != AVERROR_EXIT && serial != videoCtx.videoSerial) {
+                // First packet after a seek: drop what the decoder still holds
+                avcodec_flush_buffers(codecContext);
+                videoCtx.videoSerial = serial;
+            }
+            if (got == 0) {
+                continue;
+            }
+            if (got < 0) {
+                if (got != AVERROR_EOF) return got;
+                // End of stream: flush the decoder so its buffered frames come out
+                logError("FFmpeg: Video packet queue reached EOF. Draining decoder.");
+                avcodec_send_packet(codecContext, nullptr);
+                videoCtx.videoDraining = true;
+                continue;
+            }
+            videoCtx.videoPacketPending = true;
+        }
+
+        ret = avcodec_send_packet(codecContext, packet);
+        if (ret == AVERROR(EAGAIN)) {
+            continue;   // Keep the packet; receive first
+        }
+        videoCtx.videoPacketPending = false;
+        av_packet_unref(packet);
+        if (ret < 0) {
+            char errBuf[AV_ERROR_MAX_STRING_SIZE];
+            av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
+            logError("FFmpeg: Error sending video packet to decoder: %s", errBuf);
+            if (ret != AVERROR_INVALIDDATA) return ret;
+            // Corrupt packet: skip it and carry on with the next one
+        }
+    }
+}
+
+static int decodeTimeBucket(double ms) {
+    const double limits[VIDEO_DECODE_TIME_BUCKETS - 1] = { 1, 2, 4, 8, 16, 33, 66 };
+    for (int i = 0; i < VIDEO_DECODE_TIME_BUCKETS - 1; i++) {
+        if (ms < limits[i]) return i;
+    }
+    return VIDEO_DECODE_TIME_BUCKETS - 1;
+}
+
+// Like sws_getCachedContext, but with swscale's slice threading: the frame
+// is split into horizontal bands converted on `threads` workers.
+static struct SwsContext* getThreadedSwsContext(struct SwsContext* context,
+    int srcWidth, int srcHeight, AVPixelFormat srcFormat,
+    int dstWidth, int dstHeight, AVPixelFormat dstFormat, int flags, int threads) {
+    if (context) {
+        struct { const char* name; int64_t value; } wanted[] = {
+            { "srcw", srcWidth }, { "srch", srcHeight }, { "src_format", srcFormat },
+            { "dstw", dstWidth }, { "dsth", dstHeight }, { "dst_format", dstFormat },
+            { "sws_flags", flags }, { "threads", threads },
+        };
+        bool same = true;
+        for (const auto& option : wanted) {
+            int64_t value = 0;
+            if (av_opt_get_int(context, option.name, 0, &value) < 0 || value != option.value) {
+                same = false;
+                break;
+            }
+        }
+        if (same) return context;
+        sws_freeContext(context);
+    }
+
+    context = sws_alloc_context();
+    if (!context) return nullptr;
+    av_opt_set_int(context, "srcw", srcWidth, 0);
+    av_opt_set_int(context, "srch", srcHeight, 0);
+    av_opt_set_int(context, "src_format", srcFormat, 0);
+    av_opt_set_int(context, "dstw", dstWidth, 0);
+    av_opt_set_int(context, "dsth", dstHeight, 0);
+    av_opt_set_int(context, "dst_format", dstFormat, 0);
+    av_opt_set_int(context, "sws_flags", flags, 0);
+    av_opt_set_int(context, "threads", threads, 0);
+    if (sws_init_context(context, nullptr, nullptr) < 0) {
+        sws_freeContext(context);
+        return nullptr;
+    }
+    return context;
+}
+
+// Scale/convert src into slot.image at dstWidth x dstHeight. 4:2:0 sources
+// stay YUV (IYUV texture); everything else becomes RGBA.
+static bool convertIntoSlot(struct SwsContext** swsContext, const AVFrame* src, int dstWidth, int dstHeight, int flags,
+    int threads, bool yuvOutput, VideoFrameSlot& slot, std::atomic<uint64_t>& allocations) {
+    AVPixelFormat dstFormat = AV_PIX_FMT_RGBA;
+    if (yuvOutput) {
+        // Keep full-range sources full range so the JPEG matrix still applies
+        dstFormat = src->format == AV_PIX_FMT_YUVJ420P ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_YUV420P;
+    }
+    *swsContext = getThreadedSwsContext(*swsContext,
+        src->width, src->height, static_cast<AVPixelFormat>(src->format),
+        dstWidth, dstHeight, dstFormat, flags, threads);
+    if (!*swsContext) {
+        logError("FFmpeg: ERROR Could not initialize SwsContext for video conversion.");
+        return false;
+    }
+
+    // The slot keeps its buffer until the output size or format changes
+    if (!slot.image) slot.image = av_frame_alloc();
+    if (!slot.image) return false;
+    if (!slot.image->buf[0] || slot.image->width != dstWidth || slot.image->height != dstHeight || slot.image->format != dstFormat) {
+        av_frame_unref(slot.image);
+        slot.image->width = dstWidth;
+        slot.image->height = dstHeight;
+        slot.image->format = dstFormat;
+        if (av_frame_get_buffer(slot.image, 32) < 0) {
+            logError("FFmpeg: ERROR Could not allocate %dx%d video conversion buffer.", dstWidth, dstHeight);
+            return false;
+        }
+        allocations++;
+    }
+
+    int ret = sws_scale_frame(*swsContext, slot.image, src);
+    if (ret < 0) {
+        char errBuf[AV_ERROR_MAX_STRING_SIZE];
+        av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
+        logError("FFmpeg: sws_scale_frame failed: %s", errBuf);
+        return false;
+    }
+    slot.converted = true;
+    slot.width = dstWidth;
+    slot.height = dstHeight;
+    slot.format = yuvOutput ? SDL_PIXELFORMAT_IYUV : SDL_PIXELFORMAT_RGBA32;
+    return true;
+}
+
+// Size a frame is converted to: the on-screen rect when that is smaller than
+// the source (the GPU handles upscaling), kept even for 4:2:0 output.
+static void conversionSize(VideoContext* videoCtx, const AVFrame* frame, int* width, int* height) {
+    int targetWidth = videoCtx->targetWidth.load();
+    int targetHeight = videoCtx->targetHeight.load();
+    if (targetWidth <= 0 || targetHeight <= 0 || targetWidth >= frame->width || targetHeight >= frame->height) {
+        *width = frame->width;
+        *height = frame->height;
+        return;
+    }
+    *width = std::max(2, targetWidth & ~1);
+    *height = std::max(2, targetHeight & ~1);
+}
+
+// Hand a decoded frame to a ring slot. YUV frames shown at source size move
+// their reference in (no copy); anything else is scaled to the display size
+// with a fast swscale filter. The source reference is kept for pause refinement.
+static bool fillFrameSlot(VideoContext* videoCtx, AVFrame* frame, VideoFrameSlot& slot) {
+    Uint32 textureFormat = videoCtx->decoderOptions.yuvTextures ? yuvTextureFormatFor(frame->format) : SDL_PIXELFORMAT_UNKNOWN;
+    int width, height;
+    conversionSize(videoCtx, frame, &width, &height);
+
+    if (textureFormat != SDL_PIXELFORMAT_UNKNOWN && width == frame->width && height == frame->height &&
+        frame->linesize[0] > 0 && frame->linesize[1] > 0) {
+        slot.converted = false;
+        slot.width = frame->width;
+        slot.height = frame->height;
+        slot.format = textureFormat;
+        av_frame_move_ref(slot.frame, frame);
+        return true;
+    }
+
+    // Point sampling when only the pixel format changes, bilinear when scaling
+    int flags = (width == frame->width && height == frame->height) ? SWS_POINT : SWS_FAST_BILINEAR;
+    if (!convertIntoSlot(&videoCtx->swsContext, frame, width, height, flags,
+        convertThreadCount(videoCtx->decoderOptions), textureFormat != SDL_PIXELFORMAT_UNKNOWN, slot, videoCtx->bufferAllocations)) {
+        av_frame_unref(frame);
+        return false;
+    }
+    av_frame_move_ref(slot.frame, frame);
+    return true;
+}
+
+// Decode-ahead worker: decodes into decodedRing for the convert stage.
+// Frames already behind the display clock are dropped here, before
+// conversion, as are frames before an accurate seek target. At end of stream
+// it idles until a seek starts a new serial.
+static void videoDecodeThreadMain(VideoContext* videoCtx) {
+    AVStream* videoStream = videoCtx->formatContext->streams[videoCtx->videoStreamIndex];
+    VideoFrameRing& decoded = videoCtx->decodedRing;
+    double pts = 0.0;
+    double lastKeptPts = 0.0;
+    bool first = true;
+    int frameSerial = videoCtx->videoSerial;
+
+    while (!videoCtx->decodeStop.load()) {
+        // Sped up past the display rate: B-frames nothing refers to would
+        // mostly be thinned anyway, so do not decode them at all
+        double speed = videoCtx->playbackSpeed.load();
+        AVDiscard skip = (speed > 1.0 && speed / videoCtx->frameDuration > SPEED_DISPLAY_HZ) ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+        if (videoCtx->videoCodecContext->skip_frame != skip) videoCtx->videoCodecContext->skip_frame = skip;
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        int ret = decodeVideoFrame(*videoCtx);
+        if (ret == AVERROR_EOF) {
+            int eofSerial = videoCtx->videoSerial;
+            videoCtx->videoEofSerial.store(eofSerial);
+            while (!videoCtx->decodeStop.load() && videoCtx->videoQueue.serial() == eofSerial) {
+                SDL_Delay(5);
+            }
+            // A drained decoder only accepts packets again after a flush
+            avcodec_flush_buffers(videoCtx->videoCodecContext);
+            videoCtx->videoDraining = false;
+            continue;
+        }
+        if (ret < 0) {
+            if (ret != AVERROR_EXIT) logError("FFmpeg: Video decode worker finished (%d).", ret);
+            break;
+        }
+        videoCtx->decodedFrameCount++;
+        videoCtx->decodeTicks += SDL_GetPerformanceCounter() - start;
+        double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+        videoCtx->decodeTimeHistogram[decodeTimeBucket(ms)]++;
+
+        if (videoCtx->videoSerial != frameSerial) {
+            // First frame after a seek: timestamps restart and nothing is late yet
+            frameSerial = videoCtx->videoSerial;
+            first = true;
+        }
+
+        int64_t timestamp = videoCtx->decodedFrame->best_effort_timestamp;
+        if (timestamp != AV_NOPTS_VALUE) {
+            pts = timestamp * av_q2d(videoStream->time_base);
+        }
+        else if (!first) {
+            pts += videoCtx->frameDuration;
+        }
+
+        double seekPts = videoCtx->accurateSeekPts.load();
+        if (seekPts >= 0.0 && pts + videoCtx->frameDuration * 0.5 < seekPts) {
+            videoCtx->seekDecodedFrames++;
+            av_frame_unref(videoCtx->decodedFrame);
+            continue;
+        }
+
+        if (!first && videoCtx->fixedClockStep <= 0.0 &&
+            pts < videoCtx->displayClock.load() - 2.0 * videoCtx->frameDuration) {
+            videoCtx->droppedFrames++;
+            av_frame_unref(videoCtx->decodedFrame);
+            continue;
+        }
+        // Above 1x, keep at most one frame per display refresh; the rest are
+        // never converted
+        if (!first && speed > 1.0 && pts - lastKeptPts < speed / SPEED_DISPLAY_HZ - 0.5 * videoCtx->frameDuration) {
+            videoCtx->thinnedFrames++;
+            av_frame_unref(videoCtx->decodedFrame);
+            continue;
+        }
+        first = false;
+        lastKeptPts = pts;
+
+        // Wait for the convert stage to free a slot
+        while (decoded.occupancy() >= VIDEO_FRAME_RING_SIZE && !videoCtx->decodeStop.load()) {
+            SDL_Delay(1);
+        }
+        if (videoCtx->decodeStop.load()) break;
+
+        uint32_t write = decoded.writeIndex.load(std::memory_order_relaxed);
+        VideoFrameSlot& slot = decoded.slots[write % VIDEO_FRAME_RING_SIZE];
+        av_frame_move_ref(slot.frame, videoCtx->decodedFrame);
+        slot.pts = pts;
+        slot.serial = frameSerial;
+        decoded.writeIndex.store(write + 1, std::memory_order_release);
+    }
+
+    videoCtx->decodeDone.store(true);
+}
+
+// Convert stage: scales/converts decodedRing frames into frameRing while the
+// decode worker is already on the next frame. Frames from before a seek are
+// released without conversion.
+static void videoConvertThreadMain(VideoContext* videoCtx) {
+    VideoFrameRing& decoded = videoCtx->decodedRing;
+    VideoFrameRing& ring = videoCtx->frameRing;
+    int lastWidth = 0, lastHeight = 0;
+
+    while (!videoCtx->decodeStop.load()) {
+        if (decoded.occupancy() == 0) {
+            if (videoCtx->decodeDone.load() && decoded.occupancy() == 0) break;
+            SDL_Delay(1);
+            continue;
+        }
+
+        uint32_t read = decoded.readIndex.load(std::memory_order_relaxed);
+        VideoFrameSlot& source = decoded.slots[read % VIDEO_FRAME_RING_SIZE];
+        if (source.serial != videoCtx->videoQueue.serial() || videoCtx->seekRequests.load() != videoCtx->seeksCompleted.load()) {
+            av_frame_unref(source.frame);
+            decoded.readIndex.store(read + 1, std::memory_order_release);
+            continue;
+        }
+
+        // Wait for the render loop to free a slot
+        while (ring.occupancy() >= VIDEO_FRAME_RING_SIZE && !videoCtx->decodeStop.load()) {
+            SDL_Delay(1);
+        }
+        if (videoCtx->decodeStop.load()) break;
+
+        uint32_t write = ring.writeIndex.load(std::memory_order_relaxed);
+        VideoFrameSlot& slot = ring.slots[write % VIDEO_FRAME_RING_SIZE];
+
+        Uint64 convertStart = SDL_GetPerformanceCounter();
+        if (!fillFrameSlot(videoCtx, source.frame, slot)) {
+            decoded.readIndex.store(read + 1, std::memory_order_release);
+            break;
+        }
+        videoCtx->convertTicks += SDL_GetPerformanceCounter() - convertStart;
+        videoCtx->convertedFrameCount++;
+        if (slot.width != lastWidth || slot.height != lastHeight) {
+            logError("FFmpeg: Video frames %dx%d shown as %dx%d %s%s.", slot.frame->width, slot.frame->height,
+                slot.width, slot.height, SDL_GetPixelFormatName(slot.format),
+                slot.converted ? (convertThreadCount(videoCtx->decoderOptions) > 1 ? " (sliced swscale)" : " (swscale)") : "");
+            lastWidth = slot.width;
+            lastHeight = slot.height;
+        }
+        slot.pts = source.pts;
+        slot.serial = source.serial;
+        // Publish before releasing the source so the frame is never in neither ring
+        ring.writeIndex.store(write + 1, std::memory_order_release);
+        decoded.readIndex.store(read + 1, std::memory_order_release);
+    }
+
+    videoCtx->decodeFinished.store(true);
+}
+
+// Upload a slot to the video texture, recreating it when the size or format changes
+static bool uploadVideoFrame(VideoContext& videoCtx, const VideoFrameSlot& slot, SDL_Texture** videoTexture, SDL_Renderer* renderer) {
+    if (!renderer || !videoTexture) {
+        return true;
+    }
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    if (*videoTexture == nullptr ||
+        [&]() {
+            Uint32 format;
+            int w, h;
+            SDL_QueryTexture(*videoTexture, &format, nullptr, &w, &h);
+            return w != slot.width || h != slot.height || format != slot.format;
+        }()) {
+        if (*videoTexture) SDL_DestroyTexture(*videoTexture);
+        // The YUV->RGB matrix is fixed when the texture is created
+        if (!slot.converted) videoCtx.yuvConversionMode = yuvConversionModeFor(slot.frame);
+        SDL_SetYUVConversionMode(videoCtx.yuvConversionMode);
+        *videoTexture = SDL_CreateTexture(renderer, slot.format,
+            SDL_TEXTUREACCESS_STREAMING, slot.width, slot.height);
+        if (!*videoTexture) {
+            logError("FFmpeg: Failed to create %s SDL_Texture for video: %s", SDL_GetPixelFormatName(slot.format), SDL_GetError());
+            return false;
+        }
+    }
+
+    int result;
+    const uint8_t* const* planes = slot.converted ? slot.image->data : slot.frame->data;
+    const int* pitches = slot.converted ? slot.image->linesize : slot.frame->linesize;
+    if (slot.format == SDL_PIXELFORMAT_IYUV) {
+        result = SDL_UpdateYUVTexture(*videoTexture, nullptr,
+            planes[0], pitches[0], planes[1], pitches[1], planes[2], pitches[2]);
+    }
+    else if (slot.format == SDL_PIXELFORMAT_NV12 || slot.format == SDL_PIXELFORMAT_NV21) {
+        result = SDL_UpdateNVTexture(*videoTexture, nullptr, planes[0], pitches[0], planes[1], pitches[1]);
+    }
+    else {
+        result = SDL_UpdateTexture(*videoTexture, nullptr, planes[0], pitches[0]);
+    }
+    if (result != 0) {
+        logError("FFmpeg: Failed to update SDL_Texture for video: %s", SDL_GetError());
+    }
+
+    videoCtx.uploadTicks += SDL_GetPerformanceCounter() - start;
+    videoCtx.uploadedFrames++;
+    return true;
+}
+
+// Current playback position in seconds
+double getMasterClock(VideoContext& videoCtx) {
+    if (videoCtx.paused.load()) {
+        return videoCtx.pausedClock;
+    }
+    if (videoCtx.fixedClockStep > 0.0) {
+        return videoCtx.fixedClock;
+    }
+    double speed = videoCtx.playbackSpeed.load();
+    if (videoCtx.audioEnabled && videoCtx.audioClockValid.load()) {
+        // Extrapolate from the last audio callback
+        Uint64 elapsed = SDL_GetPerformanceCounter() - videoCtx.audioClockCounter.load();
+        return videoCtx.audioClockPts.load() + speed * (double)elapsed / (double)SDL_GetPerformanceFrequency();
+    }
+    if (videoCtx.wallClockStart == 0) {
+        return 0.0;
+    }
+    Uint64 elapsed = SDL_GetPerformanceCounter() - videoCtx.wallClockStart;
+    return videoCtx.wallClockStartPts + speed * (double)elapsed / (double)SDL_GetPerformanceFrequency();
+}
+
+// On-screen size of the video rect in output pixels; the convert worker picks
+// it up with the next frame, and getThreadedSwsContext rebuilds on change
+void setVideoTargetSize(VideoContext& videoCtx, int width, int height) {
+    videoCtx.targetWidth.store(width);
+    videoCtx.targetHeight.store(height);
+}
+
+// Freeze or resume the master clock. The audio callback mixes nothing while
+// paused. Resuming restarts every clock source from the paused position.
+void setVideoPaused(VideoContext& videoCtx, bool paused) {
+    if (videoCtx.paused.load() == paused) return;
+
+    if (paused) {
+        videoCtx.pausedClock = getMasterClock(videoCtx);
+        videoCtx.paused.store(true);
+        videoCtx.refined = false;
+        logError("FFmpeg: Video paused at %.3f s.", videoCtx.pausedClock);
+        return;
+    }
+
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (videoCtx.wallClockStart != 0) {
+        videoCtx.wallClockStart = now;
+        videoCtx.wallClockStartPts = videoCtx.pausedClock;
+    }
+    videoCtx.audioClockPts.store(videoCtx.pausedClock);
+    videoCtx.audioClockCounter.store(now);
+    videoCtx.fixedClock = videoCtx.pausedClock;
+    videoCtx.paused.store(false);
+    logError("FFmpeg: Video resumed at %.3f s.", videoCtx.pausedClock);
+}
+
+// While paused, re-convert the frame on screen once with a high-quality filter
+// (playback uses the fast one). Nothing to do when it was shown unscaled.
+static void refinePausedFrame(VideoContext& videoCtx, SDL_Texture** videoTexture, SDL_Renderer* renderer) {
+    videoCtx.refined = true;
+    const AVFrame* frame = videoCtx.shownFrame;
+    if (!frame || !frame->data[0] || !renderer || !videoTexture || !*videoTexture) return;
+
+    Uint32 textureFormat = videoCtx.decoderOptions.yuvTextures ? yuvTextureFormatFor(frame->format) : SDL_PIXELFORMAT_UNKNOWN;
+    int width, height;
+    conversionSize(&videoCtx, frame, &width, &height);
+    if (width == frame->width && height == frame->height) return;
+
+    if (convertIntoSlot(&videoCtx.refineSwsContext, frame, width, height, SWS_LANCZOS | SWS_ACCURATE_RND,
+        convertThreadCount(videoCtx.decoderOptions), textureFormat != SDL_PIXELFORMAT_UNKNOWN, videoCtx.refineSlot, videoCtx.bufferAllocations)) {
+        uploadVideoFrame(videoCtx, videoCtx.refineSlot, videoTexture, renderer);
+    }
+}
+
+// Show the frame due at the current master clock from the decode-ahead ring.
+// Early frames stay queued (the current texture is repeated); frames late by
+// more than a frame duration are dropped while a newer one is waiting.
+// Returns false once the worker has finished and the ring is empty.
+bool updateVideoPlayback(VideoContext& videoCtx, SDL_Texture** videoTexture, SDL_Renderer* renderer) {
+    if (!videoCtx.formatContext || !videoCtx.videoCodecContext) {
+        return false;
     }
 
-    av_frame_free(&videoCtx.decodedAudioFrame);
-    av_packet_free(&videoCtx.audioPacket);
-    av_free(videoCtx.audioBuffer);
-    videoCtx.audioBuffer = nullptr;
-    videoCtx.audioBufferSize = 0;
-    videoCtx.audioBufferPos = 0;
-    videoCtx.audioBufferAllocatedSize = 0;
+    if (videoCtx.streamInfoReady.exchange(false)) {
+        // Background analysis finished (fast start)
+        if (videoCtx.analyzedDuration.load() > 0.0) videoCtx.duration = videoCtx.analyzedDuration.load();
+        videoCtx.startTime = videoCtx.analyzedStartTime.load();
+    }
 
-    swr_free(&videoCtx.swrContext);
-    av_frame_free(&videoCtx.decodedFrame);
-    av_frame_free(&videoCtx.rgbFrame);
-    av_free(videoCtx.rgbBuffer);
-    videoCtx.rgbBuffer = nullptr;
-    sws_freeContext(videoCtx.swsContext);
-    avcodec_free_context(&videoCtx.videoCodecContext);
-    avcodec_free_context(&videoCtx.audioCodecContext);
-    avformat_close_input(&videoCtx.formatContext);
-    av_channel_layout_uninit(&videoCtx.audioChannelLayout);
+    // Release frames decoded before the latest seek. Until the demuxer has
+    // carried the seek out, everything in the pipeline predates it.
+    VideoFrameRing& ring = videoCtx.frameRing;
+    bool seekInFlight = videoCtx.seekRequests.load() != videoCtx.seeksCompleted.load();
+    int serial = videoCtx.videoQueue.serial();
+    while (ring.occupancy() > 0) {
+        uint32_t read = ring.readIndex.load(std::memory_order_relaxed);
+        VideoFrameSlot& slot = ring.slots[read % VIDEO_FRAME_RING_SIZE];
+        if (slot.serial == serial && !seekInFlight) break;
+        av_frame_unref(slot.frame);
+        ring.readIndex.store(read + 1, std::memory_order_release);
+    }
+    if (seekInFlight) {
+        return true;
+    }
 
-    videoCtx.formatContext = nullptr;
-    videoCtx.videoCodecContext = nullptr;
-    videoCtx.audioCodecContext = nullptr;
-    videoCtx.videoStreamIndex = -1;
-    videoCtx.audioStreamIndex = -1;
-    videoCtx.swsContext = nullptr;
-    videoCtx.decodedFrame = nullptr;
-    videoCtx.rgbFrame = nullptr;
-    videoCtx.audioPacket = nullptr;
-    videoCtx.decodedAudioFrame = nullptr;
+    // Paused: keep the frame, unless a seek needs its first frame shown
+    bool paused = videoCtx.paused.load();
+    if (paused && videoCtx.hasShownFrame) {
+        if (!videoCtx.refined) refinePausedFrame(videoCtx, videoTexture, renderer);
+        return true;
+    }
 
-    logError("FFmpeg: Video file closed and context reset.");
-}
+    auto reachedEnd = [&]() {
+        return videoCtx.decodeFinished.load() ||
+            (videoCtx.videoEofSerial.load() == serial && videoCtx.decodedRing.occupancy() == 0 && ring.occupancy() == 0);
+    };
+    if (videoCtx.fixedClockStep > 0.0) {
+        // Headless: wait for the worker so every run shows the same frames
+        while (ring.occupancy() == 0 && !reachedEnd()) {
+            SDL_Delay(1);
+        }
+    }
 
-bool decodeNextAudioPacket(VideoContext& videoCtx) {
-    logError("FFmpeg: decodeNextAudioPacket entered. Audio Buffer Size: %u, Pos: %u, Allocated: %u", videoCtx.audioBufferSize, videoCtx.audioBufferPos, videoCtx.audioBufferAllocatedSize);
-    if (!videoCtx.formatContext || !videoCtx.audioCodecContext || !videoCtx.audioPacket || !videoCtx.decodedAudioFrame || !videoCtx.audioBuffer) {
-        logError("FFmpeg: decodeNextAudioPacket returning false due to null context members.");
-        return false;
+    int occupancy = ring.occupancy();
+    videoCtx.ringOccupancyHistogram[occupancy]++;
+    if (occupancy == 0) {
+        if (reachedEnd()) {
+            return false;
+        }
+        // Worker behind: keep the current frame on screen
+        if (videoCtx.hasShownFrame) videoCtx.repeatedFrames++;
+        return true;
     }
 
-    AVPacket* packet = videoCtx.audioPacket;
-    int ret;
+    uint32_t read = ring.readIndex.load(std::memory_order_relaxed);
+    if (!videoCtx.hasShownFrame && videoCtx.wallClockStart == 0) {
+        // First frame starts the fallback wall clock
+        double firstPts = ring.slots[read % VIDEO_FRAME_RING_SIZE].pts;
+        videoCtx.wallClockStart = SDL_GetPerformanceCounter();
+        videoCtx.wallClockStartPts = firstPts;
+        videoCtx.fixedClock = firstPts;
+        if (paused) videoCtx.pausedClock = firstPts;
+    }
 
-    while (true) {
-        ret = avcodec_receive_frame(videoCtx.audioCodecContext, videoCtx.decodedAudioFrame);
-        if (ret == 0) {
-            logError("FFmpeg: Successfully received audio frame (prior to reading new packet).");
-        }
-        else if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-            if (ret == AVERROR_EOF) {
-                logError("FFmpeg: avcodec_receive_frame returned AVERROR_EOF before reading new packet. Decoder fully flushed.");
-                return false;
-            }
+    double clock = getMasterClock(videoCtx);
+    videoCtx.displayClock.store(clock);
 
-            logError("FFmpeg: avcodec_receive_frame returned EAGAIN. Attempting to read new packet.");
-            av_packet_unref(packet);
-            ret = av_read_frame(videoCtx.formatContext, packet);
-            if (ret < 0) {
-                if (ret == AVERROR_EOF) {
-                    logError("FFmpeg: av_read_frame reached EOF (audio). Sending NULL packet to flush decoder.");
-                    ret = avcodec_send_packet(videoCtx.audioCodecContext, nullptr);
-                    if (ret < 0) {
-                        char errBuf[AV_ERROR_MAX_STRING_SIZE];
-                        av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
-                        logError("FFmpeg: Error sending NULL flush packet to audio decoder: %s (code %d)", errBuf, ret);
-                        return false;
-                    }
-                    continue;
-                }
-                else {
-                    char errBuf[AV_ERROR_MAX_STRING_SIZE];
-                    av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
-                    logError("FFmpeg: av_read_frame error (audio): %s (code %d)", errBuf, ret);
-                    return false;
-                }
-            }
+    while (ring.occupancy() > 0) {
+        read = ring.readIndex.load(std::memory_order_relaxed);
+        VideoFrameSlot& slot = ring.slots[read % VIDEO_FRAME_RING_SIZE];
+        double diff = slot.pts - clock;
 
-            if (packet->stream_index != videoCtx.audioStreamIndex) {
-                av_packet_unref(packet);
-                continue;
-            }
+        if (videoCtx.hasShownFrame && diff > 0.0) {
+            // Not due yet: keep showing the current frame
+            videoCtx.repeatedFrames++;
+            break;
+        }
 
-            logError("FFmpeg: Processing an audio packet from stream %d. Size: %d, PTS: %lld", packet->stream_index, packet->size, packet->pts);
-            ret = avcodec_send_packet(videoCtx.audioCodecContext, packet);
-            if (ret < 0) {
-                char errBuf[AV_ERROR_MAX_STRING_SIZE];
-                av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
-                logError("FFmpeg: Error sending audio packet to decoder: %s (code %d)", errBuf, ret);
-                av_packet_unref(packet);
-                if (ret == AVERROR(EAGAIN)) {
-                    logError("FFmpeg: avcodec_send_packet returned EAGAIN unexpectedly, continuing.");
-                    continue;
-                }
-                return false;
-            }
-            av_packet_unref(packet);
+        if (videoCtx.hasShownFrame && diff < -videoCtx.frameDuration && ring.occupancy() > 1) {
+            videoCtx.droppedFrames++;
+            av_frame_unref(slot.frame);
+            ring.readIndex.store(read + 1, std::memory_order_release);
             continue;
         }
-        else {
-            char errBuf[AV_ERROR_MAX_STRING_SIZE];
-            av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
-            logError("FFmpeg: Error receiving audio frame from decoder: %s (code %d)", errBuf, ret);
+
+        bool uploaded = uploadVideoFrame(videoCtx, slot, videoTexture, renderer);
+        av_frame_unref(videoCtx.shownFrame);
+        av_frame_move_ref(videoCtx.shownFrame, slot.frame);
+        ring.readIndex.store(read + 1, std::memory_order_release);
+        if (!uploaded) {
             return false;
         }
+        videoCtx.clockDrift = diff;
+        videoCtx.presentedFrames++;
+        videoCtx.hasShownFrame = true;
+        videoCtx.refined = false;
+
+        if (videoCtx.presentedFrames == 1 && videoCtx.openStartCounter != 0) {
+            videoCtx.timeToFirstFrameMs = (double)(SDL_GetPerformanceCounter() - videoCtx.openStartCounter) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+            logError("FFmpeg: First frame on screen %.1f ms after open (%s).", videoCtx.timeToFirstFrameMs,
+                videoCtx.decoderOptions.fastStart ? "fast start" : "full probe");
+        }
 
-        uint8_t* out_buffer_ptr[1] = { videoCtx.audioBuffer };
-        int out_samples = 0;
+        if (videoCtx.seekPending) {
+            // Seek latency: request to first frame of the new position on screen
+            videoCtx.seekPending = false;
+            videoCtx.lastSeekMs = (double)(SDL_GetPerformanceCounter() - videoCtx.seekStartCounter) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+            int forward = videoCtx.seekDecodedFrames.load();
+            videoCtx.seekCount++;
+            videoCtx.seekLatencyTotalMs += videoCtx.lastSeekMs;
+            videoCtx.seekDecodedTotal += forward;
+            if (videoCtx.lastSeekMs > videoCtx.seekLatencyMaxMs) videoCtx.seekLatencyMaxMs = videoCtx.lastSeekMs;
+            logError("FFmpeg: Seek landed at %.3f s in %.1f ms (%d frames decoded forward from the keyframe).",
+                slot.pts, videoCtx.lastSeekMs, forward);
+        }
+        break;
+    }
 
-        if (videoCtx.swrContext) {
-            logError("FFmpeg: swr_convert input: nb_samples=%d, sample_rate=%d, format=%s, ch_layout_nb_channels=%d",
-                videoCtx.decodedAudioFrame->nb_samples, videoCtx.decodedAudioFrame->sample_rate,
-                av_get_sample_fmt_name(static_cast<AVSampleFormat>(videoCtx.decodedAudioFrame->format)),
-                videoCtx.decodedAudioFrame->ch_layout.nb_channels);
+    if (videoCtx.fixedClockStep > 0.0 && !paused) {
+        videoCtx.fixedClock += videoCtx.fixedClockStep * videoCtx.playbackSpeed.load();
+    }
+    return true;
+}
 
-            int max_out_samples = av_rescale_rnd(videoCtx.decodedAudioFrame->nb_samples, videoCtx.obtainedAudioSpec.freq, videoCtx.decodedAudioFrame->sample_rate, AV_ROUND_UP);
-            uint32_t required_buffer_size = static_cast<uint32_t>(max_out_samples * videoCtx.obtainedAudioSpec.channels * 2);
+// Seek to `seconds` (stream time). Accurate seeks show the frame at the
+// target; otherwise the keyframe before it (cheap, for scrubbing). Returns
+// immediately; the demux thread does the work.
+void seekVideo(VideoContext& videoCtx, double seconds, bool accurate) {
+    if (!videoCtx.formatContext || (videoCtx.videoStreamIndex < 0 && videoCtx.audioStreamIndex < 0)) return;
 
-            if (videoCtx.audioBufferAllocatedSize < required_buffer_size) {
-                logError("FFmpeg: Reallocating audioBuffer. Old size: %u, New size: %u", videoCtx.audioBufferAllocatedSize, required_buffer_size);
-                av_free(videoCtx.audioBuffer);
-                videoCtx.audioBuffer = static_cast<uint8_t*>(av_malloc(required_buffer_size));
-                if (!videoCtx.audioBuffer) {
-                    logError("FFmpeg: Failed to reallocate audio buffer");
-                    videoCtx.audioBufferAllocatedSize = 0;
-                    return false;
-                }
-                videoCtx.audioBufferAllocatedSize = required_buffer_size;
-            }
+    double end = videoCtx.startTime + videoCtx.duration;
+    if (videoCtx.duration > 0.0 && seconds > end) seconds = end;
+    if (seconds < videoCtx.startTime) seconds = videoCtx.startTime;
 
-            out_samples = swr_convert(videoCtx.swrContext, out_buffer_ptr, max_out_samples,
-                (const uint8_t**)videoCtx.decodedAudioFrame->extended_data, videoCtx.decodedAudioFrame->nb_samples);
+    if (!videoCtx.keyframeThread.joinable() && videoCtx.videoStreamIndex >= 0) {
+        videoCtx.keyframeThread = std::thread(keyframeIndexThreadMain, &videoCtx, videoCtx.sourcePath, videoCtx.videoStreamIndex);
+    }
 
-            if (out_samples < 0) {
-                char errBuf[AV_ERROR_MAX_STRING_SIZE];
-                av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, out_samples);
-                logError("FFmpeg: swr_convert error: %s (code %d)", errBuf, out_samples);
-                return false;
-            }
-            videoCtx.audioBufferSize = out_samples * videoCtx.obtainedAudioSpec.channels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
-            logError("FFmpeg: swr_convert output: %d samples, calculated audioBufferSize: %u", out_samples, videoCtx.audioBufferSize);
-        }
-        else {
-            int data_size = av_samples_get_buffer_size(nullptr, videoCtx.decodedAudioFrame->ch_layout.nb_channels,
-                videoCtx.decodedAudioFrame->nb_samples, static_cast<AVSampleFormat>(videoCtx.decodedAudioFrame->format), 1);
-            logError("FFmpeg: Direct copy attempt. Calculated data_size: %d, channels: %d, samples: %d, format: %s",
-                data_size, videoCtx.decodedAudioFrame->ch_layout.nb_channels, videoCtx.decodedAudioFrame->nb_samples,
-                av_get_sample_fmt_name(static_cast<AVSampleFormat>(videoCtx.decodedAudioFrame->format)));
-
-            if (data_size > 0 && static_cast<uint32_t>(data_size) <= videoCtx.audioBufferAllocatedSize &&
-                videoCtx.decodedAudioFrame->format == AV_SAMPLE_FMT_S16 &&
-                videoCtx.decodedAudioFrame->ch_layout.nb_channels == videoCtx.obtainedAudioSpec.channels &&
-                videoCtx.decodedAudioFrame->sample_rate == videoCtx.obtainedAudioSpec.freq) {
-                memcpy(videoCtx.audioBuffer, videoCtx.decodedAudioFrame->data[0], data_size);
-                videoCtx.audioBufferSize = data_size;
-            }
-            else {
-                logError("FFmpeg: Cannot copy audio directly. Format mismatch or buffer too small. Decoded: format=%s, channels=%d, rate=%d. SDL: format=AUDIO_S16SYS, channels=%d, rate=%d",
-                    av_get_sample_fmt_name(static_cast<AVSampleFormat>(videoCtx.decodedAudioFrame->format)),
-                    videoCtx.decodedAudioFrame->ch_layout.nb_channels, videoCtx.decodedAudioFrame->sample_rate,
-                    videoCtx.obtainedAudioSpec.channels, videoCtx.obtainedAudioSpec.freq);
-                videoCtx.audioBufferSize = 0;
-            }
-        }
+    videoCtx.seekTarget.store(seconds);
+    videoCtx.seekAccurate.store(accurate);
+    videoCtx.seekRequests++;
+    // Drop queued packets now; this also wakes a demuxer blocked on a full queue
+    videoCtx.videoQueue.flush();
+    videoCtx.audioQueue.flush();
+
+    videoCtx.displayClock.store(seconds);
+    videoCtx.audioClockValid.store(false);
+    videoCtx.hasShownFrame = false;
+    videoCtx.wallClockStart = 0;
+    videoCtx.fixedClock = seconds;
+    videoCtx.pausedClock = seconds;
+    videoCtx.seekDecodedFrames.store(0);
+    videoCtx.seekStartCounter = SDL_GetPerformanceCounter();
+    videoCtx.seekPending = true;
+}
 
-        videoCtx.audioBufferPos = 0;
-        av_frame_unref(videoCtx.decodedAudioFrame);
-        logError("FFmpeg: decodeNextAudioPacket returning true (successfully decoded and processed a frame). audioBufferSize: %u", videoCtx.audioBufferSize);
-        return true;
+// Change the playback speed, keeping the current position. Only the clock is
+// rebased here; the audio thread rebuilds atempo on its next chunk and drops
+// what the ring still holds for the old speed, so the demuxer and the video
+// pipeline carry on untouched.
+void setVideoSpeed(VideoContext& videoCtx, double speed) {
+    speed = std::max(MIN_PLAYBACK_SPEED, std::min(speed, MAX_PLAYBACK_SPEED));
+    if (speed == videoCtx.playbackSpeed.load()) return;
+    if (!videoCtx.formatContext) {
+        videoCtx.playbackSpeed.store(speed);   // Applies to the next file
+        return;
     }
-    logError("FFmpeg: decodeNextAudioPacket returning false (exited loop unexpectedly).");
-    return false;
+    double clock = getMasterClock(videoCtx);
+    if (videoCtx.wallClockStart != 0) {
+        videoCtx.wallClockStart = SDL_GetPerformanceCounter();
+        videoCtx.wallClockStartPts = clock;
+    }
+    videoCtx.playbackSpeed.store(speed);
+    logError("FFmpeg: Playback speed %.2fx at %.3f s.", speed, clock);
 }
 
- 
+void setVideoVolume(VideoContext& videoCtx, float volume) {
+    videoCtx.volume.store(std::max(0.0f, std::min(volume, 1.0f)));
+}
 
-void toggle_fullscreen(VideoContext& videoCtx, SDL_Window* window, SDL_Renderer* renderer) {
-    videoCtx.is_fullscreen = !videoCtx.is_fullscreen;
-    Uint32 flags = videoCtx.is_fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0;
-    SDL_SetWindowFullscreen(window, flags);
+static bool isTrackOfType(const VideoContext& videoCtx, int streamIndex, AVMediaType type) {
+    for (const MediaTrack& track : videoCtx.tracks) {
+        if (track.streamIndex == streamIndex) return track.type == type;
+    }
+    return false;
+}
 
-    int screen_width = 0; // Declare screen_width
-    int screen_height = 0; // Declare screenHeight
+// The switch starts at the current position; video is not interrupted, the
+// new audio comes in after a short gap (the demuxer re-reads from the
+// keyframe before this point) and the clock coasts across it
+bool selectAudioTrack(VideoContext& videoCtx, int streamIndex) {
+    if (!videoCtx.formatContext || videoCtx.audioOnly || !videoCtx.audioEnabled) return false;
+    if (!isTrackOfType(videoCtx, streamIndex, AVMEDIA_TYPE_AUDIO)) return false;
+    videoCtx.trackSwitchClock.store(getMasterClock(videoCtx));
+    videoCtx.requestedAudioTrack.store(streamIndex);
+    return true;
+}
 
-    SDL_GetWindowSize(window, &screen_width, &screen_height);
+bool selectSubtitleTrack(VideoContext& videoCtx, int streamIndex) {
+    if (!videoCtx.formatContext || videoCtx.audioOnly) return false;
+    if (streamIndex != -1 && !isTrackOfType(videoCtx, streamIndex, AVMEDIA_TYPE_SUBTITLE)) return false;
+    videoCtx.trackSwitchClock.store(getMasterClock(videoCtx));
+    videoCtx.requestedSubtitleTrack.store(streamIndex == -1 ? -2 : streamIndex);
+    return true;
+}
 
-    float aspect_ratio = (float)videoCtx.videoCodecContext->width / videoCtx.videoCodecContext->height;
-    int render_width = screen_width;
-    int render_height = (int)(screen_width / aspect_ratio);
+std::string describeMediaTrack(const MediaTrack& track) {
+    std::string text = track.language.empty() ? "und" : track.language;
+    text += " " + track.codec;
+    if (track.type == AVMEDIA_TYPE_AUDIO && track.channels > 0) text += " " + std::to_string(track.channels) + "ch";
+    if (track.type == AVMEDIA_TYPE_VIDEO && track.width > 0) text += " " + std::to_string(track.width) + "x" + std::to_string(track.height);
+    if (!track.title.empty()) text += " \"" + track.title + "\"";
+    return text;
+}
 
-    if (render_height > screen_height) {
-        render_height = screen_height;
-        render_width = (int)(screen_height * aspect_ratio);
+// Decode one frame from the keyframe packet at or after the demuxer position.
+// The packet is sent on its own and the decoder drained, so no reordering
+// delay holds the frame back; the decoder is flushed for the next seek.
+static bool decodePreviewKeyframe(AVFormatContext* formatContext, AVCodecContext* codecContext, int streamIndex,
+    AVPacket* packet, AVFrame* frame) {
+    const int maxPackets = 256;     // Give up on this position rather than scan the file
+    bool decoded = false;
+    for (int i = 0; i < maxPackets && !decoded; i++) {
+        if (av_read_frame(formatContext, packet) < 0) break;
+        bool keyframe = packet->stream_index == streamIndex && (packet->flags & AV_PKT_FLAG_KEY);
+        if (keyframe && avcodec_send_packet(codecContext, packet) >= 0) {
+            avcodec_send_packet(codecContext, nullptr);
+            decoded = avcodec_receive_frame(codecContext, frame) == 0;
+            avcodec_flush_buffers(codecContext);
+        }
+        av_packet_unref(packet);
     }
-
-    SDL_Rect dst_rect = { (screen_width - render_width) / 2, (screen_height - render_height) / 2, render_width, render_height };
-    SDL_RenderSetViewport(renderer, &dst_rect); // Corrected function
-    logError("SDL: Toggled fullscreen: %s=%s, viewport x=%d, y=%d, w=%d, h=%d",
-        videoCtx.is_fullscreen ? "true" : "false", dst_rect.x, dst_rect.y, dst_rect.w, dst_rect.h);
+    return decoded;
 }
 
-bool decodeVideoFrame(VideoContext& videoCtx, SDL_Texture** videoTexture, SDL_Renderer* renderer) {
-    if (!videoCtx.formatContext || !videoCtx.videoCodecContext || !videoCtx.swsContext) {
-        logError("FFmpeg: Invalid video context for decoding.");
+bool extractVideoPreview(const char* filePath, int count, int maxWidth, std::vector<ImageData>& frames) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    AVFormatContext* formatContext = nullptr;
+    if (avformat_open_input(&formatContext, filePath, nullptr, nullptr) != 0) {
+        logError("FFmpeg: Preview could not open %s", filePath);
         return false;
     }
-
-    AVPacket* packet = av_packet_alloc();
-    if (!packet) {
-        logError("FFmpeg: Failed to allocate AVPacket.");
+    const AVCodec* codec = nullptr;
+    int streamIndex = -1;
+    if (avformat_find_stream_info(formatContext, nullptr) >= 0) {
+        streamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    }
+    if (streamIndex < 0 || !codec) {
+        logError("FFmpeg: Preview found no video stream in %s", filePath);
+        avformat_close_input(&formatContext);
         return false;
     }
+    AVStream* stream = formatContext->streams[streamIndex];
+    for (unsigned int i = 0; i < formatContext->nb_streams; i++) {
+        if ((int)i != streamIndex) formatContext->streams[i]->discard = AVDISCARD_ALL;
+    }
 
-    while (av_read_frame(videoCtx.formatContext, packet) >= 0) {
-        if (packet->stream_index == videoCtx.videoStreamIndex) {
-            int retries = 0;
-            const int max_retries = 10;
-            while (retries < max_retries) {
-                int ret = avcodec_send_packet(videoCtx.videoCodecContext, packet);
-                if (ret == 0) {
-                    break; // Packet sent successfully
-                }
-                else if (ret == AVERROR(EAGAIN)) {
-                    logError("FFmpeg: Video decoder busy, retrying (%d/%d).", retries + 1, max_retries);
-                    SDL_Delay(5); // Increased delay to 5ms
-                    retries++;
-                    continue;
-                }
-                else {
-                    char errBuf[AV_ERROR_MAX_STRING_SIZE];
-                    av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
-                    logError("FFmpeg: Error sending video packet to decoder: %s", errBuf);
-                    av_packet_unref(packet);
-                    av_packet_free(&packet);
-                    return false;
-                }
-            }
-            if (retries >= max_retries) {
-                logError("FFmpeg: Video decoder busy after %d retries, skipping packet.", max_retries);
-                av_packet_unref(packet);
-                continue;
-            }
-
-            int ret = avcodec_receive_frame(videoCtx.videoCodecContext, videoCtx.decodedFrame);
-            if (ret == 0) {
-                sws_scale(videoCtx.swsContext,
-                    (const uint8_t* const*)videoCtx.decodedFrame->data, videoCtx.decodedFrame->linesize,
-                    0, videoCtx.videoCodecContext->height,
-                    videoCtx.rgbFrame->data, videoCtx.rgbFrame->linesize);
-
-                if (renderer && videoTexture) {
-                    if (*videoTexture == nullptr ||
-                        [&]() {
-                            int w, h;
-                            SDL_QueryTexture(*videoTexture, nullptr, nullptr, &w, &h);
-                            return w != videoCtx.videoCodecContext->width || h != videoCtx.videoCodecContext->height;
-                        }()) {
-                        if (*videoTexture) SDL_DestroyTexture(*videoTexture);
-                        *videoTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
-                            SDL_TEXTUREACCESS_STREAMING,
-                            videoCtx.videoCodecContext->width,
-                            videoCtx.videoCodecContext->height);
-                        if (!*videoTexture) {
-                            logError("FFmpeg: Failed to create SDL_Texture for video: %s", SDL_GetError());
-                            av_packet_unref(packet);
-                            av_packet_free(&packet);
-                            return false;
-                        }
-                    }
+    // Keyframes only, no deblocking, and the smallest lowres factor that still
+    // covers maxWidth; slice threads only, frame threads would just add delay
+    AVCodecContext* codecContext = avcodec_alloc_context3(codec);
+    if (!codecContext || avcodec_parameters_to_context(codecContext, stream->codecpar) < 0) {
+        avcodec_free_context(&codecContext);
+        avformat_close_input(&formatContext);
+        return false;
+    }
+    codecContext->skip_frame = AVDISCARD_NONKEY;
+    codecContext->skip_loop_filter = AVDISCARD_ALL;
+    codecContext->thread_type = FF_THREAD_SLICE;
+    codecContext->thread_count = 0;
+    int lowres = 0;
+    while (lowres < codec->max_lowres && (stream->codecpar->width >> (lowres + 1)) >= maxWidth) lowres++;
+    codecContext->lowres = lowres;
+    if (avcodec_open2(codecContext, codec, nullptr) < 0) {
+        logError("FFmpeg: Preview could not open the %s decoder.", codec->name);
+        avcodec_free_context(&codecContext);
+        avformat_close_input(&formatContext);
+        return false;
+    }
 
-                    if (SDL_UpdateTexture(*videoTexture, nullptr, videoCtx.rgbBuffer, videoCtx.rgbFrame->linesize[0]) != 0) {
-                        logError("FFmpeg: Failed to update SDL_Texture for video: %s", SDL_GetError());
-                    }
-                }
-                av_packet_unref(packet);
-                av_packet_free(&packet);
-                return true;
-            }
-            else if (ret == AVERROR(EAGAIN)) {
-                av_packet_unref(packet);
-                continue;
-            }
-            else if (ret == AVERROR_EOF) {
-                logError("FFmpeg: Video decoder flushed, EOF reached.");
-                av_packet_unref(packet);
-                av_packet_free(&packet);
-                return false;
-            }
-            else {
-                char errBuf[AV_ERROR_MAX_STRING_SIZE];
-                av_make_error_string(errBuf, AV_ERROR_MAX_STRING_SIZE, ret);
-                logError("FFmpeg: Error receiving video frame from decoder: %s", errBuf);
-                av_packet_unref(packet);
-                av_packet_free(&packet);
-                return false;
-            }
+    double startTime = formatContext->start_time != AV_NOPTS_VALUE ? (double)formatContext->start_time / AV_TIME_BASE : 0.0;
+    double duration = formatContext->duration > 0 ? (double)formatContext->duration / AV_TIME_BASE : 0.0;
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    struct SwsContext* swsContext = nullptr;
+    size_t firstNew = frames.size();
+
+    for (int i = 0; i < count && packet && frame; i++) {
+        // Middle of each of `count` equal spans; without a duration, consecutive keyframes
+        if (duration > 0.0) {
+            double target = startTime + duration * (i + 0.5) / count;
+            int64_t timestamp = (int64_t)(target / av_q2d(stream->time_base));
+            if (av_seek_frame(formatContext, streamIndex, timestamp, AVSEEK_FLAG_BACKWARD) < 0) continue;
         }
-        av_packet_unref(packet);
+        if (!decodePreviewKeyframe(formatContext, codecContext, streamIndex, packet, frame)) continue;
+
+        int width = std::min(maxWidth, frame->width);
+        int height = std::max(1, (int)((int64_t)frame->height * width / frame->width));
+        swsContext = sws_getCachedContext(swsContext, frame->width, frame->height, (AVPixelFormat)frame->format,
+            width, height, AV_PIX_FMT_RGBA, SWS_AREA, nullptr, nullptr, nullptr);
+        unsigned char* pixels = static_cast<unsigned char*>(malloc((size_t)width * height * 4));
+        if (!swsContext || !pixels) {
+            free(pixels);
+            av_frame_unref(frame);
+            continue;
+        }
+        uint8_t* dst[4] = { pixels, nullptr, nullptr, nullptr };
+        int dstStride[4] = { width * 4, 0, 0, 0 };
+        sws_scale(swsContext, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+        av_frame_unref(frame);
+
+        ImageData image;
+        image.pixels = pixels;
+        image.width = width;
+        image.height = height;
+        image.channels = 4;
+        frames.push_back(image);
     }
 
+    sws_freeContext(swsContext);
+    av_frame_free(&frame);
     av_packet_free(&packet);
-    return false;
-}
-
+    avcodec_free_context(&codecContext);
+    avformat_close_input(&formatContext);
 
+    double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    logError("FFmpeg: Preview: %zu of %d keyframes (%s, lowres %d) in %.1f ms.",
+        frames.size() - firstNew, count, codec->name, lowres, ms);
+    return frames.size() > firstNew;
+}
 
+bool openAudioStream(const char* filePath, VideoContext& videoCtx) {
+    videoCtx.audioOnly = true;
+    return openVideoFile(filePath, videoCtx);
+}
 
+// Playback position of an audio-only stream: the ring's clock base plus what
+// has been read out of it since. Right after a seek the base is already new
+// but the reader has not skipped the discarded bytes yet; until it has, the
+// position is the base itself.
+double getAudioStreamPosition(const VideoContext& videoCtx) {
+    const AudioRing& ring = videoCtx.audioRing;
+    int bytesPerSecond = videoCtx.obtainedAudioSpec.freq * videoCtx.obtainedAudioSpec.channels * 2;
+    if (bytesPerSecond <= 0 || ring.serial.load() < 0) return videoCtx.startTime;
+    uint64_t base = ring.baseIndex.load();
+    uint64_t read = ring.readIndex.load();
+    if (!ring.primed.load() || read < std::max(base, ring.discardIndex.load())) return ring.basePts.load();
+    uint64_t played = std::max(read, base) - base;
+    return ring.basePts.load() + ring.baseTempo.load() * (double)played / bytesPerSecond;
+}
 
+double measureTimeToFirstFrame(const char* filePath, const VideoDecoderOptions& options, const MediaReaderOptions& readerOptions) {
+    std::unique_ptr<VideoContext> videoCtx(new VideoContext());
+    videoCtx->decoderOptions = options;
+    videoCtx->readerOptions = readerOptions;
+    if (!openVideoFile(filePath, *videoCtx)) {
+        return -1.0;
+    }
+    // No renderer here, so the first frame ready for upload stands in for the
+    // first frame on screen
+    double ms = -1.0;
+    while (true) {
+        double elapsed = (double)(SDL_GetPerformanceCounter() - videoCtx->openStartCounter) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+        if (videoCtx->frameRing.occupancy() > 0) {
+            ms = elapsed;
+            break;
+        }
+        if (elapsed > 10000.0 || videoCtx->decodeFinished.load()) break;
+        SDL_Delay(1);
+    }
+    closeVideoFile(*videoCtx);
+    return ms;
+}
 
-    extern "C" void audioCallback(void* userdata, uint8_t * stream, int len) {
-        VideoContext* videoCtx = static_cast<VideoContext*>(userdata);
-        logError("FFmpeg: audioCallback entered. Requested len: %d, Current audioBufferPos: %u, audioBufferSize: %u",
-            len, videoCtx ? videoCtx->audioBufferPos : -1, videoCtx ? videoCtx->audioBufferSize : -1);
+// The decoder is set up as openVideoDecoder does, on its own demuxer with
+// every other stream discarded; the timing covers demux and decode only
+double measureDecodeFps(const char* filePath, const VideoDecoderOptions& options, int frames) {
+    AVFormatContext* formatContext = nullptr;
+    if (avformat_open_input(&formatContext, filePath, nullptr, nullptr) != 0) {
+        logError("FFmpeg: Decode benchmark could not open %s", filePath);
+        return -1.0;
+    }
+    if (avformat_find_stream_info(formatContext, nullptr) < 0) {
+        avformat_close_input(&formatContext);
+        return -1.0;
+    }
+    int streamIndex = defaultTrack(listMediaTracks(formatContext), AVMEDIA_TYPE_VIDEO);
+    if (streamIndex < 0) {
+        avformat_close_input(&formatContext);
+        return -1.0;
+    }
+    for (unsigned int i = 0; i < formatContext->nb_streams; i++) {
+        if ((int)i != streamIndex) formatContext->streams[i]->discard = AVDISCARD_ALL;
+    }
+    AVCodecParameters* params = formatContext->streams[streamIndex]->codecpar;
+    const AVCodec* codec = findVideoDecoder(options, params->codec_id);
+    AVCodecContext* codecContext = codec ? avcodec_alloc_context3(codec) : nullptr;
+    bool ok = codecContext && avcodec_parameters_to_context(codecContext, params) >= 0;
+    if (ok) {
+        applyDecoderThreading(options, codecContext);
+        ok = avcodec_open2(codecContext, codec, nullptr) >= 0;
+    }
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    ok = ok && packet && frame;
+
+    int decoded = 0;
+    bool draining = false;
+    Uint64 start = SDL_GetPerformanceCounter();
+    while (ok && decoded < frames) {
+        int ret = avcodec_receive_frame(codecContext, frame);
+        if (ret == 0) {
+            decoded++;
+            av_frame_unref(frame);
+            continue;
+        }
+        if (ret != AVERROR(EAGAIN) || draining) break;
+        if (av_read_frame(formatContext, packet) < 0) {
+            avcodec_send_packet(codecContext, nullptr);   // End of file: drain what the threads hold
+            draining = true;
+            continue;
+        }
+        if (packet->stream_index == streamIndex) avcodec_send_packet(codecContext, packet);
+        av_packet_unref(packet);
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
 
-        SDL_memset(stream, 0, len);
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&codecContext);
+    avformat_close_input(&formatContext);
+    return decoded > 0 && seconds > 0.0 ? decoded / seconds : -1.0;
+}
 
-        if (!videoCtx || !videoCtx->audioDevice || videoCtx->audioBufferAllocatedSize == 0 || !videoCtx->audioBuffer) {
-            logError("FFmpeg: audioCallback returning early: context/device/buffer invalid. videoCtx: %p, audioDevice: %u, allocatedSize: %u, audioBuffer: %p",
-                (void*)videoCtx,
-                videoCtx ? videoCtx->audioDevice : 0,
-                videoCtx ? videoCtx->audioBufferAllocatedSize : 0,
-                videoCtx ? (void*)videoCtx->audioBuffer : (void*)nullptr);
-            return;
+// Synthetic 4:2:0 source with a gradient in every plane, converted over and
+// over into one slot; the first conversion sets up the context and buffer
+// and is not timed
+double measureScaleCost(int srcWidth, int srcHeight, int dstWidth, int dstHeight, bool yuvOutput,
+    const VideoDecoderOptions& options, int frames) {
+    AVFrame* source = av_frame_alloc();
+    if (!source) return -1.0;
+    source->width = srcWidth;
+    source->height = srcHeight;
+    source->format = AV_PIX_FMT_YUV420P;
+    if (av_frame_get_buffer(source, 32) < 0) {
+        av_frame_free(&source);
+        return -1.0;
+    }
+    for (int plane = 0; plane < 3; plane++) {
+        int width = plane == 0 ? srcWidth : (srcWidth + 1) / 2;
+        int height = plane == 0 ? srcHeight : (srcHeight + 1) / 2;
+        for (int y = 0; y < height; y++) {
+            uint8_t* row = source->data[plane] + (size_t)y * source->linesize[plane];
+            for (int x = 0; x < width; x++) row[x] = (uint8_t)(x + y * (plane + 1));
         }
+    }
 
-        uint32_t amountToCopy;
-        int currentStreamPos = 0;
-
-        while (currentStreamPos < len) {
-            if (videoCtx->audioBufferPos >= videoCtx->audioBufferSize) {
-                logError("FFmpeg: audioCallback needs more audio data (bufferPos %u >= bufferSize %u). Calling decodeNextAudioPacket.",
-                    videoCtx->audioBufferPos, videoCtx->audioBufferSize);
+    int flags = (dstWidth == srcWidth && dstHeight == srcHeight) ? SWS_POINT : SWS_FAST_BILINEAR;
+    struct SwsContext* context = nullptr;
+    VideoFrameSlot slot;
+    std::atomic<uint64_t> allocations{ 0 };
+    bool ok = true;
+    Uint64 start = 0;
+    for (int i = 0; i <= frames && ok; i++) {
+        if (i == 1) start = SDL_GetPerformanceCounter();
+        ok = convertIntoSlot(&context, source, dstWidth, dstHeight, flags, convertThreadCount(options), yuvOutput, slot, allocations);
+    }
+    double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
 
-                videoCtx->audioBufferPos = 0;
-                videoCtx->audioBufferSize = 0;
+    av_frame_free(&slot.image);
+    sws_freeContext(context);
+    av_frame_free(&source);
+    return ok && frames > 0 ? ms / frames : -1.0;
+}
 
-                if (!decodeNextAudioPacket(*videoCtx)) {
-                    logError("FFmpeg: audioCallback: decodeNextAudioPacket failed or returned EOF/no data. No more audio data to provide for this request. Stream pos: %d, requested len: %d", currentStreamPos, len);
-                    return;
-                }
-                if (videoCtx->audioBufferSize == 0) {
-                    logError("FFmpeg: audioCallback: decodeNextAudioPacket succeeded but returned 0 bufferSize. No audio data. Stream pos: %d, requested len: %d", currentStreamPos, len);
-                    return;
-                }
-                logError("FFmpeg: audioCallback: decodeNextAudioPacket provided new data. New bufferSize: %u, audioBufferPos is %u.", videoCtx->audioBufferSize, videoCtx->audioBufferPos);
-            }
+static int64_t lostPackets(const PacketQueueStats& stats) {
+    return (int64_t)stats.packetsIn - (int64_t)stats.packetsOut - (int64_t)stats.packetsFlushed - stats.depth;
+}
 
-            amountToCopy = std::min(static_cast<uint32_t>(len - currentStreamPos), videoCtx->audioBufferSize - videoCtx->audioBufferPos);
+// Frames are taken straight off the frame ring, the way updateVideoPlayback
+// releases stale ones, and the audio ring is drained here instead of by the
+// output, so nothing paces the pipeline but decoding. Checks, per frame:
+// its serial is not newer than the queue's, after an accurate seek it is not
+// from before the target, and within a serial the position only goes forward.
+bool runDemuxStressTest(const char* filePath, int seeks) {
+    std::unique_ptr<VideoContext> videoCtx(new VideoContext());
+    if (!openVideoFile(filePath, *videoCtx)) {
+        logError("DemuxStress: Could not open %s", filePath);
+        return false;
+    }
+    if (videoCtx->audioEnabled) setAudioOutputSource(nullptr, nullptr);
+    videoCtx->fixedClockStep = videoCtx->frameDuration;   // No late-frame dropping
+    std::vector<uint8_t> audioScratch(64 * 1024);
+
+    const int framesPerSeek = 120;
+    VideoFrameRing& ring = videoCtx->frameRing;
+    Uint64 start = SDL_GetPerformanceCounter();
+    Uint64 lastProgress = start;
+    int frames = 0, staleFrames = 0, serialMismatches = 0, earlyFrames = 0, reversals = 0;
+    int seeksDone = 0, framesSinceSeek = 0;
+    int lastSerial = -1;
+    double lastPts = 0.0;
+    double accurateTarget = -1.0;
+    uint64_t audioBytes = 0;
+    bool reachedEnd = false;
 
-            if (amountToCopy == 0 && (videoCtx->audioBufferSize - videoCtx->audioBufferPos > 0)) {
-                logError("FFmpeg error: audioCallback: amountToCopy is 0 but data available in buffer (%u). This implies len - currentStreamPos is 0. Breaking.", videoCtx->audioBufferSize - videoCtx->audioBufferPos);
+    while (true) {
+        uint32_t drained;
+        while ((drained = videoCtx->audioRing.read(audioScratch.data(), (uint32_t)audioScratch.size())) > 0) audioBytes += drained;
+
+        bool seekInFlight = videoCtx->seekRequests.load() != videoCtx->seeksCompleted.load();
+        int serial = videoCtx->videoQueue.serial();
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (ring.occupancy() == 0) {
+            if (!seekInFlight && (videoCtx->decodeFinished.load() ||
+                (videoCtx->videoEofSerial.load() == serial && videoCtx->decodedRing.occupancy() == 0))) {
+                reachedEnd = true;
                 break;
             }
-            if (amountToCopy == 0 && (videoCtx->audioBufferSize - videoCtx->audioBufferPos == 0)) {
-                logError("FFmpeg error: audioCallback: amountToCopy is 0 and internal buffer is also consumed. Will try to decode next audio packet.");
-                if (videoCtx->audioBufferPos >= videoCtx->audioBufferSize) continue;
-                else break;
+            if ((double)(now - lastProgress) / (double)SDL_GetPerformanceFrequency() > 10.0) {
+                logError("DemuxStress: FAIL no frame for 10 s after %d frames (seek in flight: %s).", frames, seekInFlight ? "yes" : "no");
+                break;
             }
+            SDL_Delay(1);
+            continue;
+        }
+        lastProgress = now;
 
-            logError("FFmpeg: audioCallback: Before SDL_memcpy - amountToCopy: %u, audioBufferPos: %u, audioBufferSize: %u, debugPos: %d",
-                amountToCopy, videoCtx->audioBufferPos, videoCtx->audioBufferSize, currentStreamPos);
-
-            if (videoCtx->audioBuffer + videoCtx->audioBufferPos == nullptr) {
-                logError("FFmpeg error: Failed to critical FFmpeg error: videoCtx->audioBuffer + videoCtx->bufferPos is NULL before memcpy!");
-                return;
+        uint32_t read = ring.readIndex.load(std::memory_order_relaxed);
+        VideoFrameSlot& slot = ring.slots[read % VIDEO_FRAME_RING_SIZE];
+        if (slot.serial > serial) {
+            serialMismatches++;
+            logError("DemuxStress: Frame at %.3f s has serial %d, queue is at %d.", slot.pts, slot.serial, serial);
+        }
+        if (seekInFlight || slot.serial != serial) {
+            staleFrames++;
+        }
+        else {
+            if (slot.serial == lastSerial && slot.pts < lastPts) reversals++;
+            if (slot.serial != lastSerial && accurateTarget >= 0.0 && slot.pts + videoCtx->frameDuration < accurateTarget) {
+                earlyFrames++;
+                logError("DemuxStress: First frame after the seek to %.3f s is at %.3f s.", accurateTarget, slot.pts);
             }
-            if (stream + currentStreamPos == nullptr) {
-                logError("FFmpeg error: Failed to FFmpeg error: critical: stream + currentStreamPos is NULL before memcpy!");
-                return;
+            lastSerial = slot.serial;
+            lastPts = slot.pts;
+            frames++;
+            framesSinceSeek++;
+        }
+        av_frame_unref(slot.frame);
+        ring.readIndex.store(read + 1, std::memory_order_release);
+
+        if (seeksDone < seeks && framesSinceSeek >= framesPerSeek && videoCtx->duration > 0.0) {
+            // Spread over the file, forward and back; accurate and keyframe seeks alternate
+            double target = videoCtx->startTime + videoCtx->duration * (5 + (seeksDone * 37) % 85) / 100.0;
+            bool accurate = seeksDone % 2 == 0;
+            seekVideo(*videoCtx, target, accurate);
+            accurateTarget = accurate ? target : -1.0;
+            seeksDone++;
+            framesSinceSeek = 0;
+        }
+    }
+
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+    PacketQueueStats vq = videoCtx->videoQueue.stats();
+    PacketQueueStats aq = videoCtx->audioQueue.stats();
+    int64_t lostVideo = lostPackets(vq);
+    int64_t lostAudio = lostPackets(aq);
+    closeVideoFile(*videoCtx);
+
+    logError("DemuxStress: %d frames, %d seeks, %.1f MB of audio in %.1f s; %d stale frames released.",
+        frames, seeksDone, audioBytes / 1048576.0, seconds, staleFrames);
+    logError("DemuxStress: Video queue peak %d packets / %.1f MB, %llu in, %llu out, %llu flushed; audio queue peak %d packets / %.1f MB, %llu in, %llu out, %llu flushed.",
+        vq.maxDepth, vq.maxBytesQueued / 1048576.0, (unsigned long long)vq.packetsIn, (unsigned long long)vq.packetsOut, (unsigned long long)vq.packetsFlushed,
+        aq.maxDepth, aq.maxBytesQueued / 1048576.0, (unsigned long long)aq.packetsIn, (unsigned long long)aq.packetsOut, (unsigned long long)aq.packetsFlushed);
+    bool passed = reachedEnd && lostVideo == 0 && lostAudio == 0 && serialMismatches == 0 && earlyFrames == 0 && reversals == 0;
+    logError("DemuxStress: %s (end reached: %s, lost packets: video %lld, audio %lld, serial mismatches %d, frames before an accurate target %d, position reversals %d).",
+        passed ? "PASSED" : "FAILED", reachedEnd ? "yes" : "no", (long long)lostVideo, (long long)lostAudio,
+        serialMismatches, earlyFrames, reversals);
+    return passed;
+}
+
+// Counters at one point of a playback run; the run reports the difference
+// between the end of the warm-up and the end
+static void samplePlayback(VideoContext& videoCtx, VideoPlaybackRun& sample) {
+    double toMs = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    sample.presentedFrames = videoCtx.presentedFrames;
+    sample.droppedFrames = videoCtx.droppedFrames.load();
+    sample.repeatedFrames = videoCtx.repeatedFrames;
+    sample.decodedFrames = videoCtx.decodedFrameCount.load();
+    sample.convertedFrames = videoCtx.convertedFrameCount.load();
+    sample.decodeMs = (double)videoCtx.decodeTicks.load() * toMs;
+    sample.convertMs = (double)videoCtx.convertTicks.load() * toMs;
+    sample.audioUnderruns = videoCtx.audioRing.underruns.load();
+    MediaReaderStats io = videoCtx.reader.stats();
+    sample.readerStalls = io.stalls;
+    sample.readerStallMs = io.stallMs;
+    sample.allocations = videoCtx.videoQueue.stats().shellAllocations + videoCtx.audioQueue.stats().shellAllocations +
+        videoCtx.bufferAllocations.load();
+}
+
+// The render loop is stood in for by updateVideoPlayback once per display
+// refresh (real time) or back to back with the headless fixed clock step.
+// The warm-up and the measured span are in stream time from the first frame.
+bool runVideoPlayback(const char* filePath, const VideoPlaybackSetup& setup, SDL_Renderer* renderer, VideoPlaybackRun& run) {
+    run = VideoPlaybackRun();
+    std::unique_ptr<VideoContext> videoCtx(new VideoContext());
+    videoCtx->decoderOptions = setup.decoderOptions;
+    videoCtx->readerOptions = setup.readerOptions;
+    if (!openVideoFile(filePath, *videoCtx)) {
+        logError("PlaybackRun: Could not open %s", filePath);
+        return false;
+    }
+    setVideoTargetSize(*videoCtx, setup.targetWidth, setup.targetHeight);
+    std::vector<uint8_t> audioScratch;
+    if (!setup.realTime) {
+        // Every frame is shown and the audio ring is drained here, so
+        // nothing paces the pipeline but decoding
+        if (videoCtx->audioEnabled) setAudioOutputSource(nullptr, nullptr);
+        videoCtx->fixedClockStep = videoCtx->frameDuration;
+        audioScratch.resize(64 * 1024);
+    }
+    run.hasAudio = setup.realTime && videoCtx->audioEnabled;
+    run.width = videoCtx->videoCodecContext->width;
+    run.height = videoCtx->videoCodecContext->height;
+    run.frameDuration = videoCtx->frameDuration;
+
+    SDL_Texture* texture = nullptr;
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 start = SDL_GetPerformanceCounter();
+    Uint64 measureStart = start;
+    double timeout = (setup.warmupSeconds + setup.seconds) * (setup.realTime ? 2.0 : 20.0) + 10.0;
+    double firstClock = -1.0;
+    bool measuring = false;
+    VideoPlaybackRun warm;
+    while (true) {
+        while (!audioScratch.empty() && videoCtx->audioRing.read(audioScratch.data(), (uint32_t)audioScratch.size()) > 0) {}
+        if (!updateVideoPlayback(*videoCtx, &texture, renderer)) {
+            run.reachedEnd = true;
+            break;
+        }
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (videoCtx->hasShownFrame) {
+            double clock = getMasterClock(*videoCtx);
+            if (firstClock < 0.0) firstClock = clock;
+            if (!measuring && clock - firstClock >= setup.warmupSeconds) {
+                samplePlayback(*videoCtx, warm);
+                measureStart = now;
+                measuring = true;
             }
+            if (measuring && clock - firstClock >= setup.warmupSeconds + setup.seconds) break;
+        }
+        if ((double)(now - start) / (double)frequency > timeout) {
+            logError("PlaybackRun: Stopped after %.0f s without reaching the end of the run.", timeout);
+            break;
+        }
+        if (setup.realTime) SDL_Delay(16);   // One display refresh
+    }
+    if (!measuring) logError("PlaybackRun: %s ended during the warm-up; counting from the start.", filePath);
+
+    VideoPlaybackRun end;
+    samplePlayback(*videoCtx, end);
+    run.seconds = (double)(SDL_GetPerformanceCounter() - measureStart) / (double)frequency;
+    run.presentedFrames = end.presentedFrames - warm.presentedFrames;
+    run.droppedFrames = end.droppedFrames - warm.droppedFrames;
+    run.repeatedFrames = end.repeatedFrames - warm.repeatedFrames;
+    run.decodedFrames = end.decodedFrames - warm.decodedFrames;
+    run.convertedFrames = end.convertedFrames - warm.convertedFrames;
+    run.decodeMs = end.decodeMs - warm.decodeMs;
+    run.convertMs = end.convertMs - warm.convertMs;
+    run.audioUnderruns = end.audioUnderruns - warm.audioUnderruns;
+    run.readerStalls = end.readerStalls - warm.readerStalls;
+    run.readerStallMs = end.readerStallMs - warm.readerStallMs;
+    run.allocations = end.allocations - warm.allocations;
+
+    if (texture) SDL_DestroyTexture(texture);
+    closeVideoFile(*videoCtx);
+    return true;
+}
+
+// Timing starts after stream analysis, which both modes share
+bool measureDemuxCost(const char* filePath, bool selectedOnly, DemuxCost& cost) {
+    cost = DemuxCost();
+    AVFormatContext* formatContext = nullptr;
+    if (avformat_open_input(&formatContext, filePath, nullptr, nullptr) != 0) {
+        logError("FFmpeg: Demux benchmark could not open %s", filePath);
+        return false;
+    }
+    if (avformat_find_stream_info(formatContext, nullptr) < 0) {
+        logError("FFmpeg: Demux benchmark could not find stream info for %s", filePath);
+        avformat_close_input(&formatContext);
+        return false;
+    }
+    if (selectedOnly) {
+        std::vector<MediaTrack> tracks = listMediaTracks(formatContext);
+        int video = defaultTrack(tracks, AVMEDIA_TYPE_VIDEO);
+        int audio = defaultTrack(tracks, AVMEDIA_TYPE_AUDIO);
+        int subtitle = defaultTrack(tracks, AVMEDIA_TYPE_SUBTITLE);
+        for (unsigned int i = 0; i < formatContext->nb_streams; i++) {
+            bool selected = (int)i == video || (int)i == audio || (int)i == subtitle;
+            formatContext->streams[i]->discard = selected ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+        }
+    }
+
+    int64_t analyzedBytes = formatContext->pb ? formatContext->pb->bytes_read : 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    AVPacket* packet = av_packet_alloc();
+    while (packet && av_read_frame(formatContext, packet) >= 0) {
+        cost.packets++;
+        cost.packetBytes += packet->size;
+        av_packet_unref(packet);
+    }
+    cost.ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    cost.bytesRead = formatContext->pb ? formatContext->pb->bytes_read - analyzedBytes : 0;
+    av_packet_free(&packet);
+    avformat_close_input(&formatContext);
+    return true;
+}
 
-            SDL_memcpy(stream + currentStreamPos, videoCtx->audioBuffer + videoCtx->audioBufferPos, amountToCopy);
+    // Video audio source for the shared output, called on SDL's audio thread
+    // after Mix_ has mixed music and sounds into `stream`. Mixes out of
+    // audioRing and nothing else: no decoding, locks or logging here; misses
+    // are counted, not reported.
+    extern "C" void audioCallback(void* userdata, uint8_t * stream, int len) {
+        VideoContext* videoCtx = static_cast<VideoContext*>(userdata);
+        AudioRing& ring = videoCtx->audioRing;
 
-            videoCtx->audioBufferPos += amountToCopy;
-            currentStreamPos += amountToCopy;
-            logError("FFmpeg: audioCallback: After SDL_memcpy - new audioBufferPos: %u, currentStreamPos: %d, requested len: %d, remaining in stream: %d",
-                videoCtx->audioBufferPos, currentStreamPos, len, len - currentStreamPos);
+        // Audio from before a seek is stale: nothing until the decode thread
+        // has started the ring on the new serial
+        if (ring.capacity == 0 || videoCtx->paused.load() || videoCtx->seekRequests.load() != videoCtx->seeksCompleted.load() ||
+            ring.serial.load(std::memory_order_acquire) != videoCtx->audioQueue.serial()) {
+            return;
         }
 
-        logError("FFmpeg: audioCallback exiting. Filled audio stream successfully. Total copied: %d", currentStreamPos);
-    }
\ No newline at end of file
+        uint32_t wanted = (uint32_t)len;
+        uint32_t got = 0;
+        uint32_t fill = ring.fill();
+        while (got < wanted) {
+            uint32_t chunk = ring.read(videoCtx->audioMixBuffer, std::min(wanted - got, videoCtx->audioMixBufferSize));
+            if (chunk == 0) break;
+            SDL_MixAudioFormat(stream + got, videoCtx->audioMixBuffer, AUDIO_S16SYS, chunk, SDL_MIX_MAXVOLUME);
+            got += chunk;
+        }
+        if (fill < ring.minFill.load(std::memory_order_relaxed)) ring.minFill.store(fill, std::memory_order_relaxed);
+        if (got < wanted && ring.primed.load() && !videoCtx->audioFinished.load()) ring.underruns++;
+        if (!ring.primed.load()) return;
+
+        // Audio master clock: position of the next byte to hand out, minus what
+        // the output has queued ahead of the speaker (measured there)
+        int bytesPerSecond = videoCtx->obtainedAudioSpec.freq * videoCtx->obtainedAudioSpec.channels * 2;
+        if (bytesPerSecond > 0) {
+            // Ring data is time-stretched by baseTempo, and so is what is still queued
+            double tempo = ring.baseTempo.load();
+            uint64_t played = ring.readIndex.load(std::memory_order_relaxed) - ring.baseIndex.load();
+            double position = ring.basePts.load() + tempo * (double)played / bytesPerSecond;
+            videoCtx->audioClockPts.store(position - tempo * getAudioOutputLatency());
+            videoCtx->audioClockCounter.store(SDL_GetPerformanceCounter());
+            videoCtx->audioClockValid.store(true);
+        }
+    }
@@ -0,0 +1,248 @@
+#define NOMINMAX
+#include "Header.h"
+#include <algorithm>
+
+// Read-ahead file input for the demuxer.
+// FFmpeg's file protocol issues small synchronous reads on the demux thread,
+// so every network hiccup on a share becomes a stall in playback. MediaReader
+// hands FFmpeg a custom AVIOContext instead:
+//  - local files are memory-mapped and read straight from the mapping;
+//  - everything else (remote drives, UNC paths, or a failed mapping) goes
+//    through a ring filled by a background reader thread, which keeps up to
+//    cacheBytes ahead of the demuxer and a little behind it for short
+//    backward seeks.
+// Reads that find the ring empty are counted and timed as stalls.
+
+static const size_t READ_CHUNK = 256 * 1024;
+static const int AVIO_BUFFER_SIZE = 64 * 1024;
+
+static bool isLocalPath(const std::wstring& path) {
+    if (path.size() >= 2 && (path[0] == L'\\' || path[0] == L'/') && (path[1] == L'\\' || path[1] == L'/')) {
+        return false;   // UNC share
+    }
+    if (path.size() < 3 || path[1] != L':') return true;
+    wchar_t root[4] = { path[0], L':', L'\\', L'\0' };
+    UINT driveType = GetDriveTypeW(root);
+    return driveType == DRIVE_FIXED || driveType == DRIVE_RAMDISK;
+}
+
+MediaReader::~MediaReader() {
+    close();
+}
+
+bool MediaReader::open(const char* path, const MediaReaderOptions& readerOptions) {
+    close();
+    options = readerOptions;
+    std::wstring widePath = str_to_wstr(path);
+    local = isLocalPath(widePath);
+    file = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+        local ? FILE_ATTRIBUTE_NORMAL : FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        logError("MediaReader: Could not open %s (error %lu)", path, GetLastError());
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        logError("MediaReader: Could not get the size of %s", path);
+        close();
+        return false;
+    }
+    fileSize = size.QuadPart;
+
+    if (local && options.allowMap && fileSize > 0 && (uint64_t)fileSize <= (uint64_t)SIZE_MAX) {
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) mapped = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!mapped && mapping) {
+            CloseHandle(mapping);
+            mapping = nullptr;
+        }
+    }
+
+    if (!mapped) {
+        ring.resize(std::max(options.cacheBytes, READ_CHUNK * 4));
+        stop = false;
+        readerThread = std::thread(&MediaReader::readerMain, this);
+    }
+
+    uint8_t* avioBuffer = static_cast<uint8_t*>(av_malloc(AVIO_BUFFER_SIZE));
+    avioContext = avioBuffer ? avio_alloc_context(avioBuffer, AVIO_BUFFER_SIZE, 0, this, readPacket, nullptr, seekCallback) : nullptr;
+    if (!avioContext) {
+        av_free(avioBuffer);
+        logError("MediaReader: Could not allocate the AVIOContext.");
+        close();
+        return false;
+    }
+    logError("MediaReader: %s, %lld bytes, %s.", path, (long long)fileSize,
+        mapped ? "memory-mapped" : (local ? "read-ahead (mapping failed)" : "read-ahead (remote)"));
+    return true;
+}
+
+void MediaReader::close() {
+    if (readerThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        changed.notify_all();
+        readerThread.join();
+    }
+    if (avioContext) {
+        av_freep(&avioContext->buffer);
+        avio_context_free(&avioContext);
+    }
+    if (mapped) {
+        UnmapViewOfFile(mapped);
+        mapped = nullptr;
+    }
+    if (mapping) {
+        CloseHandle(mapping);
+        mapping = nullptr;
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+    }
+    std::vector<uint8_t>().swap(ring);
+    local = false;
+    fileSize = 0;
+    position = 0;
+    windowStart = 0;
+    fillEnd = 0;
+    generation = 0;
+    readError = false;
+    counters = MediaReaderStats();
+}
+
+MediaReaderStats MediaReader::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    MediaReaderStats result = counters;
+    result.mapped = mapped != nullptr;
+    result.cacheBytes = mapped ? 0 : ring.size();
+    result.cached = mapped ? 0 : (size_t)std::max<int64_t>(0, fillEnd - position);
+    return result;
+}
+
+// Background reader: appends to the ring while there is room ahead of the
+// consumer, keeping the eighth of the ring behind it for backward seeks.
+// The file read itself runs unlocked into space already cut off from the
+// window, so the consumer never sees a half-written chunk.
+void MediaReader::readerMain() {
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+    const int64_t capacity = (int64_t)ring.size();
+    const int64_t keepBehind = capacity / 8;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stop) {
+        int64_t low = std::max(windowStart, position - keepBehind);
+        int64_t space = capacity - (fillEnd - low);
+        if (fillEnd >= fileSize || readError || space < (int64_t)std::min<size_t>(READ_CHUNK, (size_t)(fileSize - fillEnd))) {
+            changed.wait(lock);
+            continue;
+        }
+
+        int64_t offset = fillEnd;
+        size_t length = (size_t)std::min<int64_t>({ (int64_t)READ_CHUNK, space, fileSize - offset });
+        size_t ringOffset = (size_t)(offset % capacity);
+        length = std::min(length, (size_t)capacity - ringOffset);   // No wrap inside one ReadFile
+        windowStart = std::max(windowStart, offset + (int64_t)length - capacity);
+        int startGeneration = generation;
+        lock.unlock();
+
+        Uint64 readStart = SDL_GetPerformanceCounter();
+        LARGE_INTEGER seekTo;
+        seekTo.QuadPart = offset;
+        DWORD got = 0;
+        bool ok = SetFilePointerEx(file, seekTo, nullptr, FILE_BEGIN) &&
+            ReadFile(file, ring.data() + ringOffset, (DWORD)length, &got, nullptr);
+
+        if (ok && options.throttleKBps > 0) {
+            // Test hook: pretend to be a slow share. Each chunk takes as long
+            // as it would at that rate, so time spent idle with a full ring
+            // never turns into a burst afterwards.
+            double due = (double)got / (options.throttleKBps * 1024.0);
+            double elapsed = (double)(SDL_GetPerformanceCounter() - readStart) / (double)SDL_GetPerformanceFrequency();
+            if (due > elapsed) SDL_Delay((Uint32)((due - elapsed) * 1000.0));
+        }
+
+        lock.lock();
+        if (generation != startGeneration) continue;   // The consumer jumped elsewhere meanwhile
+        if (!ok || got == 0) {
+            readError = true;
+            logError("MediaReader: Read of %zu bytes at %lld failed (error %lu).", length, (long long)offset, GetLastError());
+        }
+        else {
+            fillEnd += got;
+            counters.bytesRead += got;
+        }
+        changed.notify_all();
+    }
+}
+
+int MediaReader::read(uint8_t* buffer, int size) {
+    if (mapped) {
+        int64_t left = fileSize - position;
+        if (left <= 0) return AVERROR_EOF;
+        int length = (int)std::min<int64_t>(size, left);
+        memcpy(buffer, mapped + position, length);
+        position += length;
+        return length;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (position >= fileSize) return AVERROR_EOF;
+    if (position >= fillEnd && !readError) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        counters.stalls++;
+        changed.wait(lock, [this] { return position < fillEnd || readError || stop; });
+        counters.stallMs += (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    }
+    if (position >= fillEnd) return readError ? AVERROR(EIO) : AVERROR_EXIT;
+
+    const size_t capacity = ring.size();
+    int length = (int)std::min<int64_t>(size, fillEnd - position);
+    size_t ringOffset = (size_t)(position % (int64_t)capacity);
+    size_t first = std::min((size_t)length, capacity - ringOffset);
+    memcpy(buffer, ring.data() + ringOffset, first);
+    memcpy(buffer + first, ring.data(), length - first);
+    position += length;
+    changed.notify_all();   // Room for the reader
+    return length;
+}
+
+// Targets inside the cached window (or just past it) are served from the
+// ring; anything else restarts the reader at the target.
+int64_t MediaReader::seek(int64_t offset, int whence) {
+    if (whence == AVSEEK_SIZE) return fileSize;
+    int64_t target;
+    switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET: target = offset; break;
+    case SEEK_CUR: target = position + offset; break;
+    case SEEK_END: target = fileSize + offset; break;
+    default: return AVERROR(EINVAL);
+    }
+    if (target < 0) return AVERROR(EINVAL);
+    if (mapped) {
+        position = target;
+        return target;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (target < windowStart || target > fillEnd + (int64_t)READ_CHUNK) {
+        windowStart = target;
+        fillEnd = target;
+        generation++;
+        readError = false;
+        counters.restarts++;
+    }
+    position = target;
+    changed.notify_all();
+    return target;
+}
+
+int MediaReader::readPacket(void* opaque, uint8_t* buffer, int size) {
+    return static_cast<MediaReader*>(opaque)->read(buffer, size);
+}
+
+int64_t MediaReader::seekCallback(void* opaque, int64_t offset, int whence) {
+    return static_cast<MediaReader*>(opaque)->seek(offset, whence);
+}
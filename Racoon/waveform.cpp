@@ -0,0 +1,414 @@
+#define NOMINMAX
+#include "Header.h"
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cmath>
+#include <cwctype>
+#include <stdio.h>
+
+// Waveform overview and live spectrum for the sound player.
+// The overview splits the file's columns into equal time segments and
+// decodes each on its own thread with its own demuxer and decoder, seeking
+// to the segment start and stopping at its end. Every segment accumulates
+// min, max and sum of squares for the columns it owns, so the threads share
+// nothing until the buckets are put together. Results are cached in
+// %TEMP%\Racoon\waveforms, keyed on path and column count and checked against
+// the file's size and last write time.
+//
+// The spectrum is an FFT over the most recent samples from the output tap
+// (audio.cpp), i.e. exactly what the device is being fed.
+
+static const uint32_t CACHE_MAGIC = 0x31465752;   // "RWF1"
+static const int MAX_SEGMENT_THREADS = 8;           // More readers than this just thrash the disk
+static const int SPECTRUM_SIZE = 2048;              // FFT points, a power of two
+static const float SPECTRUM_FLOOR_DB = -90.0f;
+
+struct ColumnAccumulator {
+    float min = 1.0f;
+    float max = -1.0f;
+    double sumSquares = 0.0;
+    uint64_t samples = 0;
+};
+
+struct CacheHeader {
+    uint32_t magic = CACHE_MAGIC;
+    int32_t columns = 0;
+    int64_t fileSize = 0;
+    uint64_t lastWrite = 0;
+    double duration = 0.0;
+    uint32_t pathLength = 0;       // wchar_t count of the path that follows
+};
+
+static bool openSegmentDecoder(const char* path, AVFormatContext** formatContext, AVCodecContext** codecContext, int* streamIndex) {
+    if (avformat_open_input(formatContext, path, nullptr, nullptr) != 0) return false;
+    const AVCodec* codec = nullptr;
+    if (avformat_find_stream_info(*formatContext, nullptr) >= 0) {
+        *streamIndex = av_find_best_stream(*formatContext, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0);
+    }
+    if (*streamIndex < 0 || !codec) return false;
+    for (unsigned int i = 0; i < (*formatContext)->nb_streams; i++) {
+        if ((int)i != *streamIndex) (*formatContext)->streams[i]->discard = AVDISCARD_ALL;
+    }
+    *codecContext = avcodec_alloc_context3(codec);
+    if (!*codecContext || avcodec_parameters_to_context(*codecContext, (*formatContext)->streams[*streamIndex]->codecpar) < 0) {
+        return false;
+    }
+    (*codecContext)->thread_count = 1;   // The segments are the parallelism
+    return avcodec_open2(*codecContext, codec, nullptr) >= 0;
+}
+
+// Decodes [firstColumn, endColumn) of the overview into columns[]. Samples
+// are downmixed to mono float by swr and placed by timestamp, so decoding
+// from the keyframe before the segment start only costs the discarded lead-in.
+static void decodeWaveformSegment(std::string path, double startTime, double duration, int totalColumns,
+    int firstColumn, int endColumn, ColumnAccumulator* columns, const std::atomic<bool>* cancel) {
+    AVFormatContext* formatContext = nullptr;
+    AVCodecContext* codecContext = nullptr;
+    int streamIndex = -1;
+    if (!openSegmentDecoder(path.c_str(), &formatContext, &codecContext, &streamIndex)) {
+        logError("Waveform: Could not open a decoder for %s", path.c_str());
+        avcodec_free_context(&codecContext);
+        avformat_close_input(&formatContext);
+        return;
+    }
+    AVStream* stream = formatContext->streams[streamIndex];
+    double timeBase = av_q2d(stream->time_base);
+    double columnsPerSecond = totalColumns / duration;
+    double segmentStart = startTime + firstColumn / columnsPerSecond;
+    if (firstColumn > 0) {
+        av_seek_frame(formatContext, streamIndex, (int64_t)(segmentStart / timeBase), AVSEEK_FLAG_BACKWARD);
+    }
+
+    SwrContext* swrContext = nullptr;
+    AVChannelLayout mono = AV_CHANNEL_LAYOUT_MONO;
+    int rate = codecContext->sample_rate;
+    if (swr_alloc_set_opts2(&swrContext, &mono, AV_SAMPLE_FMT_FLT, rate,
+        &codecContext->ch_layout, codecContext->sample_fmt, rate, 0, nullptr) < 0 || swr_init(swrContext) < 0) {
+        logError("Waveform: Could not set up the mono downmix for %s", path.c_str());
+        swr_free(&swrContext);
+        avcodec_free_context(&codecContext);
+        avformat_close_input(&formatContext);
+        return;
+    }
+
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    std::vector<float> samples;
+    double nextTime = segmentStart;    // For frames without a timestamp
+    bool done = false;
+    bool draining = false;
+    while (!done && !cancel->load() && packet && frame) {
+        int ret = avcodec_receive_frame(codecContext, frame);
+        if (ret == AVERROR(EAGAIN)) {
+            if (draining) break;
+            if (av_read_frame(formatContext, packet) < 0) {
+                avcodec_send_packet(codecContext, nullptr);
+                draining = true;
+                continue;
+            }
+            if (packet->stream_index == streamIndex) avcodec_send_packet(codecContext, packet);
+            av_packet_unref(packet);
+            continue;
+        }
+        if (ret < 0) break;
+
+        double frameTime = frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp * timeBase : nextTime;
+        nextTime = frameTime + (double)frame->nb_samples / rate;
+        int maxCount = swr_get_out_samples(swrContext, frame->nb_samples);
+        if (nextTime > segmentStart && maxCount >= 0) {
+            samples.resize((size_t)maxCount);
+            uint8_t* out = reinterpret_cast<uint8_t*>(samples.data());
+            int count = swr_convert(swrContext, &out, (int)samples.size(), (const uint8_t**)frame->extended_data, frame->nb_samples);
+            for (int i = 0; i < count; i++) {
+                int column = (int)((frameTime - startTime + (double)i / rate) * columnsPerSecond);
+                if (column < firstColumn) continue;
+                if (column >= endColumn) {
+                    done = true;
+                    break;
+                }
+                float value = samples[i];
+                ColumnAccumulator& accumulator = columns[column];
+                accumulator.min = std::min(accumulator.min, value);
+                accumulator.max = std::max(accumulator.max, value);
+                accumulator.sumSquares += (double)value * value;
+                accumulator.samples++;
+            }
+        }
+        av_frame_unref(frame);
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    swr_free(&swrContext);
+    avcodec_free_context(&codecContext);
+    avformat_close_input(&formatContext);
+}
+
+static bool computeWaveform(const std::wstring& path, int columns, int threads, WaveformOverview& overview,
+    const std::atomic<bool>& cancel) {
+    std::string narrowPath = cc(path.c_str());
+    AVFormatContext* formatContext = nullptr;
+    if (avformat_open_input(&formatContext, narrowPath.c_str(), nullptr, nullptr) != 0) {
+        logError("Waveform: Could not open %s", narrowPath.c_str());
+        return false;
+    }
+    avformat_find_stream_info(formatContext, nullptr);
+    double startTime = formatContext->start_time != AV_NOPTS_VALUE ? (double)formatContext->start_time / AV_TIME_BASE : 0.0;
+    double duration = formatContext->duration > 0 ? (double)formatContext->duration / AV_TIME_BASE : 0.0;
+    avformat_close_input(&formatContext);
+    if (duration <= 0.0 || columns <= 0) {
+        logError("Waveform: %s has no known duration.", narrowPath.c_str());
+        return false;
+    }
+
+    if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+    threads = std::max(1, std::min({ threads, MAX_SEGMENT_THREADS, columns }));
+    std::vector<ColumnAccumulator> accumulators(columns);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        int firstColumn = (int)((int64_t)columns * i / threads);
+        int endColumn = (int)((int64_t)columns * (i + 1) / threads);
+        workers.emplace_back(decodeWaveformSegment, narrowPath, startTime, duration, columns,
+            firstColumn, endColumn, accumulators.data(), &cancel);
+    }
+    for (std::thread& worker : workers) worker.join();
+    if (cancel.load()) return false;
+
+    // Columns no sample landed in (short files, seeks that overshot) repeat
+    // their left neighbour rather than showing as silence
+    overview.path = path;
+    overview.duration = duration;
+    overview.buckets.assign(columns, WaveformBucket());
+    int filled = 0;
+    for (int i = 0; i < columns; i++) {
+        const ColumnAccumulator& accumulator = accumulators[i];
+        if (accumulator.samples == 0) {
+            if (i > 0) overview.buckets[i] = overview.buckets[i - 1];
+            continue;
+        }
+        WaveformBucket& bucket = overview.buckets[i];
+        bucket.min = accumulator.min;
+        bucket.max = accumulator.max;
+        bucket.rms = (float)std::sqrt(accumulator.sumSquares / accumulator.samples);
+        filled++;
+    }
+    return filled > 0;
+}
+
+bool computeWaveformOverview(const std::wstring& path, int columns, int threads, WaveformOverview& overview) {
+    std::atomic<bool> cancel{ false };
+    return computeWaveform(path, columns, threads, overview, cancel);
+}
+
+// Cache files: %TEMP%\Racoon\waveforms\<FNV-1a of the lowercased path>-<columns>.wfm
+static std::wstring waveformCachePath(const std::wstring& path, int columns) {
+    wchar_t tempDir[MAX_PATH];
+    DWORD length = GetTempPathW(MAX_PATH, tempDir);
+    if (length == 0 || length >= MAX_PATH) return std::wstring();
+    std::wstring dir = std::wstring(tempDir) + L"Racoon";
+    CreateDirectoryW(dir.c_str(), nullptr);
+    dir += L"\\waveforms";
+    CreateDirectoryW(dir.c_str(), nullptr);
+
+    uint64_t hash = 14695981039346656037ULL;
+    for (wchar_t ch : path) {
+        hash ^= (uint64_t)towlower(ch);
+        hash *= 1099511628211ULL;
+    }
+    wchar_t name[64];
+    swprintf(name, 64, L"\\%016llx-%d.wfm", (unsigned long long)hash, columns);
+    return dir + name;
+}
+
+static bool fileStamp(const std::wstring& path, int64_t* size, uint64_t* lastWrite) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) return false;
+    *size = ((int64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    *lastWrite = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
+
+static bool readWaveformCache(const std::wstring& path, int columns, WaveformOverview& overview) {
+    int64_t size = 0;
+    uint64_t lastWrite = 0;
+    std::wstring cachePath = waveformCachePath(path, columns);
+    if (cachePath.empty() || !fileStamp(path, &size, &lastWrite)) return false;
+    FILE* file = nullptr;
+    if (_wfopen_s(&file, cachePath.c_str(), L"rb") != 0 || !file) return false;
+
+    CacheHeader header;
+    std::wstring storedPath;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && header.magic == CACHE_MAGIC &&
+        header.columns == columns && header.fileSize == size && header.lastWrite == lastWrite &&
+        header.pathLength == path.size();
+    if (ok) {
+        storedPath.resize(header.pathLength);
+        ok = fread(&storedPath[0], sizeof(wchar_t), header.pathLength, file) == header.pathLength && storedPath == path;
+    }
+    if (ok) {
+        overview.buckets.resize(columns);
+        ok = fread(overview.buckets.data(), sizeof(WaveformBucket), columns, file) == (size_t)columns;
+    }
+    fclose(file);
+    if (!ok) return false;
+    overview.path = path;
+    overview.duration = header.duration;
+    return true;
+}
+
+static void writeWaveformCache(const WaveformOverview& overview) {
+    CacheHeader header;
+    std::wstring cachePath = waveformCachePath(overview.path, (int)overview.buckets.size());
+    if (cachePath.empty() || !fileStamp(overview.path, &header.fileSize, &header.lastWrite)) return;
+    header.columns = (int32_t)overview.buckets.size();
+    header.duration = overview.duration;
+    header.pathLength = (uint32_t)overview.path.size();
+
+    FILE* file = nullptr;
+    if (_wfopen_s(&file, cachePath.c_str(), L"wb") != 0 || !file) return;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(overview.path.data(), sizeof(wchar_t), overview.path.size(), file) == overview.path.size() &&
+        fwrite(overview.buckets.data(), sizeof(WaveformBucket), overview.buckets.size(), file) == overview.buckets.size();
+    fclose(file);
+    if (!ok) DeleteFileW(cachePath.c_str());   // Never leave a truncated entry behind
+}
+
+static bool loadWaveform(const std::wstring& path, int columns, WaveformOverview& overview, const std::atomic<bool>& cancel) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    bool cached = readWaveformCache(path, columns, overview);
+    if (!cached) {
+        if (!computeWaveform(path, columns, 0, overview, cancel)) return false;
+        writeWaveformCache(overview);
+    }
+    double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    logError("Waveform: %d columns for %s %s in %.1f ms.", columns, cc(path.c_str()).c_str(),
+        cached ? "read from cache" : "decoded", ms);
+    return true;
+}
+
+bool loadWaveformOverview(const std::wstring& path, int columns, WaveformOverview& overview) {
+    std::atomic<bool> cancel{ false };
+    return loadWaveform(path, columns, overview, cancel);
+}
+
+// One background request at a time: the sound player only ever wants the
+// overview of the track it is showing.
+struct WaveformJob {
+    std::thread worker;
+    std::atomic<bool> cancel{ false };
+    std::atomic<bool> ready{ false };
+    std::atomic<bool> failed{ false };   // No overview for this file (no duration or audio, decoder error); not retried
+    std::wstring path;
+    int columns = 0;
+    WaveformOverview result;       // Owned by the worker until ready
+};
+
+static WaveformJob g_waveformJob;
+
+void cancelWaveformOverview() {
+    if (g_waveformJob.worker.joinable()) {
+        g_waveformJob.cancel = true;
+        g_waveformJob.worker.join();
+    }
+    g_waveformJob.cancel = false;
+    g_waveformJob.ready = false;
+    g_waveformJob.failed = false;
+    g_waveformJob.path.clear();
+    g_waveformJob.result = WaveformOverview();
+}
+
+void requestWaveformOverview(const std::wstring& path, int columns) {
+    if (g_waveformJob.path == path && g_waveformJob.columns == columns) return;
+    cancelWaveformOverview();
+    g_waveformJob.path = path;
+    g_waveformJob.columns = columns;
+    g_waveformJob.worker = std::thread([path, columns]() {
+        SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+        if (loadWaveform(path, columns, g_waveformJob.result, g_waveformJob.cancel)) {
+            g_waveformJob.ready.store(true, std::memory_order_release);
+        }
+        else if (!g_waveformJob.cancel.load()) {
+            logError("Waveform: No overview for %s", cc(path.c_str()).c_str());
+            g_waveformJob.failed.store(true);
+        }
+    });
+}
+
+bool waveformOverviewFailed() {
+    return g_waveformJob.failed.load();
+}
+
+bool takeWaveformOverview(WaveformOverview& overview) {
+    if (!g_waveformJob.ready.load(std::memory_order_acquire)) return false;
+    g_waveformJob.ready = false;
+    overview = std::move(g_waveformJob.result);
+    g_waveformJob.result = WaveformOverview();
+    return true;
+}
+
+// In-place iterative radix-2 FFT; n is a power of two
+static void fft(float* re, float* im, int n) {
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            std::swap(re[i], re[j]);
+            std::swap(im[i], im[j]);
+        }
+    }
+    for (int length = 2; length <= n; length <<= 1) {
+        double angle = -2.0 * M_PI / length;
+        float wRe = (float)cos(angle), wIm = (float)sin(angle);
+        for (int i = 0; i < n; i += length) {
+            float curRe = 1.0f, curIm = 0.0f;
+            for (int k = 0; k < length / 2; k++) {
+                int a = i + k, b = i + k + length / 2;
+                float tRe = re[b] * curRe - im[b] * curIm;
+                float tIm = re[b] * curIm + im[b] * curRe;
+                re[b] = re[a] - tRe;
+                im[b] = im[a] - tIm;
+                re[a] += tRe;
+                im[a] += tIm;
+                float nextRe = curRe * wRe - curIm * wIm;
+                curIm = curRe * wIm + curIm * wRe;
+                curRe = nextRe;
+            }
+        }
+    }
+}
+
+// Log-spaced bands from 40 Hz to Nyquist, each the peak bin level mapped
+// from SPECTRUM_FLOOR_DB..0 dBFS onto 0..1.
+void computeAudioSpectrum(float* bands, int count) {
+    static float window[SPECTRUM_SIZE];
+    static bool windowReady = false;
+    if (!windowReady) {
+        for (int i = 0; i < SPECTRUM_SIZE; i++) window[i] = 0.5f - 0.5f * (float)cos(2.0 * M_PI * i / (SPECTRUM_SIZE - 1));
+        windowReady = true;
+    }
+    std::fill(bands, bands + count, 0.0f);
+    int rate = getAudioOutputInfo().frequency;
+    float re[SPECTRUM_SIZE], im[SPECTRUM_SIZE];
+    if (rate <= 0 || count <= 0 || !readAudioOutputTap(re, SPECTRUM_SIZE)) return;
+    for (int i = 0; i < SPECTRUM_SIZE; i++) {
+        re[i] *= window[i];
+        im[i] = 0.0f;
+    }
+    fft(re, im, SPECTRUM_SIZE);
+
+    const float scale = 4.0f / SPECTRUM_SIZE;    // Full-scale sine -> 1 (2/N, and 2 for the Hann window's gain)
+    const double lowHz = 40.0, highHz = rate / 2.0;
+    for (int band = 0; band < count; band++) {
+        double fromHz = lowHz * pow(highHz / lowHz, (double)band / count);
+        double toHz = lowHz * pow(highHz / lowHz, (double)(band + 1) / count);
+        int fromBin = std::max(1, (int)(fromHz * SPECTRUM_SIZE / rate));
+        int toBin = std::min(SPECTRUM_SIZE / 2, std::max(fromBin + 1, (int)(toHz * SPECTRUM_SIZE / rate)));
+        float peak = 0.0f;
+        for (int bin = fromBin; bin < toBin; bin++) {
+            peak = std::max(peak, std::sqrt(re[bin] * re[bin] + im[bin] * im[bin]) * scale);
+        }
+        float db = peak > 0.0f ? 20.0f * log10f(peak) : SPECTRUM_FLOOR_DB;
+        bands[band] = std::max(0.0f, std::min(1.0f, (db - SPECTRUM_FLOOR_DB) / -SPECTRUM_FLOOR_DB));
+    }
+}